@@ -10,77 +10,34 @@
 /*
 schema:
 
-calendar_dates
---------------
-service_id      integer (pk)
-date            integer (unix timestamp)
-exception_type  integer
-
-
-routes
--------
-route_id            integer (pk)
-agency_id           integer (join agency table)
-route_short_name    text
-route_long_name     text
-route_type          integer
-route_url           text
-route_color         text?
-
-stop_times
+The tables loaded from the feed's text files, and the field each column is read from,
+are declared in TableSchema.h.
+
+shape_geom (set_shape_geometry, instead of shape)
 ----------
-trip_id             integer (join trips)
-arrival_time        text (HH:MM:SS)
-departure_time      text (HH:MM:SS)
-stop_id             integer (join stops table)
-stop_sequence       integer
-pickup_type         integer
-drop_off_type       integer
-shape_dist_traveled real
-
-stops
-------
-stop_id             integer (pk)
-stop_code           integer
-stop_name           text
-stop_desc           text
-stop_lat            real
-stop_lon            real
-zone_id             integer
-
-trips
-------
-trip_id             integer (pk)
-route_id            integer
-service_id          integer
-trip_headsign       text
-direction_id        integer
-block_id            text
-shape_id            integer
-
-
-agency
--------
-agency_id           integer (pk)
-agency_name         text
-agency_url          text
-agency_timezone     text
-agency_lang         text
-agency_phone        text
-
-
-shapes
-------
 shape_id                integer (pk)
-shape_pt_lat            real
-shape_pt_lon            real
-shape_pt_sequence       integer
-shape_dist_traveled     real
+point_count             integer
+geom                    blob (ShapeGeometry encoding)
 
 
  */
 
 #include "BusDataLoader.h"
+#include "MappedFile.h"
+#include "ParallelCsvParser.h"
+#include "FieldDecoder.h"
+#include "ServiceCalendar.h"
+#include "SpatialIndex.h"
+#include "TextSearch.h"
+#include "QueryPlans.h"
+#include "StopDepartures.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <cmath>
+#include <set>
 
 const char *fn_calendarDates = "calendar_dates.txt";
 const char *fn_routes = "routes.txt";
@@ -92,6 +49,213 @@ const char *fn_agency = "agency.txt";
 
 using namespace std;
 
+// bytes of a file tokenized by one parse thread at a time
+static const size_t PARSE_CHUNK_SIZE = 4 * 1024 * 1024;
+
+const BusDataLoader::TableLoad BusDataLoader::table_loads[] = {
+        {"calendar_date", &BusDataLoader::load_calendar_dates},
+        {"route", &BusDataLoader::load_routes},
+        {"stop", &BusDataLoader::load_stops},
+        {"trip", &BusDataLoader::load_trips},
+        {"agency", &BusDataLoader::load_agency},
+        {"shape", &BusDataLoader::load_shapes},
+        {"stop_time", &BusDataLoader::load_stop_times},
+        {NULL, NULL}};
+
+// the GTFS files load_data reads, in the order of table_loads
+static const char *FEED_FILES[] = {fn_calendarDates, fn_routes, fn_stops, fn_trips, fn_agency, fn_shapes, fn_stopTimes};
+
+// a feed without one of these is broken; the other files may be left out
+static const char *REQUIRED_FILES[] = {fn_stops, fn_trips, fn_stopTimes};
+
+// the feed_meta row of loader_settings; never the name of a feed file
+static const char *SETTINGS_DIGEST = "loader settings";
+
+static const char *MEMORY_DATABASE = ":memory:";
+
+// database bytes per byte of GTFS text, indexes included (about 1.75 measured on a large feed)
+static const size_t DATABASE_SIZE_FACTOR = 2;
+
+// pages copied per sqlite3_backup_step when persisting an in-memory build
+static const int BACKUP_PAGES_PER_STEP = 16384;
+
+// how long a reload waits for other writers to start, and for readers to finish before it commits
+static const int RELOAD_BUSY_TIMEOUT_MS = 30000;
+
+// rows per multi-row INSERT; past a few dozen the per-statement overhead is already gone
+static const size_t DEFAULT_INSERT_BATCH_ROWS = 64;
+
+// fast builds go to db_path + BUILD_SUFFIX and are renamed over db_path when complete
+static const char *BUILD_SUFFIX = ".building";
+
+// larger pages mean fewer, fuller b-tree nodes; only takes effect before the first table is created
+static const char *BUILD_PAGE_SIZE_PRAGMA = "PRAGMA page_size = 8192";
+
+// nothing else can see the build file, so it needs no journal, no syncs and no shared lock
+static const char *FAST_BUILD_PRAGMAS[] = {
+        "PRAGMA journal_mode = OFF",
+        "PRAGMA synchronous = OFF",
+        "PRAGMA locking_mode = EXCLUSIVE",
+        "PRAGMA cache_size = -16384"};
+
+
+/*!
+ * Every table loaded from a feed file, in the order create_tables creates them: as it is
+ * stored by default, and as it is stored encoded, with integer times for stop_time
+ * (time_columns) and dictionary codes for the others (dictionary_encoding).
+ */
+static const TableDescriptor *const TABLE_FORMS[][2] = {
+        {&AGENCY_TABLE,        &AGENCY_TABLE},
+        {&CALENDAR_DATE_TABLE, &CALENDAR_DATE_TABLE},
+        {&ROUTE_TABLE,         &ROUTE_CODED_TABLE},
+        {&STOP_TIME_TABLE,     &STOP_TIME_SECONDS_TABLE},
+        {&STOP_TABLE,          &STOP_CODED_TABLE},
+        {&TRIP_TABLE,          &TRIP_CODED_TABLE},
+        {&SHAPE_TABLE,         &SHAPE_TABLE}
+};
+
+// the key a clustered stop_time is stored in
+static const char *const STOP_TIME_KEY = "trip_id, stop_sequence";
+
+BusDataLoader::BusDataLoader() : reader_mode(READER_MMAP), fast_build(false), insert_batch_rows(DEFAULT_INSERT_BATCH_ROWS), concurrent_tables(false), shard_threads(0), virtual_table_import(false), memory_budget(0), clustered_stop_times(false), time_columns(TIMES_TEXT), dictionary_encoding(false), shape_geometry(false), feed_archive(NULL), presorted_indexes(false), analysis_limit(0), departure_first_date(0), departure_days(0), incremental_reload(false) {
+    // the calling thread writes to sqlite; the remaining hardware threads parse
+    unsigned int hardwareThreads = std::thread::hardware_concurrency();
+    parse_threads = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+
+    for (size_t i = 0; i < sizeof(TABLE_FORMS) / sizeof(TABLE_FORMS[0]); i++) {
+        const TableDescriptor *encoded = TABLE_FORMS[i][1];
+        for (size_t c = 0; c < encoded->column_count; c++) {
+            if (encoded->columns[c].type == COLUMN_DICTIONARY) {
+                dictionary_fields.push_back(encoded->columns[c].source);
+                dictionaries.push_back(new StringPool());
+            }
+        }
+    }
+}
+
+BusDataLoader::~BusDataLoader() {
+    for (size_t i = 0; i < dictionaries.size(); i++) {
+        delete dictionaries[i];
+    }
+}
+
+void BusDataLoader::set_reader_mode(ReaderMode mode) {
+    reader_mode = mode;
+}
+
+void BusDataLoader::set_parse_threads(unsigned int threads) {
+    parse_threads = threads;
+}
+
+void BusDataLoader::set_fast_build(bool enabled) {
+    fast_build = enabled;
+}
+
+void BusDataLoader::set_insert_batch_rows(size_t rows) {
+    insert_batch_rows = rows < 1 ? 1 : rows;
+}
+
+void BusDataLoader::set_concurrent_tables(bool enabled) {
+    concurrent_tables = enabled;
+}
+
+void BusDataLoader::set_virtual_table_import(bool enabled) {
+    virtual_table_import = enabled;
+}
+
+void BusDataLoader::set_memory_budget(size_t bytes) {
+    memory_budget = bytes;
+}
+
+void BusDataLoader::set_clustered_stop_times(bool enabled) {
+    clustered_stop_times = enabled;
+}
+
+void BusDataLoader::set_time_columns(TimeColumns columns) {
+    time_columns = columns;
+}
+
+void BusDataLoader::set_dictionary_encoding(bool enabled) {
+    dictionary_encoding = enabled;
+}
+
+void BusDataLoader::set_shape_geometry(bool enabled) {
+    shape_geometry = enabled;
+}
+
+void BusDataLoader::set_presorted_indexes(bool enabled) {
+    presorted_indexes = enabled;
+}
+
+void BusDataLoader::set_analysis_limit(int rows) {
+    analysis_limit = rows;
+}
+
+void BusDataLoader::set_departure_window(int64_t first_date, unsigned int days) {
+    departure_first_date = first_date;
+    departure_days = days;
+}
+
+void BusDataLoader::set_incremental_reload(bool enabled) {
+    incremental_reload = enabled;
+}
+
+const StringPool *BusDataLoader::dictionary(const char *column) const {
+    for (size_t i = 0; i < dictionaries.size(); i++) {
+        if (dictionary_encoding && strcmp(dictionary_fields[i], column) == 0) {
+            return dictionaries[i];
+        }
+    }
+    return NULL;
+}
+
+const TableDescriptor *BusDataLoader::table_descriptor(const string &tableName) const {
+    for (size_t i = 0; i < sizeof(TABLE_FORMS) / sizeof(TABLE_FORMS[0]); i++) {
+        if (tableName == TABLE_FORMS[i][0]->name) {
+            bool encoded = tableName == STOP_TIME_TABLE.name ? time_columns != TIMES_TEXT : dictionary_encoding;
+            return TABLE_FORMS[i][encoded ? 1 : 0];
+        }
+    }
+    return NULL;
+}
+
+int BusDataLoader::write_dictionaries(sqlite3 *db) {
+    int status = 0;
+
+    if (!dictionary_encoding) {
+        return 0;
+    }
+
+    sqlite3_exec(db, "SAVEPOINT dictionaries", NULL, NULL, NULL);
+    for (size_t i = 0; i < dictionaries.size() && status == 0; i++) {
+        sqlite3_stmt *stmt = NULL;
+        char *sql = sqlite3_mprintf("INSERT INTO \"dict_%w\" (code, value) VALUES (?, ?)", dictionary_fields[i]);
+
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+            status = 1;
+        }
+        for (uint32_t code = 1; status == 0 && code <= dictionaries[i]->size(); code++) {
+            size_t length;
+            const char *value = dictionaries[i]->value(code, &length);
+            sqlite3_bind_int64(stmt, 1, code);
+            sqlite3_bind_text(stmt, 2, value, (int) length, SQLITE_STATIC);
+            if (sqlite3_step(stmt) != SQLITE_DONE) {
+                status = 1;
+            }
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_free(sql);
+    }
+
+    if (status != 0) {
+        printf("\n    WARN: %s", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK TO dictionaries; RELEASE dictionaries", NULL, NULL, NULL);
+        return 1;
+    }
+    sqlite3_exec(db, "RELEASE dictionaries", NULL, NULL, NULL);
+    return 0;
+}
 
 int BusDataLoader::create_database(char const *path, const char **error_msg) {
     printf("\ncreating database at %s", path);
@@ -100,45 +264,83 @@ int BusDataLoader::create_database(char const *path, const char **error_msg) {
 
     status = sqlite3_open(path, &db);
     if (status == SQLITE_OK) {
-        sqlite3_stmt *stmt = NULL;
-        const char *pzTail;
+        status = create_tables(db, error_msg);
+    }
 
-        int numTables = 7;
-        char const *sql[] = {"CREATE TABLE agency (id INTEGER PRIMARY KEY, agency_id INTEGER, agency_name VARCHAR, agency_url VARCHAR, agency_timezone VARCHAR, agency_lang VARCHAR, agency_phone VARCHAR)",
+    sqlite3_close(db);
+
+    return status;
+}
 
-                "CREATE TABLE calendar_date (id INTEGER PRIMARY KEY, service_id INTEGER, date VARCHAR, exception_type INTEGER)",
+/*!
+ * The generated text column shows the stored value as is when it is not a number of
+ * seconds, so NULLs and fields that failed to parse read back as before.
+ */
+static string generated_time_column(const char *name, const char *seconds) {
+    char *column = sqlite3_mprintf("ALTER TABLE stop_time ADD COLUMN %s VARCHAR GENERATED ALWAYS AS (CASE typeof(%s) WHEN 'integer' THEN printf('%%02d:%%02d:%%02d', %s / 3600, %s / 60 %% 60, %s %% 60) ELSE %s END) VIRTUAL",
+            name, seconds, seconds, seconds, seconds, seconds);
+    string sql(column);
+    sqlite3_free(column);
+    return sql;
+}
 
-                "CREATE TABLE route (id INTEGER PRIMARY KEY, route_id INTEGER, agency_id INTEGER, route_short_name VARCHAR, route_long_name VARCHAR, route_type INTEGER, route_url VARCHAR, route_color VARCHAR)",
+int BusDataLoader::add_time_text_columns(sqlite3 *db) {
+    char *errMsg = NULL;
 
-                "CREATE TABLE stop_time (id INTEGER PRIMARY KEY, trip_id INTEGER, arrival_time VARCHAR, departure_time VARCHAR, stop_id INTEGER, stop_sequence INTEGER, pickup_type INTEGER, drop_off_type INTEGER, shape_dist_traveled REAL)",
+    if (time_columns != TIMES_SECONDS_AND_TEXT) {
+        return 0;
+    }
 
-                "CREATE TABLE stop (id INTEGER PRIMARY KEY, stop_id INTEGER, stop_code INTEGER, stop_name VARCHAR, stop_desc TEXT, stop_lat REAL, stop_lon REAL, zone_id INTEGER)",
+    // sqlite evaluates even VIRTUAL generated columns on every insert, so they go on once the rows are in
+    string sql = generated_time_column("arrival_time", "arrival_secs").append("; ").append(generated_time_column("departure_time", "departure_secs"));
+    if (sqlite3_exec(db, sql.c_str(), NULL, NULL, &errMsg) != SQLITE_OK) {
+        printf("\n    WARN: %s", errMsg != NULL ? errMsg : sqlite3_errmsg(db));
+        sqlite3_free(errMsg);
+        return 1;
+    }
+    return 0;
+}
 
-                "CREATE TABLE trip (id INTEGER PRIMARY KEY, route_id INTEGER, service_id INTEGER, trip_id INTEGER, trip_headsign VARCHAR, direction_id INTEGER, block_id VARCHAR, shape_id INTEGER)",
+int BusDataLoader::create_tables(sqlite3 *db, const char **error_msg) {
+    int status = 0;
+    sqlite3_stmt *stmt = NULL;
+    const char *pzTail;
 
-                "CREATE TABLE shape (id INTEGER PRIMARY KEY, shape_id INTEGER, shape_pt_lat REAL, shape_pt_lon REAL, shape_pt_sequence INTEGER, shape_dist_traveled REAL)",};
+    int numTables = sizeof(TABLE_FORMS) / sizeof(TABLE_FORMS[0]);
+    vector<string> sql;
+    for (int i = 0; i < numTables; i++) {
+        sql.push_back(table_sql(table_descriptor(TABLE_FORMS[i][0]->name)));
+    }
+    for (size_t d = 0; dictionary_encoding && d < dictionary_fields.size(); d++) {
+        char *dictionarySql = sqlite3_mprintf("CREATE TABLE \"dict_%w\" (code INTEGER PRIMARY KEY, value VARCHAR)", dictionary_fields[d]);
+        sql.push_back(dictionarySql);
+        sqlite3_free(dictionarySql);
+    }
 
 //        printf("\ncurr status = %i",status);
-        printf("\nCreating %i tables", numTables);
-        for (int i = 0; i < numTables; i++) {
-            sqlite3_prepare_v2(db, sql[i], strlen(sql[i]), &stmt, &pzTail);
-            status = sqlite3_step(stmt);
-            sqlite3_finalize(stmt);
+    printf("\nCreating %i tables", numTables);
+    for (size_t i = 0; i < sql.size(); i++) {
+        sqlite3_prepare_v2(db, sql[i].c_str(), sql[i].length(), &stmt, &pzTail);
+        status = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
 //            printf("\nstatus at %i: %i",i,status);
-            const char *error = sqlite3_errmsg(db);
+        const char *error = sqlite3_errmsg(db);
 
-            if (error_msg != NULL) {
-                *error_msg = error;
-            }
+        if (error_msg != NULL) {
+            *error_msg = error;
         }
-
     }
 
-    sqlite3_close(db);
-
     return status;
 }
 
+string BusDataLoader::table_sql(const TableDescriptor *table) const {
+    if (shape_geometry && table == &SHAPE_TABLE) {
+        return "CREATE TABLE shape_geom (shape_id INTEGER PRIMARY KEY, point_count INTEGER, geom BLOB)";
+    }
+    return create_table_sql(*table, clustered_stop_times && strcmp(table->name, STOP_TIME_TABLE.name) == 0 ? STOP_TIME_KEY : NULL);
+}
+
 void BusDataLoader::clear_old_database(char const *dbPath) {
     ifstream oldDb;
     bool exists = false;
@@ -154,50 +356,6 @@ void BusDataLoader::clear_old_database(char const *dbPath) {
 }
 
 
-/*!
- * CSV parser function borrowed from http://www.zedwood.com/article/112/cpp-csv-parser
- */
-void BusDataLoader::csvline_populate(vector<string> &record, const string& line, char delimiter) {
-    int linepos = 0;
-    int inquotes = false;
-    char c;
-    int linemax = line.length();
-    string curstring;
-    record.clear();
-
-    while (line[linepos] != 0 && linepos < linemax) {
-
-        c = line[linepos];
-
-        if (!inquotes && curstring.length() == 0 && c == '"') {
-            //beginquotechar
-            inquotes = true;
-        } else if (inquotes && c == '"') {
-            //quotechar
-            if ((linepos + 1 < linemax) && (line[linepos + 1] == '"')) {
-                //encountered 2 double quotes in a row (resolves to 1 double quote)
-                curstring.push_back(c);
-                linepos++;
-            } else {
-                //endquotechar
-                inquotes = false;
-            }
-        } else if (!inquotes && c == delimiter) {
-            //end of field
-            record.push_back(curstring);
-            curstring = "";
-        } else if (!inquotes && (c == '\r' || c == '\n')) {
-            record.push_back(curstring);
-            return;
-        } else {
-            curstring.push_back(c);
-        }
-        linepos++;
-    }
-    record.push_back(curstring);
-    return;
-}
-
 void BusDataLoader::get_column_names(sqlite3 *db, string tableName, vector<string> *colNames, int *columnCount) {
     char c_sql[1024];
     sprintf(c_sql, "select * from %s", tableName.c_str());
@@ -228,318 +386,1426 @@ bool BusDataLoader::is_number(const std::string& s) {
 }
 
 
-int BusDataLoader::insert_data(string filePath, sqlite3 *db, string tableName, vector<string> *column_names) {
-    bool free_cols = false;
-    if (!column_names) {
-        column_names = new vector<string>();
-        get_column_names(db, tableName, column_names, NULL);
+void BusDataLoader::report_progress(const string &tableName, unsigned int lineNo) {
+    if ((lineNo & 0x3ff) == 0) {
+        printf("Loading %s...................................%u\r", tableName.c_str(), lineNo);
+        fflush(stdout);
     }
+}
 
-    int retStatus = 0;
-    sqlite3_stmt *stmt = NULL;
-    bool stmtCreated = false;
-    ifstream file;
-    string line;
-    char cSql[1024];
-    string sql;
-    const char *pzTail;
-    vector<string> comps;
-    string colsArg;
-    string valsArg;
-    char *transactionErrMsg;
-
+/*!
+ * "(?, ?), (?, ?), ..." for a multi-row INSERT.
+ */
+static string values_list(size_t columns, size_t rows) {
+    string row = "(?";
+    for (size_t i = 1; i < columns; i++) {
+        row.append(", ?");
+    }
+    row.append(")");
 
-    unsigned long column_count = column_names->size();
-    for (unsigned int i = 0; i < column_count; i++) {
-        colsArg.append(column_names->at(i));
-        if (i < column_count - 1) {
-            colsArg.append(", ");
+    string values;
+    values.reserve((row.length() + 2) * rows);
+    for (size_t r = 0; r < rows; r++) {
+        if (r > 0) {
+            values.append(", ");
         }
+        values.append(row);
     }
+    return values;
+}
 
-    file.open(filePath.c_str());
-
-    if (file.is_open()) {
-        vector<string> warningLines;
-        unsigned int lineCtr = 0;
-        int status;
-        char statusStr[1024];
-        const char *statusMsg;
-        string comp;
-        sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, &transactionErrMsg);
-        while (file.good()) {
-            lineCtr++;
-            getline(file, line);
-
-            // the first line is a description of the fields, so start at line 2
-            if (lineCtr > 1 && line.length() > 0) {
-                //comps = split_line(line);
-                csvline_populate(comps, line, ',');
-
-                printf("Loading %s...................................%i\r", tableName.c_str(), lineCtr);
-                fflush(stdout);
-
-                if (!stmtCreated) {
-                    valsArg.clear();
-                    for (unsigned int i = 0; i < comps.size(); i++) {
-                        if (i > 0) {
-                            valsArg.append(",");
-                        }
-                        valsArg.append("?");
-                    }
-                    sprintf(cSql, "INSERT INTO %s (%s) VALUES(%s)", tableName.c_str(), colsArg.c_str(), valsArg.c_str());
-                    status = sqlite3_prepare_v2(db, cSql, strlen(cSql), &stmt, &pzTail);
-                    stmtCreated = true;
-                }
-
-                string(tmp);
-
-
-                for (unsigned int i = 0; i < comps.size(); i++) {
-                    const char *sqlCmp = comps.at((size_t) i).c_str();
-//                    printf("\nsql cmp: %s", sqlCmp);
-                    sqlite3_bind_text(stmt, i + 1, sqlCmp, -1, SQLITE_TRANSIENT);
-                }
-
-                status = sqlite3_step(stmt);
-                sqlite3_clear_bindings(stmt);
-                sqlite3_reset(stmt);
+/*!
+ * Position of each field named in a header row, without a leading byte order mark
+ * and surrounding blanks. The header row names the fields, so feeds may reorder
+ * columns or add ones we do not load.
+ */
+static void header_columns(const CsvRecord &header, map<string, int> *columns) {
+    columns->clear();
+    for (size_t i = 0; i < header.size(); i++) {
+        const char *name = header[i].data;
+        size_t length = header[i].length;
+        if (i == 0 && length >= 3 && memcmp(name, "\xEF\xBB\xBF", 3) == 0) {
+            name += 3;
+            length -= 3;
+        }
+        trim_field(&name, &length);
+        columns->insert(make_pair(string(name, length), (int) i));
+    }
+}
 
-                if (status != SQLITE_OK && status < 100) {
-                    retStatus = 1;
-                    statusMsg = sqlite3_errmsg(db);
-                    int ln = lineCtr;
-                    sprintf(statusStr, "line %i: caught error %i: %s", ln, status, statusMsg);
-                    warningLines.push_back(string(statusStr));
-                }
+int BusDataLoader::prepare_insert(sqlite3 *db, const TableDescriptor &table, const CsvRecord &header, InsertPlan *plan) {
+    map<string, int> headerColumns;
+    size_t found = 0;
+
+    header_columns(header, &headerColumns);
+
+    // every column is bound, in table order; those the file lacks are bound NULL
+    plan->table = &table;
+    plan->source_index.assign(table.column_count, -1);
+    plan->dictionaries.assign(table.column_count, NULL);
+    plan->wanted.assign(header.size(), 0);
+
+    for (size_t i = 0; i < table.column_count; i++) {
+        const ColumnDescriptor &column = table.columns[i];
+        map<string, int>::const_iterator source = headerColumns.find(column.source);
+        if (source != headerColumns.end()) {
+            plan->source_index[i] = source->second;
+            plan->wanted[source->second] = 1;
+            found++;
+        }
+        for (size_t d = 0; column.type == COLUMN_DICTIONARY && d < dictionary_fields.size(); d++) {
+            if (strcmp(dictionary_fields[d], column.source) == 0) {
+                plan->dictionaries[i] = dictionaries[d];
             }
-
         }
+    }
 
-        sqlite3_finalize(stmt);
-        sqlite3_exec(db, "END TRANSACTION", NULL, NULL, &transactionErrMsg);
-        stmtCreated = false;
+    if (found == 0) {
+        printf("    WARN: no columns of %s found in the header\n", table.name);
+        return 1;
+    }
 
-        printf("Loading %s...................................done\n", tableName.c_str());
+    plan->insert_prefix = string("INSERT INTO ").append(table.name).append(" (").append(column_list(table)).append(") VALUES ");
+    string sql = plan->insert_prefix + values_list(table.column_count, 1);
+    if (sqlite3_prepare_v2(db, sql.c_str(), sql.length(), &plan->stmt, NULL) != SQLITE_OK) {
+        printf("    WARN: %s\n", sqlite3_errmsg(db));
+        return 1;
+    }
 
-        for (unsigned int j = 0; j < warningLines.size(); j++) {
-            printf("    WARN: %s\n", warningLines.at(j).c_str());
+    // a clustered stop_time is filled in key order; both key fields must be in the file
+    plan->key_index.clear();
+    if (clustered_stop_times && strcmp(table.name, STOP_TIME_TABLE.name) == 0) {
+        map<string, int>::const_iterator trip = headerColumns.find("trip_id");
+        map<string, int>::const_iterator sequence = headerColumns.find("stop_sequence");
+        if (trip != headerColumns.end() && sequence != headerColumns.end()) {
+            plan->key_index.push_back(trip->second);
+            plan->key_index.push_back(sequence->second);
         }
-        printf("\n");
     }
-    if (free_cols) {
-        delete column_names;
+
+    // a stop_time indexed from its parsed keys hands every inserted row to the index as well
+    plan->index_keys = NULL;
+    if (presorted_indexes && strcmp(table.name, STOP_TIME_TABLE.name) == 0) {
+        const char *keyFields[] = {"stop_id", "departure_time", "trip_id", "stop_sequence"};
+        int keyIndex[4];
+        for (size_t k = 0; k < 4; k++) {
+            map<string, int>::const_iterator field = headerColumns.find(keyFields[k]);
+            keyIndex[k] = field != headerColumns.end() ? field->second : -1;
+        }
+        stop_time_index.set_fields(keyIndex[0], keyIndex[1], keyIndex[2], keyIndex[3]);
+        plan->index_keys = &stop_time_index;
     }
 
-    file.close();
+    // the parameters of row r in batch_stmt are the single-row ones offset by r * column_count
+    int paramCount = (int) table.column_count;
+    int variableLimit = sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    plan->batch_rows = min(insert_batch_rows, (size_t) (variableLimit / paramCount));
+    plan->pending = 0;
+    plan->row_fields.resize(max(plan->batch_rows, (size_t) 1) * paramCount);
+    plan->field_state.resize(max(plan->batch_rows, (size_t) 1) * paramCount);
+    plan->row_lines.resize(max(plan->batch_rows, (size_t) 1));
+    plan->row_keys.resize(plan->index_keys != NULL ? max(plan->batch_rows, (size_t) 1) : 0);
+    plan->row_key_states.resize(plan->row_keys.size());
+
+    if (plan->batch_rows > 1) {
+        string batchSql = plan->insert_prefix + values_list(paramCount, plan->batch_rows);
+        if (sqlite3_prepare_v2(db, batchSql.c_str(), batchSql.length(), &plan->batch_stmt, NULL) != SQLITE_OK) {
+            printf("    WARN: %s\n", sqlite3_errmsg(db));
+            return 1;
+        }
+    }
 
-    return retStatus;
+    return 0;
 }
 
+int BusDataLoader::insert_record(sqlite3 *db, InsertPlan &plan, const CsvField *fields, size_t fieldCount, unsigned int lineNo, vector<string> &warningLines) {
+    int status;
+    char statusStr[1024];
+    const char *statusMsg;
+    sqlite3_stmt *stmt = plan.stmt;
+    bool batched = plan.batch_rows > 1;
+    size_t columns = plan.source_index.size();
+    CsvField *row = &plan.row_fields[batched ? plan.pending * columns : 0];
+    char *state = &plan.field_state[batched ? plan.pending * columns : 0];
+
+    if (plan.index_keys != NULL) {
+        size_t slot = batched ? plan.pending : 0;
+        plan.row_key_states[slot] = (char) plan.index_keys->read_key(fields, fieldCount, &plan.row_keys[slot]);
+    }
 
-int BusDataLoader::load_calendar_dates(char const *dir_path, sqlite3 *db) {
-    std::string joined = std::string(dir_path);
-    joined.append("/").append(fn_calendarDates);
+    for (size_t i = 0; i < columns; i++) {
+        size_t source = (size_t) plan.source_index[i];
+        if (source >= fieldCount) {
+            // short rows leave their trailing columns NULL
+            state[i] = FIELD_MISSING;
+        } else if (!batched || (fields[source].data >= plan.stable_begin && fields[source].data + fields[source].length <= plan.stable_end)) {
+            row[i] = fields[source];
+            state[i] = FIELD_STABLE;
+        } else {
+            // the field will not survive until the batch is written
+            row[i].data = (const char *) (uintptr_t) plan.spill.size();
+            row[i].length = fields[source].length;
+            plan.spill.insert(plan.spill.end(), fields[source].data, fields[source].data + fields[source].length);
+            state[i] = FIELD_SPILLED;
+        }
+    }
 
-    int status = 0;
+    if (batched) {
+        plan.row_lines[plan.pending++] = lineNo;
+        return plan.pending == plan.batch_rows ? flush_rows(db, plan, warningLines) : 0;
+    }
 
-    vector<string> *cols = new vector<string>();
-    cols->push_back("service_id");
-    cols->push_back("date");
-    cols->push_back("exception_type");
+    // every parameter is rebound for every row, so there are no stale bindings to clear
+    plan.table->bind_row(stmt, 1, row, state, NULL, &plan.dictionaries[0]);
+    status = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
 
-    status = insert_data(joined, db, "calendar_date", cols);
+    if (status != SQLITE_OK && status < 100) {
+        statusMsg = sqlite3_errmsg(db);
+        sprintf(statusStr, "line %u: caught error %i: %s", lineNo, status, statusMsg);
+        warningLines.push_back(string(statusStr));
+        return 1;
+    }
 
-    delete cols;
+    if (plan.index_keys != NULL) {
+        plan.index_keys->add(plan.row_keys[0], (StopTimeIndex::KeyState) plan.row_key_states[0]);
+    }
 
     return 0;
 }
 
-int BusDataLoader::load_routes(char const *dir_path, sqlite3 *db) {
-    std::string joined = std::string(dir_path);
-    joined.append("/").append(fn_routes);
+int BusDataLoader::flush_rows(sqlite3 *db, InsertPlan &plan, vector<string> &warningLines) {
+    int status = SQLITE_ERROR;
+    char statusStr[1024];
+    sqlite3_stmt *stmt = plan.batch_stmt;
+    size_t columns = plan.source_index.size();
+    RowBinder bindRow = plan.table->bind_row;
+    int retStatus = 0;
 
-    int status = 0;
+    if (plan.pending == 0) {
+        return 0;
+    }
 
-    vector<string> *cols = new vector<string>();
-    cols->push_back("route_id");
-    cols->push_back("agency_id");
-    cols->push_back("route_short_name");
-    cols->push_back("route_long_name");
-    cols->push_back("route_type");
-    cols->push_back("route_url");
-    cols->push_back("route_color");
+    // the rows left over at the end of a file get a statement of their own
+    if (plan.pending < plan.batch_rows) {
+        string tailSql = plan.insert_prefix + values_list(columns, plan.pending);
+        if (sqlite3_prepare_v2(db, tailSql.c_str(), tailSql.length(), &stmt, NULL) != SQLITE_OK) {
+            sqlite3_finalize(stmt);
+            stmt = NULL;
+        }
+    }
 
-    status = insert_data(joined, db, "route", cols);
+    // every parameter is rebound for every batch, so there are no stale bindings to clear
+    if (stmt != NULL) {
+        for (size_t r = 0; r < plan.pending; r++) {
+            bindRow(stmt, (int) (r * columns) + 1, &plan.row_fields[r * columns], &plan.field_state[r * columns], plan.spill.data(), &plan.dictionaries[0]);
+        }
 
-    delete cols;
+        status = sqlite3_step(stmt);
+        if (stmt == plan.batch_stmt) {
+            sqlite3_reset(stmt);
+        } else {
+            sqlite3_finalize(stmt);
+        }
+    }
 
-    return 0;
-}
+    if (status != SQLITE_OK && status < 100) {
+        // the failed statement wrote nothing, so the rows go in again one at a time and only the bad ones are reported
+        for (size_t r = 0; r < plan.pending; r++) {
+            bindRow(plan.stmt, 1, &plan.row_fields[r * columns], &plan.field_state[r * columns], plan.spill.data(), &plan.dictionaries[0]);
+            status = sqlite3_step(plan.stmt);
+            sqlite3_reset(plan.stmt);
+
+            if (status != SQLITE_OK && status < 100) {
+                sprintf(statusStr, "line %u: caught error %i: %s", plan.row_lines[r], status, sqlite3_errmsg(db));
+                warningLines.push_back(string(statusStr));
+                retStatus = 1;
+            } else if (plan.index_keys != NULL) {
+                plan.index_keys->add(plan.row_keys[r], (StopTimeIndex::KeyState) plan.row_key_states[r]);
+            }
+        }
+    } else if (plan.index_keys != NULL) {
+        for (size_t r = 0; r < plan.pending; r++) {
+            plan.index_keys->add(plan.row_keys[r], (StopTimeIndex::KeyState) plan.row_key_states[r]);
+        }
+    }
 
-int BusDataLoader::load_stop_times(char const *dir_path, sqlite3 *db) {
-    std::string joined = std::string(dir_path);
-    joined.append("/").append(fn_stopTimes);
+    plan.pending = 0;
+    plan.spill.clear();
 
-    int status = 0;
+    return retStatus;
+}
 
-    vector<string> *cols = new vector<string>();
-    cols->push_back("trip_id");
-    cols->push_back("arrival_time");
-    cols->push_back("departure_time");
-    cols->push_back("stop_id");
-    cols->push_back("stop_sequence");
-    cols->push_back("pickup_type");
-    cols->push_back("drop_off_type");
-    cols->push_back("shape_dist_traveled");
+/*!
+ * Clustering key of one record and where the record sits in the file.
+ */
+struct KeyedRecord {
+    int64_t key[2];
+    size_t offset;
+    uint32_t length;
+    uint32_t line;
+
+    bool operator<(const KeyedRecord &other) const {
+        return key[0] != other.key[0] ? key[0] < other.key[0] : key[1] < other.key[1];
+    }
+};
 
-    status = insert_data(joined, db, "stop_time", cols);
+static bool record_key(const CsvRecord &record, const vector<int> &keyIndex, int64_t *key) {
+    for (size_t k = 0; k < 2; k++) {
+        size_t source = (size_t) keyIndex[k];
+        if (source >= record.size() || !parse_int64(record[source].data, record[source].length, &key[k])) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    delete cols;
+int BusDataLoader::insert_in_key_order(sqlite3 *db, const string &tableName, InsertPlan &plan, const char *body, size_t size, unsigned int lineBase, vector<string> &warningLines) {
+    CsvReader reader(body, size, ',');
+    CsvRecord record;
+    vector<char> keyOnly(plan.wanted.size(), 0);
+    vector<KeyedRecord> records;
+    KeyedRecord last;
+    bool started = false;
+    bool numeric = true;
+    int retStatus = 0;
 
-    return 0;
-}
+    // feeds are usually written trip by trip, so records go straight in while their keys ascend
+    reader.set_projection(&plan.wanted);
+    const char *start = body;
+    unsigned int startLine = lineBase;
+    while (reader.next_record(record)) {
+        KeyedRecord keyed;
+        if (!record_key(record, plan.key_index, keyed.key) || (started && keyed < last)) {
+            break;
+        }
 
-int BusDataLoader::load_stops(char const *dir_path, sqlite3 *db) {
-    std::string joined = std::string(dir_path);
-    joined.append("/").append(fn_stops);
+        unsigned int lineNo = lineBase + reader.line_number();
+        report_progress(tableName, lineNo);
+        if (insert_record(db, plan, record.fields(), record.size(), lineNo, warningLines) != 0) {
+            retStatus = 1;
+        }
+        last = keyed;
+        started = true;
+        start = reader.position();
+        startLine = lineBase + reader.lines_consumed();
+    }
 
-    int status = 0;
+    // everything from the first record out of order on is sorted by key before it goes in
+    CsvReader rest(start, body + size - start, ',');
+    rest.set_projection(&keyOnly);
+    for (size_t k = 0; k < plan.key_index.size(); k++) {
+        keyOnly[plan.key_index[k]] = 1;
+    }
 
-    vector<string> *cols = new vector<string>();
-    cols->push_back("stop_id");
-    cols->push_back("stop_code");
-    cols->push_back("stop_name");
-    cols->push_back("stop_desc");
-    cols->push_back("stop_lat");
-    cols->push_back("stop_lon");
-    cols->push_back("zone_id");
+    const char *recordStart = start;
+    while (rest.next_record(record)) {
+        KeyedRecord keyed;
+        if (!record_key(record, plan.key_index, keyed.key)) {
+            numeric = false;
+            break;
+        }
+        keyed.offset = recordStart - body;
+        keyed.length = (uint32_t) (rest.position() - recordStart);
+        keyed.line = startLine + rest.line_number();
+        records.push_back(keyed);
+        recordStart = rest.position();
+    }
 
-    status = insert_data(joined, db, "stop", cols);
+    rest.set_projection(&plan.wanted);
+    if (!numeric) {
+        // no numeric order to restore: the rest of the file goes in as it is
+        rest.reset(start, body + size - start);
+        while (rest.next_record(record)) {
+            unsigned int lineNo = startLine + rest.line_number();
+            report_progress(tableName, lineNo);
+            if (insert_record(db, plan, record.fields(), record.size(), lineNo, warningLines) != 0) {
+                retStatus = 1;
+            }
+        }
+        return retStatus;
+    }
 
-    delete cols;
+    // equal keys keep their file order, so a duplicate reports the later line
+    stable_sort(records.begin(), records.end());
 
-    return 0;
+    for (size_t r = 0; r < records.size(); r++) {
+        rest.reset(body + records[r].offset, records[r].length);
+        if (!rest.next_record(record)) {
+            continue;
+        }
+        report_progress(tableName, records[r].line);
+        if (insert_record(db, plan, record.fields(), record.size(), records[r].line, warningLines) != 0) {
+            retStatus = 1;
+        }
+    }
+
+    return retStatus;
 }
 
-int BusDataLoader::load_trips(char const *dir_path, sqlite3 *db) {
-    std::string joined = std::string(dir_path);
-    joined.append("/").append(fn_trips);
+/*!
+ * gtfs_intern(param, value): the dictionary code of value in the pool of parameter
+ * param, from the insert plan's pools given as user data.
+ */
+static void intern_value(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    const vector<StringPool *> *dictionaries = (const vector<StringPool *> *) sqlite3_user_data(context);
+    int param = sqlite3_value_int(argv[0]);
+    (void) argc;
+
+    if (sqlite3_value_type(argv[1]) == SQLITE_NULL || sqlite3_value_bytes(argv[1]) == 0) {
+        sqlite3_result_null(context);
+        return;
+    }
+    const char *text = (const char *) sqlite3_value_text(argv[1]);
+    sqlite3_result_int64(context, (*dictionaries)[param]->intern(text, sqlite3_value_bytes(argv[1])));
+}
 
+int BusDataLoader::insert_from_virtual_table(sqlite3 *db, const InsertPlan &plan, const string &filePath, const char *data, size_t size, vector<string> &warningLines) {
+    const TableDescriptor &table = *plan.table;
+    CsvBufferMap buffers;
+    char *errMsg = NULL;
     int status = 0;
+    string colsArg;
+    string selectArg;
 
-    vector<string> *cols = new vector<string>();
-    cols->push_back("route_id");
-    cols->push_back("service_id");
-    cols->push_back("trip_id");
-    cols->push_back("trip_headsign");
-    cols->push_back("direction_id");
-    cols->push_back("block_id");
-    cols->push_back("shape_id");
+    // the table reads the buffer already mapped or inflated for this file
+    buffers[filePath] = make_pair(data, size);
+    register_csv_virtual_table(db, &buffers);
 
-    status = insert_data(joined, db, "trip", cols);
+    // columns whose field the file lacks are left out, and so left NULL
+    for (size_t i = 0; i < table.column_count; i++) {
+        const ColumnDescriptor &descriptor = table.columns[i];
+        if (plan.source_index[i] < 0) {
+            continue;
+        }
+        char *column = sqlite3_mprintf("\"%w\"", descriptor.name);
+        char *select;
+        if (descriptor.type == COLUMN_SECONDS) {
+            select = sqlite3_mprintf("gtfs_seconds(\"%w\")", descriptor.source);
+        } else if (descriptor.type == COLUMN_DICTIONARY) {
+            select = sqlite3_mprintf("gtfs_intern(%d, \"%w\")", (int) i, descriptor.source);
+        } else {
+            select = sqlite3_mprintf("\"%w\"", descriptor.source);
+        }
+        colsArg.append(colsArg.empty() ? "" : ", ").append(column);
+        selectArg.append(selectArg.empty() ? "" : ", ").append(select);
+        sqlite3_free(select);
+        sqlite3_free(column);
+    }
 
-    delete cols;
+    // codes come from the same pools bind_row interns into
+    sqlite3_create_function(db, "gtfs_intern", 2, SQLITE_UTF8, (void *) &plan.dictionaries, intern_value, NULL, NULL);
 
-    return 0;
-}
+    // typed from the target table, so values arrive decoded exactly as bind_row would bind them
+    char *create = sqlite3_mprintf("CREATE VIRTUAL TABLE temp.gtfs_import USING gtfs_csv(%Q, %Q)", filePath.c_str(), table.name);
+    string insert = string("INSERT INTO ").append(table.name).append(" (").append(colsArg).append(") SELECT ").append(selectArg).append(" FROM temp.gtfs_import");
+    if (!plan.key_index.empty()) {
+        insert.append(" ORDER BY ").append(STOP_TIME_KEY);
+    }
 
-int BusDataLoader::load_agency(char const *dir_path, sqlite3 *db) {
-    std::string joined = std::string(dir_path);
-    joined.append("/").append(fn_agency);
+    if (sqlite3_exec(db, create, NULL, NULL, &errMsg) != SQLITE_OK || sqlite3_exec(db, insert.c_str(), NULL, NULL, &errMsg) != SQLITE_OK) {
+        warningLines.push_back(string("caught error: ").append(errMsg != NULL ? errMsg : sqlite3_errmsg(db)));
+        status = 1;
+    }
+    sqlite3_free(errMsg);
+    sqlite3_free(create);
 
-    int status = 0;
+    sqlite3_exec(db, "DROP TABLE IF EXISTS temp.gtfs_import", NULL, NULL, NULL);
+    register_csv_virtual_table(db, NULL);
+    sqlite3_create_function(db, "gtfs_intern", 2, SQLITE_UTF8, NULL, NULL, NULL, NULL);
 
-    vector<string> *cols = new vector<string>();
-    cols->push_back("agency_id");
-    cols->push_back("agency_name");
-    cols->push_back("agency_url");
-    cols->push_back("agency_timezone");
-    cols->push_back("agency_lang");
-    cols->push_back("agency_phone");
+    return status;
+}
 
-    status = insert_data(joined, db, "agency", cols);
+static bool is_required_file(const char *fileName) {
+    for (size_t i = 0; i < sizeof(REQUIRED_FILES) / sizeof(REQUIRED_FILES[0]); i++) {
+        if (strcmp(REQUIRED_FILES[i], fileName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    delete cols;
+int BusDataLoader::insert_data(char const *dir_path, const char *fileName, sqlite3 *db, const TableDescriptor &table) {
+    int retStatus = 0;
+    bool opened = false;
+    char *transactionErrMsg;
+    vector<string> warningLines;
+    InsertPlan plan;
+    CsvRecord record;
+    unsigned int lineCtr = 0;
+    string filePath = string(dir_path).append("/").append(fileName);
+    MappedFile mapped;
+    const char *data = NULL;
+    size_t size = 0;
+    bool buffered = false;
+    string tableName(table.name);
+
+    plan.stmt = NULL;
+    plan.table = &table;
+    plan.index_keys = NULL;
+    plan.batch_stmt = NULL;
+    plan.batch_rows = 1;
+    plan.pending = 0;
+    plan.stable_begin = NULL;
+    plan.stable_end = NULL;
+
+    // members of a zip feed are always parsed from memory, whatever the reader mode
+    if (feed_archive != NULL) {
+        buffered = feed_archive->member_data(fileName, &data, &size);
+    } else if (reader_mode == READER_MMAP && mapped.open(filePath.c_str())) {
+        buffered = true;
+        data = mapped.data();
+        size = mapped.size();
+    }
 
-    return 0;
-}
+    if (feed_archive != NULL || reader_mode == READER_MMAP) {
+        if (buffered) {
+            opened = true;
+            // on its own a savepoint is a transaction; during a reload it nests in the reload's
+            sqlite3_exec(db, "SAVEPOINT load_table", NULL, NULL, &transactionErrMsg);
+
+            CsvReader reader(data, size, ',');
+            plan.stable_begin = data;
+            plan.stable_end = data + size;
+
+            // the first line is a description of the fields
+            if (!reader.next_record(record)) {
+                warningLines.push_back(string(fileName).append(" has no header"));
+                retStatus = 1;
+            } else if (prepare_insert(db, table, record, &plan) != 0) {
+                retStatus = 1;
+            } else if (virtual_table_import) {
+                if (insert_from_virtual_table(db, plan, filePath, data, size, warningLines) != 0) {
+                    retStatus = 1;
+                }
+            } else if (!plan.key_index.empty()) {
+                const char *body = reader.position();
+                if (insert_in_key_order(db, tableName, plan, body, size - (body - data), reader.lines_consumed(), warningLines) != 0) {
+                    retStatus = 1;
+                }
+            } else if (table_parse_threads(table) > 0) {
+                const char *body = reader.position();
+                ParallelCsvParser parser(body, size - (body - data), ',', table_parse_threads(table), PARSE_CHUNK_SIZE, &plan.wanted);
+                unsigned int lineBase = reader.lines_consumed();
+                const CsvRecordBatch *batch;
 
-int BusDataLoader::load_shapes(char const *dir_path, sqlite3 *db) {
-    std::string joined = std::string(dir_path);
-    joined.append("/").append(fn_shapes);
+                while ((batch = parser.next_batch()) != NULL) {
+                    const CsvField *fields = batch->fields.empty() ? NULL : &batch->fields[0];
 
-    int status = 0;
+                    for (size_t r = 0; r < batch->field_counts.size(); r++) {
+                        lineCtr = lineBase + batch->lines[r];
+                        report_progress(tableName, lineCtr);
 
-    vector<string> *cols = new vector<string>();
-    cols->push_back("shape_id");
-    cols->push_back("shape_pt_lat");
-    cols->push_back("shape_pt_lon");
-    cols->push_back("shape_pt_sequence");
-    cols->push_back("shape_dist_traveled");
+                        if (insert_record(db, plan, fields, batch->field_counts[r], lineCtr, warningLines) != 0) {
+                            retStatus = 1;
+                        }
+                        fields += batch->field_counts[r];
+                    }
 
-    status = insert_data(joined, db, "shape", cols);
+                    lineBase += batch->line_count;
+                }
+            } else {
+                reader.set_projection(&plan.wanted);
 
-    delete cols;
+                while (reader.next_record(record)) {
+                    lineCtr = reader.line_number();
+                    report_progress(tableName, lineCtr);
+
+                    if (insert_record(db, plan, record.fields(), record.size(), lineCtr, warningLines) != 0) {
+                        retStatus = 1;
+                    }
+                }
+            }
+
+            if (flush_rows(db, plan, warningLines) != 0) {
+                retStatus = 1;
+            }
+            sqlite3_finalize(plan.batch_stmt);
+            sqlite3_finalize(plan.stmt);
+        }
+    } else {
+        ifstream file;
+        string line;
+        CsvReader lineReader(NULL, 0, ',');
+
+        file.open(filePath.c_str());
+
+        if (file.is_open()) {
+            opened = true;
+            sqlite3_exec(db, "SAVEPOINT load_table", NULL, NULL, &transactionErrMsg);
+            while (file.good()) {
+                lineCtr++;
+                getline(file, line);
+
+                if (line.length() == 0) {
+                    continue;
+                }
+
+                lineReader.reset(line.data(), line.length());
+                if (!lineReader.next_record(record)) {
+                    continue;
+                }
+
+                // the first line is a description of the fields
+                if (plan.stmt == NULL) {
+                    if (prepare_insert(db, table, record, &plan) != 0) {
+                        retStatus = 1;
+                        break;
+                    }
+                    lineReader.set_projection(&plan.wanted);
+                    continue;
+                }
+
+                report_progress(tableName, lineCtr);
+
+                if (insert_record(db, plan, record.fields(), record.size(), lineCtr, warningLines) != 0) {
+                    retStatus = 1;
+                }
+            }
+            if (plan.stmt == NULL && retStatus == 0) {
+                warningLines.push_back(string(fileName).append(" has no header"));
+                retStatus = 1;
+            }
+
+            if (flush_rows(db, plan, warningLines) != 0) {
+                retStatus = 1;
+            }
+            sqlite3_finalize(plan.batch_stmt);
+            sqlite3_finalize(plan.stmt);
+        }
+
+        file.close();
+    }
+
+    if (opened) {
+        sqlite3_exec(db, "RELEASE load_table", NULL, NULL, &transactionErrMsg);
+
+        printf("Loading %s...................................done\n", tableName.c_str());
+
+        for (unsigned int j = 0; j < warningLines.size(); j++) {
+            printf("    WARN: %s\n", warningLines.at(j).c_str());
+        }
+        printf("\n");
+    } else if (is_required_file(fileName)) {
+        printf("Loading %s...................................failed: %s is missing\n\n", tableName.c_str(), fileName);
+        retStatus = 1;
+    }
+
+    return retStatus;
+}
+
+
+int BusDataLoader::load_calendar_dates(char const *dir_path, sqlite3 *db) {
+    int status = 0;
+
+    status = insert_data(dir_path, fn_calendarDates, db, *table_descriptor("calendar_date"));
+
+    return status;
+}
+
+int BusDataLoader::load_routes(char const *dir_path, sqlite3 *db) {
+    int status = 0;
+
+    status = insert_data(dir_path, fn_routes, db, *table_descriptor("route"));
+
+    return status;
+}
+
+int BusDataLoader::load_stop_times(char const *dir_path, sqlite3 *db) {
+    int status = 0;
+
+    status = insert_data(dir_path, fn_stopTimes, db, *table_descriptor("stop_time"));
+
+    return status;
+}
+
+int BusDataLoader::load_stops(char const *dir_path, sqlite3 *db) {
+    int status = 0;
+
+    status = insert_data(dir_path, fn_stops, db, *table_descriptor("stop"));
+
+    return status;
+}
+
+int BusDataLoader::load_trips(char const *dir_path, sqlite3 *db) {
+    int status = 0;
+
+    status = insert_data(dir_path, fn_trips, db, *table_descriptor("trip"));
+
+    return status;
+}
+
+int BusDataLoader::load_agency(char const *dir_path, sqlite3 *db) {
+    int status = 0;
+
+    status = insert_data(dir_path, fn_agency, db, *table_descriptor("agency"));
+
+    return status;
+}
+
+int BusDataLoader::load_shapes(char const *dir_path, sqlite3 *db) {
+    int status = 0;
+
+    if (shape_geometry) {
+        return load_shape_geometry(dir_path, db);
+    }
+
+    status = insert_data(dir_path, fn_shapes, db, *table_descriptor("shape"));
 
     return status;
 }
 
-int BusDataLoader::create_indices(sqlite3 *db) {
+static bool point_before(const ShapePoint &a, const ShapePoint &b) {
+    return a.sequence < b.sequence;
+}
+
+static int write_shape(sqlite3_stmt *stmt, int64_t shapeId, vector<ShapePoint> &points, string &blob) {
+    stable_sort(points.begin(), points.end(), point_before);
+    blob.clear();
+    ShapeGeometry::encode(points, &blob);
+
+    sqlite3_bind_int64(stmt, 1, shapeId);
+    sqlite3_bind_int64(stmt, 2, (sqlite3_int64) points.size());
+    sqlite3_bind_blob(stmt, 3, blob.data(), (int) blob.size(), SQLITE_STATIC);
+    int status = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return status == SQLITE_DONE ? 0 : 1;
+}
+
+int BusDataLoader::load_shape_geometry(char const *dir_path, sqlite3 *db) {
+    string filePath = string(dir_path).append("/").append(fn_shapes);
+    MappedFile mapped;
+    const char *data = NULL;
+    size_t size = 0;
+    CsvRecord record;
+    vector<string> warningLines;
+    char warning[256];
+    bool opened = false;
+    int retStatus = 0;
+
+    if (feed_archive != NULL) {
+        opened = feed_archive->member_data(fn_shapes, &data, &size);
+    } else if (mapped.open(filePath.c_str())) {
+        opened = true;
+        data = mapped.data();
+        size = mapped.size();
+    }
+
+    // the geometry is all shape_geom holds, so it cannot be built without the file
+    if (!opened) {
+        printf("Loading shape_geom...................................failed: %s is missing\n\n", fn_shapes);
+        return 1;
+    }
+
+    CsvReader reader(data, size, ',');
+    if (!reader.next_record(record)) {
+        printf("Loading shape_geom...................................failed: %s has no header\n\n", fn_shapes);
+        return 1;
+    }
+
+    // the points are read from the fields the shape table is loaded from, in its column order
+    map<string, int> headerColumns;
+    int index[] = {-1, -1, -1, -1, -1};
+    vector<char> wanted(record.size(), 0);
+    header_columns(record, &headerColumns);
+    for (size_t f = 0; f < SHAPE_TABLE.column_count; f++) {
+        map<string, int>::const_iterator source = headerColumns.find(SHAPE_TABLE.columns[f].source);
+        if (source != headerColumns.end()) {
+            index[f] = source->second;
+            wanted[source->second] = 1;
+        }
+    }
+    if (index[0] < 0 || index[1] < 0 || index[2] < 0 || index[3] < 0) {
+        printf("    WARN: %s has no shape_id, shape_pt_lat, shape_pt_lon or shape_pt_sequence\n", fn_shapes);
+        return 1;
+    }
+
+    sqlite3_stmt *insert = NULL;
+    const char *insertSql = "INSERT OR REPLACE INTO shape_geom (shape_id, point_count, geom) VALUES (?, ?, ?)";
+    if (sqlite3_prepare_v2(db, insertSql, -1, &insert, NULL) != SQLITE_OK) {
+        printf("    WARN: %s\n", sqlite3_errmsg(db));
+        return 1;
+    }
+    sqlite3_exec(db, "SAVEPOINT shape_geom", NULL, NULL, NULL);
+
+    vector<ShapePoint> run;
+    int64_t runId = 0;
+    set<int64_t> written;
+    map<int64_t, vector<ShapePoint> > split;
+    string blob;
+
+    // a run ends when the shape_id changes; a shape seen before is split and waits for the end
+    auto finishRun = [&]() {
+        if (run.empty()) {
+            return;
+        }
+        if (written.count(runId) != 0) {
+            vector<ShapePoint> &points = split[runId];
+            points.insert(points.end(), run.begin(), run.end());
+        } else {
+            if (write_shape(insert, runId, run, blob) != 0) {
+                warningLines.push_back(string("shape ").append(to_string(runId)).append(": ").append(sqlite3_errmsg(db)));
+                retStatus = 1;
+            }
+            written.insert(runId);
+        }
+        run.clear();
+    };
+
+    reader.set_projection(&wanted);
+    while (reader.next_record(record)) {
+        unsigned int lineNo = reader.line_number();
+        report_progress("shape_geom", lineNo);
+
+        int64_t shapeId;
+        ShapePoint point;
+        const CsvField *f = record.fields();
+        size_t count = record.size();
+        if ((size_t) index[3] >= count || (size_t) index[0] >= count || (size_t) index[1] >= count || (size_t) index[2] >= count
+                || !parse_int64(f[index[0]].data, f[index[0]].length, &shapeId)
+                || !parse_decimal(f[index[1]].data, f[index[1]].length, &point.lat)
+                || !parse_decimal(f[index[2]].data, f[index[2]].length, &point.lon)
+                || !parse_int64(f[index[3]].data, f[index[3]].length, &point.sequence)) {
+            snprintf(warning, sizeof(warning), "line %u: not a shape point, skipped", lineNo);
+            warningLines.push_back(warning);
+            continue;
+        }
+        if (index[4] < 0 || (size_t) index[4] >= count || !parse_decimal(f[index[4]].data, f[index[4]].length, &point.dist)) {
+            point.dist = NAN;
+        }
+
+        if (shapeId != runId) {
+            finishRun();
+        }
+        runId = shapeId;
+        run.push_back(point);
+    }
+    finishRun();
+
+    // shapes whose rows were not contiguous: merge the held back rows into what was written
+    sqlite3_stmt *select = NULL;
+    sqlite3_prepare_v2(db, "SELECT geom FROM shape_geom WHERE shape_id = ?", -1, &select, NULL);
+    for (map<int64_t, vector<ShapePoint> >::iterator it = split.begin(); it != split.end(); ++it) {
+        vector<ShapePoint> points;
+        sqlite3_bind_int64(select, 1, it->first);
+        if (sqlite3_step(select) == SQLITE_ROW) {
+            ShapeGeometry::decode(sqlite3_column_blob(select, 0), (size_t) sqlite3_column_bytes(select, 0), &points);
+        }
+        sqlite3_reset(select);
+
+        points.insert(points.end(), it->second.begin(), it->second.end());
+        if (write_shape(insert, it->first, points, blob) != 0) {
+            warningLines.push_back(string("shape ").append(to_string(it->first)).append(": ").append(sqlite3_errmsg(db)));
+            retStatus = 1;
+        }
+    }
+    sqlite3_finalize(select);
+    sqlite3_finalize(insert);
+
+    sqlite3_exec(db, "RELEASE shape_geom", NULL, NULL, NULL);
+
+    printf("Loading shape_geom...................................done (%lu shapes, %lu split)\n", (unsigned long) written.size(), (unsigned long) split.size());
+    for (unsigned int j = 0; j < warningLines.size(); j++) {
+        printf("    WARN: %s\n", warningLines.at(j).c_str());
+    }
+    printf("\n");
+
+    return retStatus;
+}
+
+static double seconds_since(const chrono::steady_clock::time_point &start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int BusDataLoader::create_indices(sqlite3 *db, const set<string> &loaded) {
     char errMsg[1024];
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    bool presorted = false;
+    bool stopTimes = loaded.count(STOP_TIME_TABLE.name) != 0;
+
+    if (presorted_indexes && stopTimes) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        printf("Building stop_time_by_stop and stop_time_by_departure.......");
+
+        // the virtual table import never hands rows to the index, so the keys are read back
+        if (stop_time_index.usable() || (virtual_table_import && stop_time_index.collect(db, time_columns != TIMES_TEXT) == 0)) {
+            presorted = stop_time_index.usable();
+        }
+        if (!presorted) {
+            printf("keys are missing or not integers, indexing stop_time instead\n\n");
+        } else if (stop_time_index.build(db, parse_threads + 1) != 0) {
+            return -1;
+        } else {
+            printf("%lu keys in %.2f s\n\n", (unsigned long) stop_time_index.size(), seconds_since(start));
+        }
+    }
 
     int indexCt = 5;
     const char *createSql[] = {
             "CREATE INDEX idx_st_stop_id on stop_time(stop_id)",
             "CREATE INDEX idx_st_trip_id on stop_time(trip_id)",
-            "CREATE INDEX idx_st_departure_time on stop_time(departure_time)",
+            time_columns == TIMES_TEXT ? "CREATE INDEX idx_st_departure_time on stop_time(departure_time)" : "CREATE INDEX idx_st_departure_secs on stop_time(departure_secs)",
             "CREATE INDEX idx_t_trip_id on trip(trip_id)",
             "CREATE INDEX idx_cd_date on calendar_date(date)"
     };
+    const char *indexedTables[] = {STOP_TIME_TABLE.name, STOP_TIME_TABLE.name, STOP_TIME_TABLE.name, TRIP_TABLE.name, CALENDAR_DATE_TABLE.name};
 
     for (int i = 0; i < indexCt; i++) {
         const char *sql = createSql[i];
 
+        if (loaded.count(indexedTables[i]) == 0) {
+            // a table kept from the last load keeps its indexes
+            continue;
+        }
+
+        if (clustered_stop_times && strstr(sql, "idx_st_trip_id") != NULL) {
+            // the clustered table's primary key already leads with trip_id
+            continue;
+        }
+        if (presorted && strstr(sql, "idx_st_departure") != NULL) {
+            // covered by stop_time_by_departure; idx_st_stop_id stays for the stop times without a departure
+            continue;
+        }
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
         printf("%s............................", sql);
         if (sqlite3_exec(db, sql, NULL, NULL, (char **) &errMsg) != SQLITE_OK) {
             printf("\nError creating index [%s]: %s", sql, errMsg);
             return -1;
         }
-        printf("done\n\n");
+        printf("done in %.2f s\n\n", seconds_since(start));
+    }
+
+    bool places = loaded.count(STOP_TABLE.name) != 0 || loaded.count(SHAPE_TABLE.name) != 0 || loaded.count(TRIP_TABLE.name) != 0;
+    bool names = loaded.count(STOP_TABLE.name) != 0 || loaded.count(TRIP_TABLE.name) != 0;
+    if ((places && SpatialIndex::build(db) != 0) || (names && TextSearch::build(db) != 0)) {
+        return -1;
+    }
+
+    printf("Indexes built in %.2f s\n\n", seconds_since(started));
+
+    return 0;
+}
+
+
+int BusDataLoader::build_departures(sqlite3 *db) {
+    // the keys are still here when the presorted indexes were built from them
+    if (!stop_time_index.usable() && stop_time_index.collect(db, time_columns != TIMES_TEXT) != 0) {
+        return -1;
+    }
+    if (!stop_time_index.usable()) {
+        printf("Building stop_departure..............................keys are missing or not integers, skipped\n\n");
+        return 0;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (StopDepartures::build(db, stop_time_index.by_stop(parse_threads + 1), departure_first_date, departure_days, parse_threads + 1) != 0) {
+        return -1;
     }
+    printf("stop_departure built in %.2f s\n\n", seconds_since(start));
 
     return 0;
 }
 
 
+int BusDataLoader::update_statistics(sqlite3 *db, const set<string> &tables) {
+    vector<string> problems;
+
+    if (QueryPlans::analyze(db, analysis_limit, tables) != 0) {
+        return -1;
+    }
+
+    // a hot query that stopped using its index would scan in production, so it fails the build
+    QueryPlans::check(db, &problems);
+    if (!problems.empty()) {
+        printf("Query plan check failed:\n");
+        for (size_t i = 0; i < problems.size(); i++) {
+            printf("    %s\n", problems[i].c_str());
+        }
+        printf("\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int BusDataLoader::open_build_database(char const *path, sqlite3 **db) {
+    char *errMsg = NULL;
+
+    if (strcmp(path, MEMORY_DATABASE) != 0) {
+        clear_old_database(path);
+    }
+
+    if (sqlite3_open(path, db) != SQLITE_OK
+            || sqlite3_exec(*db, BUILD_PAGE_SIZE_PRAGMA, NULL, NULL, &errMsg) != SQLITE_OK
+            || create_tables(*db, NULL) != SQLITE_DONE) {
+        printf("Could not create %s: %s\n", path, errMsg != NULL ? errMsg : sqlite3_errmsg(*db));
+        sqlite3_free(errMsg);
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(FAST_BUILD_PRAGMAS) / sizeof(FAST_BUILD_PRAGMAS[0]); i++) {
+        if (sqlite3_exec(*db, FAST_BUILD_PRAGMAS[i], NULL, NULL, &errMsg) != SQLITE_OK) {
+            printf("%s failed: %s\n", FAST_BUILD_PRAGMAS[i], errMsg);
+            sqlite3_free(errMsg);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int BusDataLoader::publish_database(char const *build_path, char const *db_path) {
+    // the data has to be on disk before the rename makes it visible
+    int fd = open(build_path, O_RDONLY);
+    if (fd < 0 || fsync(fd) != 0) {
+        printf("Could not sync %s\n", build_path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    close(fd);
+
+    if (rename(build_path, db_path) != 0) {
+        printf("Could not move %s to %s\n", build_path, db_path);
+        return 1;
+    }
+
+    // and so does the directory entry
+    string dir = db_path;
+    size_t slash = dir.find_last_of('/');
+    dir = slash == string::npos ? "." : (slash == 0 ? "/" : dir.substr(0, slash));
+    fd = open(dir.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+
+    return 0;
+}
+
+int BusDataLoader::merge_shard(sqlite3 *db, const string &shardPath, const char *tableName) {
+    sqlite3_stmt *stmt = NULL;
+    char *errMsg = NULL;
+    const char *attachSql = "ATTACH DATABASE ? AS shard";
+    int status = 0;
+
+    if (sqlite3_prepare_v2(db, attachSql, strlen(attachSql), &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, shardPath.c_str(), shardPath.length(), SQLITE_STATIC);
+        status = sqlite3_step(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    if (status != SQLITE_DONE) {
+        printf("    WARN: could not attach %s: %s\n", shardPath.c_str(), sqlite3_errmsg(db));
+        return 1;
+    }
+
+    // both tables come from create_tables, so sqlite copies the stored records without decoding them
+    string sql = string("INSERT INTO main.").append(tableName).append(" SELECT * FROM shard.").append(tableName);
+    status = 0;
+    if (sqlite3_exec(db, sql.c_str(), NULL, NULL, &errMsg) != SQLITE_OK) {
+        printf("    WARN: merging %s failed: %s\n", tableName, errMsg);
+        sqlite3_free(errMsg);
+        status = 1;
+    }
+
+    sqlite3_exec(db, "DETACH DATABASE shard", NULL, NULL, NULL);
+
+    printf("Merging %s...................................done\n", tableName);
+    return status;
+}
+
+int BusDataLoader::load_table_shards(char const *dir_path, char const *db_path, sqlite3 *db) {
+    vector<string> shardPaths;
+    vector<int> results;
+    vector<thread> loaders;
+    int failures = 0;
+
+    for (const TableLoad *table = table_loads; table->table_name != NULL; table++) {
+        shardPaths.push_back(string(db_path).append(".").append(table->table_name).append(".shard"));
+    }
+    results.assign(shardPaths.size(), 0);
+
+    // each table gets a connection and file of its own, so the loads share no sqlite state
+    size_t direct = shardPaths.size() - 1;
+    shard_threads = (unsigned int) direct;
+    for (size_t i = 0; i < direct; i++) {
+        loaders.push_back(thread([this, dir_path, &shardPaths, &results, i]() {
+            sqlite3 *shard = NULL;
+            if (open_build_database(shardPaths[i].c_str(), &shard) != 0) {
+                results[i] = 1;
+            } else {
+                results[i] = (this->*table_loads[i].load)(dir_path, shard);
+            }
+            sqlite3_close(shard);
+        }));
+    }
+
+    // stop_time, by far the largest, goes straight into the target: copying it over would cost more than the overlap saves
+    results[direct] = (this->*table_loads[direct].load)(dir_path, db);
+
+    for (size_t i = 0; i < loaders.size(); i++) {
+        loaders[i].join();
+    }
+    shard_threads = 0;
+
+    for (size_t i = 0; i < direct; i++) {
+        const char *tableName = shape_geometry && strcmp(table_loads[i].table_name, "shape") == 0 ? "shape_geom" : table_loads[i].table_name;
+        failures += results[i] != 0 ? results[i] : merge_shard(db, shardPaths[i], tableName);
+        remove(shardPaths[i].c_str());
+    }
+
+    return failures + results[direct];
+}
+
+unsigned int BusDataLoader::table_parse_threads(const TableDescriptor &table) const {
+    if (shard_threads == 0 || parse_threads == 0) {
+        return parse_threads;
+    }
+    // a shard's loader thread parses its file itself; stop_time, on the calling thread, gets what is left
+    if (strcmp(table.name, STOP_TIME_TABLE.name) != 0) {
+        return 0;
+    }
+    return parse_threads > shard_threads ? parse_threads - shard_threads : 1;
+}
+
+size_t BusDataLoader::estimate_database_size(char const *dir_path, ZipArchive *archive) {
+    size_t total = 0;
+
+    for (size_t i = 0; i < sizeof(FEED_FILES) / sizeof(FEED_FILES[0]); i++) {
+        size_t size = 0;
+        struct stat info;
+        if (archive != NULL) {
+            archive->member_size(FEED_FILES[i], &size);
+        } else if (stat(string(dir_path).append("/").append(FEED_FILES[i]).c_str(), &info) == 0) {
+            size = (size_t) info.st_size;
+        }
+        total += size;
+    }
+
+    return total * DATABASE_SIZE_FACTOR;
+}
+
+string BusDataLoader::loader_settings() const {
+    char settings[256];
+
+    snprintf(settings, sizeof(settings), "times %d, dictionaries %d, shape geometry %d, clustered %d, presorted %d, departures %lld+%u, analysis %d",
+            (int) time_columns, (int) dictionary_encoding, (int) shape_geometry, (int) clustered_stop_times, (int) presorted_indexes,
+            (long long) departure_first_date, departure_days, analysis_limit);
+    return settings;
+}
+
+void BusDataLoader::digest_feed(char const *dir_path, ZipArchive *archive, FeedMeta *digests) const {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    string settings = loader_settings();
+
+    printf("Hashing feed files...................................");
+    fflush(stdout);
+
+    digests->clear();
+    digests->add(SETTINGS_DIGEST, (int64_t) settings.length(), FeedMeta::hash(settings.data(), settings.length()));
+    for (size_t i = 0; i < sizeof(FEED_FILES) / sizeof(FEED_FILES[0]); i++) {
+        string filePath = string(dir_path).append("/").append(FEED_FILES[i]);
+        MappedFile mapped;
+        struct stat info;
+        size_t size;
+        uint32_t crc;
+
+        // a zip member already carries a checksum of its content, so it is not inflated to hash it
+        if (archive != NULL) {
+            if (archive->member_size(FEED_FILES[i], &size) && archive->member_crc32(FEED_FILES[i], &crc)) {
+                digests->add(FEED_FILES[i], (int64_t) size, crc);
+            } else {
+                digests->add(FEED_FILES[i], -1, 0);
+            }
+        } else if (stat(filePath.c_str(), &info) != 0) {
+            digests->add(FEED_FILES[i], -1, 0);
+        } else if (info.st_size == 0 || !mapped.open(filePath.c_str())) {
+            digests->add(FEED_FILES[i], (int64_t) info.st_size, FeedMeta::hash(NULL, 0));
+        } else {
+            digests->add(FEED_FILES[i], (int64_t) mapped.size(), FeedMeta::hash(mapped.data(), mapped.size()));
+        }
+    }
+
+    printf("done in %.2f s\n\n", seconds_since(start));
+}
+
+bool BusDataLoader::find_changed_tables(char const *db_path, const FeedMeta &digests, set<string> *changed) const {
+    sqlite3 *db = NULL;
+    FeedMeta loaded;
+
+    bool found = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK && loaded.read(db) == 0;
+    sqlite3_close(db);
+    if (!found || !digests.matches(loaded, SETTINGS_DIGEST)) {
+        return false;
+    }
+
+    changed->clear();
+    for (size_t i = 0; i < sizeof(FEED_FILES) / sizeof(FEED_FILES[0]); i++) {
+        if (!digests.matches(loaded, FEED_FILES[i])) {
+            changed->insert(table_loads[i].table_name);
+        }
+    }
+    return true;
+}
+
+int BusDataLoader::open_reload_database(char const *db_path, const set<string> &tables, sqlite3 **db) {
+    char *errMsg = NULL;
+    string sql;
+
+    // everything up to the COMMIT in load_data is one transaction, so readers keep the old
+    // tables until then and a reload that fails is rolled back
+    if (sqlite3_open_v2(db_path, db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        printf("Could not open %s: %s\n", db_path, sqlite3_errmsg(*db));
+        return 1;
+    }
+    sqlite3_busy_timeout(*db, RELOAD_BUSY_TIMEOUT_MS);
+    sqlite3_exec(*db, "PRAGMA cache_size = -16384", NULL, NULL, NULL);
+    if (sqlite3_exec(*db, "BEGIN IMMEDIATE", NULL, NULL, &errMsg) != SQLITE_OK) {
+        printf("Could not start the reload of %s: %s\n", db_path, errMsg);
+        sqlite3_free(errMsg);
+        return 1;
+    }
+
+    // dropping a table drops its indexes; the loaded values of its dictionary columns go too
+    for (set<string>::const_iterator it = tables.begin(); it != tables.end(); ++it) {
+        const TableDescriptor *table = table_descriptor(*it);
+        char *drop = sqlite3_mprintf("DROP TABLE IF EXISTS \"%w\"; ", shape_geometry && table == &SHAPE_TABLE ? "shape_geom" : table->name);
+        sql.append(drop).append(table_sql(table)).append("; ");
+        sqlite3_free(drop);
+
+        for (size_t c = 0; c < table->column_count; c++) {
+            if (table->columns[c].type == COLUMN_DICTIONARY) {
+                char *clear = sqlite3_mprintf("DELETE FROM \"dict_%w\"; ", table->columns[c].source);
+                sql.append(clear);
+                sqlite3_free(clear);
+            }
+        }
+    }
+
+    printf("Reloading %lu of %lu tables\n\n", (unsigned long) tables.size(), (unsigned long) (sizeof(FEED_FILES) / sizeof(FEED_FILES[0])));
+    if (sqlite3_exec(*db, sql.c_str(), NULL, NULL, &errMsg) != SQLITE_OK) {
+        printf("Could not clear the changed tables: %s\n", errMsg);
+        sqlite3_free(errMsg);
+        sqlite3_exec(*db, "ROLLBACK", NULL, NULL, NULL);
+        return 1;
+    }
+
+    return 0;
+}
+
+int BusDataLoader::persist_database(sqlite3 *db, char const *path) {
+    sqlite3 *dest = NULL;
+    int status;
+
+    printf("Writing database to %s", path);
+    fflush(stdout);
+
+    if (sqlite3_open(path, &dest) != SQLITE_OK) {
+        printf("\nCould not open %s: %s\n", path, sqlite3_errmsg(dest));
+        sqlite3_close(dest);
+        return 1;
+    }
+
+    // the copy replaces the file's whole content, so it needs no rollback journal either
+    sqlite3_exec(dest, "PRAGMA journal_mode = OFF", NULL, NULL, NULL);
+    sqlite3_exec(dest, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
+
+    sqlite3_backup *backup = sqlite3_backup_init(dest, "main", db, "main");
+    if (backup == NULL) {
+        printf("\nCould not copy to %s: %s\n", path, sqlite3_errmsg(dest));
+        sqlite3_close(dest);
+        return 1;
+    }
+
+    do {
+        status = sqlite3_backup_step(backup, BACKUP_PAGES_PER_STEP);
+        printf(".");
+        fflush(stdout);
+    } while (status == SQLITE_OK || status == SQLITE_BUSY || status == SQLITE_LOCKED);
+
+    sqlite3_backup_finish(backup);
+    if (status != SQLITE_DONE) {
+        printf("\nCould not copy to %s: %s\n", path, sqlite3_errstr(status));
+    } else {
+        printf("done\n");
+    }
+
+    sqlite3_close(dest);
+    return status == SQLITE_DONE ? 0 : 1;
+}
+
 int BusDataLoader::load_data(char const *dir_path, char const *db_path) {
 
-    sqlite3 *db;
-    sqlite3_open(db_path, &db);
+    sqlite3 *db = NULL;
+    string buildPath = string(db_path).append(BUILD_SUFFIX);
     printf("\n\n");
 
     int status = 0;
 
     int failureCt = 0;
 
-    failureCt += load_calendar_dates(dir_path, db);
-    failureCt += load_routes(dir_path, db);
-    failureCt += load_stops(dir_path, db);
-    failureCt += load_trips(dir_path, db);
-    failureCt += load_agency(dir_path, db);
-    failureCt += load_shapes(dir_path, db);
-    failureCt += load_stop_times(dir_path, db);
+    ZipArchive archive;
+    bool zipped = ZipArchive::is_zip_path(dir_path);
+    if (zipped && !archive.open(dir_path)) {
+        printf("Could not read feed archive %s\n", dir_path);
+        return 1;
+    }
+
+    // the tables loaded this time: all of them, unless only some files changed since the last load
+    FeedMeta digests;
+    set<string> loaded;
+    bool partial = false;
+    if (incremental_reload) {
+        digest_feed(dir_path, zipped ? &archive : NULL, &digests);
+        partial = find_changed_tables(db_path, digests, &loaded);
+        if (partial && loaded.empty()) {
+            printf("Feed unchanged since %s was loaded, nothing to reload\n\n", db_path);
+            return 0;
+        }
+    }
+    if (!partial) {
+        for (const TableLoad *table = table_loads; table->table_name != NULL; table++) {
+            loaded.insert(table->table_name);
+        }
+    }
+
+    if (zipped) {
+        // inflate every member up front so later tables are ready while earlier ones load
+        vector<string> members;
+        for (size_t i = 0; table_loads[i].table_name != NULL; i++) {
+            if (loaded.count(table_loads[i].table_name) != 0) {
+                members.push_back(FEED_FILES[i]);
+            }
+        }
+        archive.extract_async(members);
+        feed_archive = &archive;
+    }
+
+    for (size_t i = 0; i < dictionaries.size(); i++) {
+        dictionaries[i]->clear();
+    }
+    stop_time_index.clear();
+
+    bool inMemory = false;
+    if (memory_budget > 0 && !partial) {
+        size_t estimate = estimate_database_size(dir_path, feed_archive);
+        inMemory = estimate <= memory_budget;
+        printf("Estimated database size %lu MB: building %s\n\n", (unsigned long) (estimate >> 20), inMemory ? "in memory" : "on disk");
+    }
+
+    if (partial) {
+        // the tables that did not change stay where they are
+        if (open_reload_database(db_path, loaded, &db) != 0) {
+            sqlite3_close(db);
+            feed_archive = NULL;
+            return 1;
+        }
+    } else if (inMemory || fast_build) {
+        if (open_build_database(inMemory ? MEMORY_DATABASE : buildPath.c_str(), &db) != 0) {
+            sqlite3_close(db);
+            if (!inMemory) {
+                remove(buildPath.c_str());
+            }
+            feed_archive = NULL;
+            return 1;
+        }
+    } else {
+        if (incremental_reload) {
+            // whatever an earlier load left there is replaced
+            clear_old_database(db_path);
+            create_database(db_path, NULL);
+        }
+        sqlite3_open(db_path, &db);
+    }
+
+    if (concurrent_tables && !partial) {
+        failureCt += load_table_shards(dir_path, fast_build ? buildPath.c_str() : db_path, db);
+    } else {
+        for (const TableLoad *table = table_loads; table->table_name != NULL; table++) {
+            if (loaded.count(table->table_name) != 0) {
+                failureCt += (this->*table->load)(dir_path, db);
+            }
+        }
+    }
+
+    feed_archive = NULL;
 
 
     if (failureCt != 0) {
         status = 1;
         printf("\nData load failed with %i errors.", failureCt);
+    } else if ((loaded.count(STOP_TIME_TABLE.name) != 0 && add_time_text_columns(db) != 0) || write_dictionaries(db) != 0
+            || (loaded.count(CALENDAR_DATE_TABLE.name) != 0 && ServiceCalendar::build(db) != 0)) {
+        status = 1;
     } else {
-        status = create_indices(db);
+        status = create_indices(db, loaded);
+    }
+
+    bool departures = loaded.count(STOP_TIME_TABLE.name) != 0 || loaded.count(TRIP_TABLE.name) != 0 || loaded.count(CALENDAR_DATE_TABLE.name) != 0;
+    if (status == 0 && departure_days > 0 && departures) {
+        status = build_departures(db);
+    }
+    stop_time_index.clear();
+
+    // a reload only refreshes the statistics of the tables it rewrote, and of what is built from them
+    set<string> analyzed;
+    if (partial) {
+        analyzed = loaded;
+        if (loaded.count(CALENDAR_DATE_TABLE.name) != 0) {
+            analyzed.insert("service_calendar");
+        }
+        if (loaded.count(STOP_TIME_TABLE.name) != 0) {
+            analyzed.insert("stop_time_by_stop");
+            analyzed.insert("stop_time_by_departure");
+        }
+        if (loaded.count(SHAPE_TABLE.name) != 0) {
+            analyzed.insert("shape_geom");
+        }
+        if (loaded.count(TRIP_TABLE.name) != 0) {
+            analyzed.insert("headsign");
+        }
+        if (departure_days > 0 && departures) {
+            analyzed.insert("stop_departure");
+        }
+    }
+    if (status == 0 && analysis_limit >= 0) {
+        status = update_statistics(db, analyzed);
+    }
+
+    if (status == 0 && incremental_reload) {
+        status = digests.write(db);
+    }
+
+    if (inMemory && status == 0) {
+        status = persist_database(db, fast_build ? buildPath.c_str() : db_path);
+    }
+
+    if (partial && status == 0 && sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+        printf("Could not commit the reload of %s: %s\n", db_path, sqlite3_errmsg(db));
+        status = 1;
+    }
+    if (partial && status != 0) {
+        // leave whatever was at db_path untouched
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
     }
 
     sqlite3_close(db);
 
+    if (fast_build && !partial) {
+        if (status == 0) {
+            status = publish_database(buildPath.c_str(), db_path);
+        }
+        if (status != 0) {
+            // leave whatever was at db_path untouched
+            remove(buildPath.c_str());
+        }
+    }
+
 
     return status;
 
@@ -16,13 +16,206 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <cstring>
 #include <sqlite3.h>
 #include <vector>
 #include <iterator>
+#include <map>
+#include <set>
+#include <thread>
+
+#include "CsvReader.h"
+#include "FieldDecoder.h"
+#include "ZipArchive.h"
+#include "CsvVirtualTable.h"
+#include "StringPool.h"
+#include "ShapeGeometry.h"
+#include "TableSchema.h"
+#include "StopTimeIndex.h"
+#include "FeedMeta.h"
 
 class BusDataLoader {
     public:
 
+    /*!
+     * How insert_data reads the GTFS text files. READER_MMAP maps the file and binds
+     * fields straight out of the mapping; READER_STREAM is the original ifstream/getline path.
+     */
+    enum ReaderMode {
+        READER_STREAM,
+        READER_MMAP
+    };
+
+    BusDataLoader();
+
+    ~BusDataLoader();
+
+    void set_reader_mode(ReaderMode mode);
+
+    /*!
+     * Number of threads that tokenize a file in READER_MMAP mode while the calling
+     * thread, which owns the sqlite connection, writes the rows in file order. 0
+     * parses on the calling thread. Defaults to one less than the number of hardware
+     * threads.
+     */
+    void set_parse_threads(unsigned int threads);
+
+    /*!
+     * When enabled, load_data creates the schema itself in a scratch file next to
+     * db_path, loads it with journaling and syncs off, and only then syncs it and
+     * renames it over db_path. Readers see the old database or the complete new one,
+     * never a partial load; on failure db_path is left alone.
+     */
+    void set_fast_build(bool enabled);
+
+    /*!
+     * Rows written per INSERT statement. The actual count is capped so a statement
+     * never needs more than SQLITE_LIMIT_VARIABLE_NUMBER parameters; 1 writes every
+     * row with its own single-row statement.
+     */
+    void set_insert_batch_rows(size_t rows);
+
+    /*!
+     * When enabled, load_data loads every table on its own thread into its own
+     * scratch database, then copies them into the target in one pass with ATTACH and
+     * INSERT ... SELECT. The load takes about as long as the largest table instead of
+     * the sum of all of them. The tables share the parse threads: each of the smaller
+     * tables is parsed on its own loader thread, and stop_time's parser gets the parse
+     * threads those loader threads leave (at least one).
+     */
+    void set_concurrent_tables(bool enabled);
+
+    /*!
+     * When enabled, each mapped (or inflated) file is loaded with a single
+     * INSERT ... SELECT from a gtfs_csv virtual table over it, so values go from the
+     * tokenizer into the b-tree without binding. See CsvVirtualTable.h.
+     */
+    void set_virtual_table_import(bool enabled);
+
+    /*!
+     * Bytes load_data may use to build the whole database, indexes included, in an
+     * in-memory database, which is then copied to db_path with the backup API. When
+     * the size estimated from the feed's files exceeds it, the database is built on
+     * disk as usual. 0 (the default) always builds on disk.
+     */
+    void set_memory_budget(size_t bytes);
+
+    /*!
+     * When enabled, create_database makes stop_time a WITHOUT ROWID table keyed on
+     * (trip_id, stop_sequence), so a trip's stops are stored together and the
+     * separate trip_id index is not built. The id column is left NULL. With
+     * READER_MMAP and zip feeds the rows go in in key order, so the b-tree only grows
+     * at its right edge: a sorted file streams straight in, and anything after the
+     * first record out of order is sorted before it is inserted. Set it before
+     * create_database.
+     */
+    void set_clustered_stop_times(bool enabled);
+
+    /*!
+     * How stop_time keeps arrival and departure times. TIMES_TEXT stores the feed's
+     * "HH:MM:SS" text as before. TIMES_SECONDS stores seconds since midnight in the
+     * INTEGER columns arrival_secs and departure_secs (past 86400 for trips running
+     * after midnight) and indexes departure_secs instead of the text. TIMES_SECONDS_AND_TEXT
+     * adds arrival_time and departure_time back as VIRTUAL generated columns, formatted
+     * from the seconds, so existing queries keep working without storing the text
+     * (single-digit hours come back zero padded). load_data appends them to the table
+     * once the rows are in, because sqlite computes generated columns on every insert.
+     */
+    enum TimeColumns {
+        TIMES_TEXT,
+        TIMES_SECONDS,
+        TIMES_SECONDS_AND_TEXT
+    };
+
+    /*!
+     * Set before create_database. Defaults to TIMES_TEXT.
+     */
+    void set_time_columns(TimeColumns columns);
+
+    /*!
+     * When enabled, the repetitive text columns trip.trip_headsign, trip.block_id,
+     * route.route_short_name and stop.stop_name are interned while the files are
+     * parsed. Their tables hold integer codes in <column>_code instead, and each
+     * distinct value is written once to dict_<column> (code INTEGER PRIMARY KEY,
+     * value VARCHAR):
+     *
+     *     SELECT h.value FROM trip JOIN dict_trip_headsign h ON h.code = trip.trip_headsign_code;
+     *
+     * Empty fields get a NULL code. Set it before create_database.
+     */
+    void set_dictionary_encoding(bool enabled);
+
+    /*!
+     * The values interned for column (e.g. "trip_headsign") by the last load_data, or
+     * NULL if it is not dictionary encoded. Code c of the database is value c here.
+     */
+    const StringPool *dictionary(const char *column) const;
+
+    /*!
+     * When enabled, shapes.txt is stored one row per shape instead of one per point:
+     * shape_geom (shape_id INTEGER PRIMARY KEY, point_count INTEGER, geom BLOB), where
+     * geom holds the points in shape_pt_sequence order as ShapeGeometry encodes them
+     * (decode with ShapeGeometry::decode). The shape table is not created. Points are
+     * grouped as the file streams past: a shape is written as soon as its run of rows
+     * ends, and only shapes whose rows are split across the file are held back and
+     * merged at the end. The load fails when shapes.txt is missing. Coordinates are
+     * kept to 1e-6 degrees and distances to 1e-4. Set it before create_database.
+     */
+    void set_shape_geometry(bool enabled);
+
+    /*!
+     * When enabled, stop_time gets no departure index. Its keys are kept as the rows
+     * are inserted, radix sorted once the file is in, and written in key order to the
+     * covering tables stop_time_by_stop and stop_time_by_departure (see
+     * StopTimeIndex), which is much cheaper than CREATE INDEX sorting the table on
+     * disk. The sort runs on the parse threads and the calling thread. Stop times
+     * without a departure are not in those tables, so stop_time keeps its stop_id
+     * index. When a key is not an integer the departure index is built as usual
+     * instead.
+     */
+    void set_presorted_indexes(bool enabled);
+
+    /*!
+     * Once the indexes are built, load_data runs ANALYZE so the planner works from the
+     * feed's real row counts, then checks the plans of the canonical queries (see
+     * QueryPlans). A query that no longer searches with its index fails the load, so
+     * a fast build is not published and a reload is rolled back. This sets PRAGMA
+     * analysis_limit for that ANALYZE. 0 (the default) reads every row, which takes
+     * well under a second on the full NJT feed. A negative limit skips the statistics
+     * and the check.
+     */
+    void set_analysis_limit(int rows);
+
+    /*!
+     * When days is above 0, load_data finishes by materializing stop_departure: every
+     * stop's departures on each of days days from first_date (yyyymmdd; 0 starts on
+     * the first service date), with the trip's route and headsign, keyed for range
+     * scans by stop, date and time (see StopDepartures). The dates are worked out on
+     * the parse threads and the calling thread. 0 days (the default) skips it.
+     */
+    void set_departure_window(int64_t first_date, unsigned int days);
+
+    /*!
+     * When enabled, load_data records the size and content hash of every feed file in
+     * feed_meta (see FeedMeta), together with the settings the tables were built with.
+     * The next load into the same db_path compares the feed against it: when nothing
+     * changed it returns at once. When some files changed it reloads just their
+     * tables in place and rebuilds only what is derived from them, keeping every other
+     * table and its indexes. The reload is one transaction in db_path's rollback
+     * journal, so readers see the old tables until it commits, and a reload that fails
+     * leaves db_path as it was. Anything else (a new database, different settings)
+     * replaces the whole database, so there is no need to clear it first.
+     */
+    void set_incremental_reload(bool enabled);
+
+    /*!
+     * dir_path is either a directory holding the GTFS text files or the feed's .zip
+     * archive, which is read in place. Once the tables are loaded, calendar_date is
+     * expanded into the service_calendar bitsets (see ServiceCalendar), and the
+     * indexes are built, including the stop, shape and route R*Trees (see SpatialIndex)
+     * and the stop name and headsign full-text indexes (see TextSearch). Last, the
+     * planner statistics are gathered (see set_analysis_limit).
+     */
     int load_data(char const *dir_path, char const *db_path);
 
     void clear_old_database(char const *dbPath);
@@ -31,13 +224,120 @@ class BusDataLoader {
 
     private:
 
-    void csvline_populate(std::vector <std::string> &record, const std::string& line, char delimiter);
+    typedef int (BusDataLoader::*TableLoadFunction)(char const *dir_path, sqlite3 *db);
+
+    struct TableLoad {
+        const char *table_name;
+        TableLoadFunction load;
+    };
+
+    static const TableLoad table_loads[];
+
+    /*!
+     * How the fields of one GTFS file map onto its INSERT statement, which lists every
+     * column of table: for each column, the index of the header field it is read from
+     * (-1 when the file has no such field). wanted flags the header fields that are
+     * bound at all.
+     */
+    struct InsertPlan {
+        sqlite3_stmt *stmt;
+        const TableDescriptor *table;
+        std::vector<int> source_index;
+        std::vector<char> wanted;
+
+        /*!
+         * Header fields of the clustering key, when rows are inserted in key order.
+         */
+        std::vector<int> key_index;
+
+        /*!
+         * Where the keys of each inserted row are kept, when stop_time is indexed from
+         * them. A row's keys are read as it is parsed and held in row_keys (one per
+         * buffered row) until the row is in the table.
+         */
+        StopTimeIndex *index_keys;
+        std::vector<StopTimeKey> row_keys;
+        std::vector<char> row_key_states;
+
+        /*!
+         * Pool each column's values are interned in, NULL for columns stored as they are.
+         */
+        std::vector<StringPool *> dictionaries;
+
+        /*!
+         * Rows are buffered and written batch_rows at a time by batch_stmt, whose VALUES
+         * clause repeats the parameters once per row. Buffered fields that point into
+         * [stable_begin, stable_end) are kept as they are; anything else (unescaped
+         * fields, stream-mode lines) is copied into spill and stored as an offset.
+         */
+        sqlite3_stmt *batch_stmt;
+        std::string insert_prefix;
+        size_t batch_rows;
+        size_t pending;
+        std::vector<CsvField> row_fields;
+        std::vector<char> field_state;
+        std::vector<unsigned int> row_lines;
+        std::vector<char> spill;
+        const char *stable_begin;
+        const char *stable_end;
+    };
+
+    const TableDescriptor *table_descriptor(const std::string &tableName) const;
+
+    int create_tables(sqlite3 *db, const char **error_msg);
+
+    std::string table_sql(const TableDescriptor *table) const;
+
+    /*!
+     * The settings that shape the tables, as recorded in feed_meta.
+     */
+    std::string loader_settings() const;
+
+    void digest_feed(char const *dir_path, ZipArchive *archive, FeedMeta *digests) const;
+
+    /*!
+     * True when db_path was loaded from a feed with these settings; changed gets the
+     * tables whose files differ from digests since.
+     */
+    bool find_changed_tables(char const *db_path, const FeedMeta &digests, std::set<std::string> *changed) const;
+
+    /*!
+     * Opens db_path in a BEGIN IMMEDIATE transaction that load_data commits once the
+     * reload is done, with the tables to be reloaded emptied.
+     */
+    int open_reload_database(char const *db_path, const std::set<std::string> &tables, sqlite3 **db);
+
+    int add_time_text_columns(sqlite3 *db);
+
+    int write_dictionaries(sqlite3 *db);
+
+    int load_shape_geometry(char const *dir_path, sqlite3 *db);
+
+    int open_build_database(char const *path, sqlite3 **db);
+
+    int publish_database(char const *build_path, char const *db_path);
+
+    size_t estimate_database_size(char const *dir_path, ZipArchive *archive);
+
+    int persist_database(sqlite3 *db, char const *path);
 
     void get_column_names(sqlite3 *db, std::string tableName, std::vector<std::string> *colNames, int *columnCount);
 
     bool is_number(const std::string& s);
 
-    int insert_data(std::string filePath, sqlite3 *db, std::string tableName, std::vector<std::string> *column_names);
+    int insert_data(char const *dir_path, const char *fileName, sqlite3 *db, const TableDescriptor &table);
+
+    void report_progress(const std::string &tableName, unsigned int lineNo);
+
+    int prepare_insert(sqlite3 *db, const TableDescriptor &table, const CsvRecord &header, InsertPlan *plan);
+
+    int insert_record(sqlite3 *db, InsertPlan &plan, const CsvField *fields, size_t fieldCount, unsigned int lineNo, std::vector<std::string> &warningLines);
+
+    int flush_rows(sqlite3 *db, InsertPlan &plan, std::vector<std::string> &warningLines);
+
+    int insert_in_key_order(sqlite3 *db, const std::string &tableName, InsertPlan &plan, const char *body, size_t size, unsigned int lineBase, std::vector<std::string> &warningLines);
+
+    int insert_from_virtual_table(sqlite3 *db, const InsertPlan &plan, const std::string &filePath, const char *data, size_t size, std::vector<std::string> &warningLines);
 
     int load_calendar_dates(char const *dir_path, sqlite3 *db);
 
@@ -53,7 +353,69 @@ class BusDataLoader {
 
     int load_shapes(char const *dir_path, sqlite3 *db);
 
-    int create_indices(sqlite3 *db);
+    int create_indices(sqlite3 *db, const std::set<std::string> &loaded);
+
+    int update_statistics(sqlite3 *db, const std::set<std::string> &tables);
+
+    int build_departures(sqlite3 *db);
+
+    int load_table_shards(char const *dir_path, char const *db_path, sqlite3 *db);
+
+    /*!
+     * Workers the parser of table's file may start: parse_threads, less what the
+     * loader threads of load_table_shards already take while they run.
+     */
+    unsigned int table_parse_threads(const TableDescriptor &table) const;
+
+    int merge_shard(sqlite3 *db, const std::string &shardPath, const char *tableName);
+
+    ReaderMode reader_mode;
+
+    unsigned int parse_threads;
+
+    bool fast_build;
+
+    size_t insert_batch_rows;
+
+    bool concurrent_tables;
+
+    /*!
+     * Loader threads running beside the calling one, while load_table_shards runs.
+     */
+    unsigned int shard_threads;
+
+    bool virtual_table_import;
+
+    size_t memory_budget;
+
+    bool clustered_stop_times;
+
+    TimeColumns time_columns;
+
+    bool dictionary_encoding;
+
+    /*!
+     * The feed field of every COLUMN_DICTIONARY column, and the pool it is interned in.
+     */
+    std::vector<const char *> dictionary_fields;
+
+    std::vector<StringPool *> dictionaries;
+
+    bool shape_geometry;
+
+    ZipArchive *feed_archive;
+
+    bool presorted_indexes;
+
+    int analysis_limit;
+
+    int64_t departure_first_date;
+
+    unsigned int departure_days;
+
+    bool incremental_reload;
+
+    StopTimeIndex stop_time_index;
 
 };
 
@@ -0,0 +1,163 @@
+/*!
+ * \file    CsvReader
+ * \project 
+ *
+ */
+
+#include "CsvReader.h"
+
+#include <cstring>
+
+using namespace std;
+
+// bytes handed to the scanner at a time; keeps the offset buffer small and in cache
+static const size_t WINDOW_SIZE = 64 * 1024;
+
+
+CsvReader::CsvReader(const char *data, size_t size, char delimiter, CsvScanner::Kernel kernel)
+        : pos(data), end(data + size), delimiter(delimiter), line(1), record_line(0), projection(NULL),
+          scanner(delimiter, kernel), scan_pos(data), window(data),
+          positions((size < WINDOW_SIZE ? size : WINDOW_SIZE) + 64), position_count(0), position_index(0) {
+}
+
+void CsvRecord::finish() {
+    // the slab may have moved while the record grew, so its fields are pointed at it last
+    for (size_t i = 0; i < slab_fields.size(); i++) {
+        field_list[slab_fields[i].first].data = slab.data() + slab_fields[i].second;
+    }
+}
+
+
+void CsvReader::reset(const char *data, size_t size) {
+    pos = data;
+    end = data + size;
+    line = 1;
+    record_line = 0;
+    scanner.reset();
+    scan_pos = data;
+    window = data;
+    position_count = 0;
+    position_index = 0;
+
+    size_t needed = (size < WINDOW_SIZE ? size : WINDOW_SIZE) + 64;
+    if (positions.size() < needed) {
+        positions.resize(needed);
+    }
+}
+
+const char *CsvReader::scan_window() {
+    while (position_index == position_count) {
+        if (scan_pos >= end) {
+            return end;
+        }
+
+        size_t length = end - scan_pos;
+        if (length > WINDOW_SIZE) {
+            length = WINDOW_SIZE;
+        }
+
+        window = scan_pos;
+        position_count = scanner.scan(window, length, &positions[0]);
+        position_index = 0;
+        scan_pos += length;
+    }
+
+    return window + positions[position_index++];
+}
+
+static unsigned int count_lines(const char *start, const char *stop) {
+    unsigned int count = 0;
+    for (const char *nl = start; (nl = (const char *) memchr(nl, '\n', stop - nl)) != NULL; nl++) {
+        count++;
+    }
+    return count;
+}
+
+void CsvReader::skip_quoted_field(CsvRecord &record, const char *start, const char *stop) {
+    line += count_lines(start, stop);
+    record.add_field(start, stop - start);
+}
+
+void CsvReader::add_quoted_field(CsvRecord &record, const char *start, const char *stop) {
+    const char *inner = start + 1;
+
+    line += count_lines(inner, stop);
+
+    const char *quote = (const char *) memchr(inner, '"', stop - inner);
+    if (quote != NULL && quote == stop - 1) {
+        record.add_field(inner, quote - inner);
+        return;
+    }
+
+    vector<char> &slab = record.slab;
+    size_t offset = slab.size();
+    bool inquotes = true;
+
+    for (const char *c = inner; c < stop; c++) {
+        if (inquotes && *c == '"') {
+            if (c + 1 < stop && c[1] == '"') {
+                //encountered 2 double quotes in a row (resolves to 1 double quote)
+                slab.push_back('"');
+                c++;
+            } else {
+                //endquotechar
+                inquotes = false;
+            }
+        } else {
+            slab.push_back(*c);
+        }
+    }
+
+    record.slab_fields.push_back(make_pair(record.size(), offset));
+    record.add_field(NULL, slab.size() - offset);
+}
+
+void CsvReader::skip_terminator(const char *terminator) {
+    if (terminator >= end) {
+        pos = end;
+        return;
+    }
+
+    pos = terminator + 1;
+    line++;
+
+    if (*terminator == '\r' && pos < end && *pos == '\n') {
+        next_structural();
+        pos++;
+    }
+}
+
+bool CsvReader::next_record(CsvRecord &record) {
+    record.clear();
+
+    while (pos < end) {
+        const char *field_start = pos;
+        record_line = line;
+
+        while (true) {
+            const char *p = next_structural();
+            bool terminator = p >= end || *p != delimiter;
+
+            if (terminator && record.empty() && p == field_start) {
+                // blank lines never produce a record
+                skip_terminator(p);
+                break;
+            }
+
+            add_field(record, field_start, p);
+
+            if (!terminator) {
+                pos = p + 1;
+                field_start = pos;
+                continue;
+            }
+
+            skip_terminator(p);
+            record.finish();
+
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,147 @@
+/*!
+ * \file    CsvReader
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __CsvReader_H_
+#define __CsvReader_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "CsvScanner.h"
+
+/*!
+ * A view of one field of a CSV record. The bytes are not NUL terminated and
+ * stay valid until the record is parsed again.
+ */
+struct CsvField {
+    const char *data;
+    size_t length;
+};
+
+/*!
+ * One parsed CSV record. Fields are slices into the source buffer, except for
+ * fields whose bytes had to be rewritten (escaped quotes), which live in the
+ * record's byte slab. The field array, the slab and the slab offsets keep their
+ * capacity from row to row, so once a record has been warmed up on the widest row
+ * of a file, parsing further rows into it does not touch the heap.
+ */
+class CsvRecord {
+    public:
+
+    size_t size() const { return field_list.size(); }
+
+    bool empty() const { return field_list.empty(); }
+
+    const CsvField &operator[](size_t i) const { return field_list[i]; }
+
+    const CsvField *fields() const { return field_list.empty() ? NULL : &field_list[0]; }
+
+    private:
+
+    friend class CsvReader;
+
+    void clear() {
+        field_list.clear();
+        slab.clear();
+        slab_fields.clear();
+    }
+
+    void add_field(const char *data, size_t length) {
+        CsvField field;
+        field.data = data;
+        field.length = length;
+        field_list.push_back(field);
+    }
+
+    void finish();
+
+    std::vector<CsvField> field_list;
+    std::vector<char> slab;
+    std::vector<std::pair<size_t, size_t> > slab_fields;
+};
+
+/*!
+ * Splits an in-memory CSV buffer (typically a MappedFile) into records. The
+ * buffer is tokenized a window at a time by CsvScanner, and fields are handed
+ * out as slices pointing straight into the buffer.
+ */
+class CsvReader {
+    public:
+
+    CsvReader(const char *data, size_t size, char delimiter, CsvScanner::Kernel kernel = CsvScanner::KERNEL_AUTO);
+
+    /*!
+     * Starts over on a new buffer, keeping the scanner's offset buffer so that
+     * line-at-a-time callers do not reallocate it for every line.
+     */
+    void reset(const char *data, size_t size);
+
+    bool next_record(CsvRecord &record);
+
+    /*!
+     * Restricts full field decoding to the fields flagged in wanted (indexed by field
+     * position). Other fields are still delimited, but quoted ones are handed out raw,
+     * without unquoting or unescaping. Pass NULL to decode every field.
+     */
+    void set_projection(const std::vector<char> *wanted) { projection = wanted; }
+
+    unsigned int line_number() const { return record_line; }
+
+    unsigned int lines_consumed() const { return line - 1; }
+
+    const char *position() const { return pos; }
+
+    private:
+
+    const char *next_structural() {
+        if (position_index == position_count) {
+            return scan_window();
+        }
+        return window + positions[position_index++];
+    }
+
+    const char *scan_window();
+
+    void add_field(CsvRecord &record, const char *start, const char *stop) {
+        if (start < stop && *start == '"') {
+            size_t index = record.size();
+            if (projection == NULL || (index < projection->size() && (*projection)[index])) {
+                add_quoted_field(record, start, stop);
+            } else {
+                skip_quoted_field(record, start, stop);
+            }
+            return;
+        }
+        record.add_field(start, stop - start);
+    }
+
+    void add_quoted_field(CsvRecord &record, const char *start, const char *stop);
+
+    void skip_quoted_field(CsvRecord &record, const char *start, const char *stop);
+
+    void skip_terminator(const char *terminator);
+
+    const char *pos;
+    const char *end;
+    char delimiter;
+    unsigned int line;
+    unsigned int record_line;
+    const std::vector<char> *projection;
+
+    CsvScanner scanner;
+    const char *scan_pos;
+    const char *window;
+    std::vector<uint32_t> positions;
+    size_t position_count;
+    size_t position_index;
+};
+
+#endif //__CsvReader_H_
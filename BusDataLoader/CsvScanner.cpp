@@ -0,0 +1,216 @@
+/*!
+ * \file    CsvScanner
+ * \project 
+ *
+ */
+
+#include "CsvScanner.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CSV_SCANNER_X86 1
+#include <immintrin.h>
+#endif
+
+
+static void classify_scalar(const char *block, char delimiter, uint64_t *quotes, uint64_t *structurals) {
+    uint64_t q = 0;
+    uint64_t s = 0;
+    for (int i = 0; i < 64; i++) {
+        char c = block[i];
+        q |= (uint64_t) (c == '"') << i;
+        s |= (uint64_t) (c == delimiter || c == '\n' || c == '\r') << i;
+    }
+    *quotes = q;
+    *structurals = s;
+}
+
+static uint64_t prefix_xor_scalar(uint64_t bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+#ifdef CSV_SCANNER_X86
+
+static void classify_sse2(const char *block, char delimiter, uint64_t *quotes, uint64_t *structurals) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i delim = _mm_set1_epi8(delimiter);
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    uint64_t q = 0;
+    uint64_t s = 0;
+
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (block + i * 16));
+        __m128i st = _mm_or_si128(_mm_cmpeq_epi8(v, delim), _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+        q |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << (i * 16);
+        s |= (uint64_t) (uint16_t) _mm_movemask_epi8(st) << (i * 16);
+    }
+    *quotes = q;
+    *structurals = s;
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char *block, char delimiter, uint64_t *quotes, uint64_t *structurals) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i delim = _mm256_set1_epi8(delimiter);
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+
+    __m256i lo = _mm256_loadu_si256((const __m256i *) block);
+    __m256i hi = _mm256_loadu_si256((const __m256i *) (block + 32));
+
+    __m256i st_lo = _mm256_or_si256(_mm256_cmpeq_epi8(lo, delim), _mm256_or_si256(_mm256_cmpeq_epi8(lo, lf), _mm256_cmpeq_epi8(lo, cr)));
+    __m256i st_hi = _mm256_or_si256(_mm256_cmpeq_epi8(hi, delim), _mm256_or_si256(_mm256_cmpeq_epi8(hi, lf), _mm256_cmpeq_epi8(hi, cr)));
+
+    *quotes = (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, quote))
+            | (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, quote)) << 32;
+    *structurals = (uint64_t) (uint32_t) _mm256_movemask_epi8(st_lo)
+            | (uint64_t) (uint32_t) _mm256_movemask_epi8(st_hi) << 32;
+}
+
+// carry-less multiplication by all ones is a prefix-XOR in a single instruction
+__attribute__((target("pclmul,sse2")))
+static uint64_t prefix_xor_clmul(uint64_t bits) {
+    __m128i all_ones = _mm_set1_epi8((char) 0xff);
+    __m128i result = _mm_clmulepi64_si128(_mm_set_epi64x(0, (long long) bits), all_ones, 0);
+    return (uint64_t) _mm_cvtsi128_si64(result);
+}
+
+#endif
+
+/*!
+ * Quote state of a block worked out one quote at a time, for blocks where a quote
+ * turns up in the middle of an unquoted field. Such a quote is a literal character;
+ * only quotes in opens (field starts and the second half of an escaped pair) can
+ * open a quoted region. Returns the quoted mask and sets closing to the quotes that
+ * ended one.
+ */
+static uint64_t resolve_quotes(uint64_t quotes, uint64_t opens, uint64_t in_quotes, uint64_t closing_carry, uint64_t *closing) {
+    uint64_t quoted = 0;
+    uint64_t closed = 0;
+    bool inside = in_quotes != 0;
+
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = (uint64_t) 1 << i;
+        if (quotes & bit) {
+            bool after_close = i == 0 ? closing_carry != 0 : (closed & (bit >> 1)) != 0;
+            if (inside) {
+                inside = false;
+                closed |= bit;
+            } else if ((opens & bit) || after_close) {
+                inside = true;
+            }
+        }
+        if (inside) {
+            quoted |= bit;
+        }
+    }
+
+    *closing = closed;
+    return quoted;
+}
+
+
+CsvScanner::CsvScanner(char delimiter, Kernel kernel) : delimiter(delimiter), in_quotes(0), after_structural(1), after_closing_quote(0) {
+    if (kernel == KERNEL_AUTO || !kernel_supported(kernel)) {
+        kernel = best_kernel();
+    }
+    active_kernel = kernel;
+    classify = classify_scalar;
+    prefix_xor = prefix_xor_scalar;
+
+#ifdef CSV_SCANNER_X86
+    if (kernel == KERNEL_SSE2) {
+        classify = classify_sse2;
+    } else if (kernel == KERNEL_AVX2) {
+        classify = classify_avx2;
+    }
+    if (kernel != KERNEL_SCALAR && __builtin_cpu_supports("pclmul")) {
+        prefix_xor = prefix_xor_clmul;
+    }
+#endif
+}
+
+bool CsvScanner::kernel_supported(Kernel kernel) {
+    switch (kernel) {
+        case KERNEL_AUTO:
+        case KERNEL_SCALAR:
+            return true;
+#ifdef CSV_SCANNER_X86
+        case KERNEL_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+CsvScanner::Kernel CsvScanner::best_kernel() {
+    if (kernel_supported(KERNEL_AVX2)) {
+        return KERNEL_AVX2;
+    }
+    if (kernel_supported(KERNEL_SSE2)) {
+        return KERNEL_SSE2;
+    }
+    return KERNEL_SCALAR;
+}
+
+size_t CsvScanner::scan(const char *data, size_t size, uint32_t *positions) {
+    size_t count = 0;
+    size_t offset = 0;
+    char tail[64];
+
+    while (offset < size) {
+        const char *block = data + offset;
+        uint64_t valid = ~(uint64_t) 0;
+
+        if (size - offset < 64) {
+            // pad the last partial block so the kernels can always read 64 bytes
+            size_t remaining = size - offset;
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block, remaining);
+            block = tail;
+            valid = ((uint64_t) 1 << remaining) - 1;
+        }
+
+        uint64_t quotes;
+        uint64_t structurals;
+        classify(block, delimiter, &quotes, &structurals);
+
+        // a quote only opens a quoted region at the start of a field or right after the
+        // quote that closed one (an escaped pair); in_quotes carries the state between blocks
+        uint64_t opens = structurals << 1 | after_structural;
+        uint64_t closing_carry = after_closing_quote;
+        after_structural = structurals >> 63;
+
+        // bits set inside a quoted region (opening quote included, closing quote excluded)
+        uint64_t quoted = prefix_xor(quotes) ^ in_quotes;
+        uint64_t closing = quotes & ~quoted;
+        if ((quotes & quoted & ~(opens | quotes << 1 | closing_carry)) != 0) {
+            // a quote in the middle of an unquoted field, which the prefix-XOR took for an opening one
+            quoted = resolve_quotes(quotes, opens, in_quotes, closing_carry, &closing);
+        }
+        in_quotes = (uint64_t) ((int64_t) quoted >> 63);
+        after_closing_quote = closing >> 63;
+
+        structurals &= ~quoted & valid;
+
+        while (structurals != 0) {
+            positions[count++] = (uint32_t) (offset + __builtin_ctzll(structurals));
+            structurals &= structurals - 1;
+        }
+
+        offset += 64;
+    }
+
+    return count;
+}
@@ -0,0 +1,71 @@
+/*!
+ * \file    CsvScanner
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __CsvScanner_H_
+#define __CsvScanner_H_
+
+#include <cstddef>
+#include <stdint.h>
+
+/*!
+ * Vectorized structural scanner for CSV data. Each 64 byte block is classified
+ * into quote, delimiter and line terminator bitmasks; quoted regions are resolved
+ * with a prefix-XOR over the quote mask, and the offsets of every unquoted
+ * delimiter, CR and LF are emitted in bulk. A quote opens a quoted region only at
+ * the start of a field; one in the middle of an unquoted field (12" SIGN) is a
+ * literal character, and blocks holding one are resolved quote by quote.
+ *
+ * The kernel (AVX2, SSE2 or portable scalar) is picked once at runtime from the
+ * CPU features; all kernels produce identical output.
+ */
+class CsvScanner {
+    public:
+
+    enum Kernel {
+        KERNEL_AUTO,
+        KERNEL_SCALAR,
+        KERNEL_SSE2,
+        KERNEL_AVX2
+    };
+
+    CsvScanner(char delimiter, Kernel kernel = KERNEL_AUTO);
+
+    /*!
+     * Scans size bytes starting at data and writes the offsets (relative to data) of all
+     * structural characters to positions, which must have room for size + 64 entries.
+     * Quote state is carried over from the previous call. Returns the number of offsets written.
+     */
+    size_t scan(const char *data, size_t size, uint32_t *positions);
+
+    void reset() {
+        in_quotes = 0;
+        after_structural = 1;
+        after_closing_quote = 0;
+    }
+
+    Kernel kernel() const { return active_kernel; }
+
+    static bool kernel_supported(Kernel kernel);
+
+    static Kernel best_kernel();
+
+    private:
+
+    typedef void (*classify_fn)(const char *block, char delimiter, uint64_t *quotes, uint64_t *structurals);
+
+    char delimiter;
+    uint64_t in_quotes;
+    uint64_t after_structural;
+    uint64_t after_closing_quote;
+    Kernel active_kernel;
+    classify_fn classify;
+    uint64_t (*prefix_xor)(uint64_t);
+};
+
+#endif //__CsvScanner_H_
@@ -0,0 +1,301 @@
+/*!
+ * \file    CsvVirtualTable
+ * \project 
+ *
+ */
+
+#include "CsvVirtualTable.h"
+#include "CsvReader.h"
+#include "FieldDecoder.h"
+#include "MappedFile.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+struct CsvTable {
+    sqlite3_vtab base;
+    MappedFile file;
+    const char *data;
+    size_t size;
+    size_t body;
+    size_t column_count;
+    vector<ColumnType> types;
+};
+
+struct CsvCursor {
+    sqlite3_vtab_cursor base;
+    CsvReader *reader;
+    CsvRecord record;
+    vector<char> wanted;
+    sqlite3_int64 row;
+    bool eof;
+};
+
+/*!
+ * Strips the quotes sqlite leaves around a module argument.
+ */
+static string unquote_argument(const char *arg) {
+    string value(arg);
+    while (!value.empty() && value[0] == ' ') {
+        value.erase(0, 1);
+    }
+    while (!value.empty() && value[value.length() - 1] == ' ') {
+        value.erase(value.length() - 1);
+    }
+
+    if (value.length() >= 2 && (value[0] == '\'' || value[0] == '"') && value[value.length() - 1] == value[0]) {
+        char quote = value[0];
+        string unquoted;
+        for (size_t i = 1; i + 1 < value.length(); i++) {
+            unquoted.push_back(value[i]);
+            if (value[i] == quote && value[i + 1] == quote) {
+                i++;
+            }
+        }
+        return unquoted;
+    }
+    return value;
+}
+
+static int csv_connect(sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **vtab, char **err) {
+    const CsvBufferMap *buffers = (const CsvBufferMap *) aux;
+
+    if (argc != 4 && argc != 5) {
+        *err = sqlite3_mprintf("gtfs_csv takes the path of the file and optionally a table to take column types from");
+        return SQLITE_ERROR;
+    }
+
+    // columns named like one of the type table's get its declared type
+    map<string, ColumnType> declared;
+    if (argc == 5) {
+        sqlite3_stmt *stmt = NULL;
+        char *sql = sqlite3_mprintf("SELECT * FROM \"%w\"", unquote_argument(argv[4]).c_str());
+        int status = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+        sqlite3_free(sql);
+        if (status != SQLITE_OK) {
+            *err = sqlite3_mprintf("gtfs_csv: %s", sqlite3_errmsg(db));
+            return status;
+        }
+        for (int i = 0; i < sqlite3_column_count(stmt); i++) {
+            declared[sqlite3_column_name(stmt, i)] = column_type_from_decl(sqlite3_column_decltype(stmt, i));
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    string path = unquote_argument(argv[3]);
+    CsvTable *table = new CsvTable();
+    memset(&table->base, 0, sizeof(table->base));
+
+    CsvBufferMap::const_iterator buffer = buffers != NULL ? buffers->find(path) : CsvBufferMap::const_iterator();
+    if (buffers != NULL && buffer != buffers->end()) {
+        table->data = buffer->second.first;
+        table->size = buffer->second.second;
+    } else if (table->file.open(path.c_str())) {
+        table->data = table->file.data();
+        table->size = table->file.size();
+    } else {
+        *err = sqlite3_mprintf("gtfs_csv: cannot open %s", path.c_str());
+        delete table;
+        return SQLITE_ERROR;
+    }
+
+    // the header row names the columns
+    CsvReader reader(table->data, table->size, ',');
+    CsvRecord header;
+    if (!reader.next_record(header)) {
+        *err = sqlite3_mprintf("gtfs_csv: %s has no header row", path.c_str());
+        delete table;
+        return SQLITE_ERROR;
+    }
+    table->body = reader.position() - table->data;
+    table->column_count = header.size();
+
+    string schema = "CREATE TABLE x(";
+    for (size_t i = 0; i < header.size(); i++) {
+        const char *name = header[i].data;
+        size_t length = header[i].length;
+        if (i == 0 && length >= 3 && memcmp(name, "\xEF\xBB\xBF", 3) == 0) {
+            name += 3;
+            length -= 3;
+        }
+        trim_field(&name, &length);
+
+        string column(name, length);
+        map<string, ColumnType>::const_iterator type = declared.find(column);
+        table->types.push_back(type != declared.end() ? type->second : COLUMN_TEXT);
+
+        const char *typeName = table->types.back() == COLUMN_INTEGER ? " INTEGER" : (table->types.back() == COLUMN_REAL ? " REAL" : "");
+        char *quoted = sqlite3_mprintf("%s\"%w\"%s", i > 0 ? ", " : "", column.c_str(), typeName);
+        schema.append(quoted);
+        sqlite3_free(quoted);
+    }
+    schema.append(")");
+
+    int status = sqlite3_declare_vtab(db, schema.c_str());
+    if (status != SQLITE_OK) {
+        *err = sqlite3_mprintf("gtfs_csv: bad header in %s: %s", path.c_str(), sqlite3_errmsg(db));
+        delete table;
+        return status;
+    }
+
+    *vtab = &table->base;
+    return SQLITE_OK;
+}
+
+static int csv_disconnect(sqlite3_vtab *vtab) {
+    delete (CsvTable *) vtab;
+    return SQLITE_OK;
+}
+
+static int csv_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+    CsvTable *table = (CsvTable *) vtab;
+
+    // a file can only be scanned; pass the referenced columns on so the rest are left raw
+    info->estimatedCost = (double) table->size;
+    info->estimatedRows = (sqlite3_int64) (table->size / 64 + 1);
+    info->idxStr = sqlite3_mprintf("%llx", (unsigned long long) info->colUsed);
+    info->needToFreeIdxStr = 1;
+    return SQLITE_OK;
+}
+
+static int csv_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor) {
+    CsvTable *table = (CsvTable *) vtab;
+    CsvCursor *csv = new CsvCursor();
+    memset(&csv->base, 0, sizeof(csv->base));
+    csv->reader = new CsvReader(table->data + table->body, table->size - table->body, ',');
+    csv->row = 0;
+    csv->eof = true;
+    *cursor = &csv->base;
+    return SQLITE_OK;
+}
+
+static int csv_close(sqlite3_vtab_cursor *cursor) {
+    CsvCursor *csv = (CsvCursor *) cursor;
+    delete csv->reader;
+    delete csv;
+    return SQLITE_OK;
+}
+
+static int csv_filter(sqlite3_vtab_cursor *cursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+    CsvCursor *csv = (CsvCursor *) cursor;
+    CsvTable *table = (CsvTable *) cursor->pVtab;
+    (void) idxNum;
+    (void) argc;
+    (void) argv;
+
+    // bit 63 of colUsed stands for every column from 63 on
+    unsigned long long used = idxStr != NULL ? strtoull(idxStr, NULL, 16) : ~0ULL;
+    csv->wanted.assign(table->column_count, 0);
+    for (size_t i = 0; i < table->column_count; i++) {
+        csv->wanted[i] = (used >> (i < 63 ? i : 63)) & 1;
+    }
+
+    csv->reader->reset(table->data + table->body, table->size - table->body);
+    csv->reader->set_projection(&csv->wanted);
+    csv->row = 0;
+    csv->eof = !csv->reader->next_record(csv->record);
+    return SQLITE_OK;
+}
+
+static int csv_next(sqlite3_vtab_cursor *cursor) {
+    CsvCursor *csv = (CsvCursor *) cursor;
+    csv->row++;
+    csv->eof = !csv->reader->next_record(csv->record);
+    return SQLITE_OK;
+}
+
+static int csv_eof(sqlite3_vtab_cursor *cursor) {
+    return ((CsvCursor *) cursor)->eof;
+}
+
+static int csv_column(sqlite3_vtab_cursor *cursor, sqlite3_context *context, int column) {
+    CsvCursor *csv = (CsvCursor *) cursor;
+    CsvTable *table = (CsvTable *) cursor->pVtab;
+
+    if ((size_t) column >= csv->record.size()) {
+        sqlite3_result_null(context);
+        return SQLITE_OK;
+    }
+
+    const CsvField &field = csv->record[column];
+
+    // typed columns decode like the loader binds: empty is NULL, anything unparseable stays text
+    ColumnType type = table->types[column];
+    if (type != COLUMN_TEXT && field.length == 0) {
+        sqlite3_result_null(context);
+        return SQLITE_OK;
+    } else if (type == COLUMN_INTEGER) {
+        int64_t value;
+        if (parse_int64(field.data, field.length, &value)) {
+            sqlite3_result_int64(context, value);
+            return SQLITE_OK;
+        }
+    } else if (type == COLUMN_REAL) {
+        double value;
+        if (parse_decimal(field.data, field.length, &value)) {
+            sqlite3_result_double(context, value);
+            return SQLITE_OK;
+        }
+    }
+
+    // fields inside the file stay put for the life of the table; unescaped ones are rewritten by the next row
+    bool stable = field.data >= table->data && field.data + field.length <= table->data + table->size;
+    sqlite3_result_text(context, field.data, (int) field.length, stable ? SQLITE_STATIC : SQLITE_TRANSIENT);
+    return SQLITE_OK;
+}
+
+static int csv_rowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid) {
+    *rowid = ((CsvCursor *) cursor)->row;
+    return SQLITE_OK;
+}
+
+static sqlite3_module csv_module = {
+        0,                  // iVersion
+        csv_connect,        // xCreate
+        csv_connect,        // xConnect
+        csv_best_index,
+        csv_disconnect,
+        csv_disconnect,     // xDestroy
+        csv_open,
+        csv_close,
+        csv_filter,
+        csv_next,
+        csv_eof,
+        csv_column,
+        csv_rowid,
+        NULL,               // xUpdate: read only
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL};
+
+static void gtfs_seconds(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int64_t value;
+    (void) argc;
+    const char *text = (const char *) sqlite3_value_text(argv[0]);
+
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_bytes(argv[0]) == 0) {
+        sqlite3_result_null(context);
+    } else if (sqlite3_value_type(argv[0]) == SQLITE_TEXT && parse_time_seconds(text, sqlite3_value_bytes(argv[0]), &value)) {
+        sqlite3_result_int64(context, value);
+    } else {
+        sqlite3_result_value(context, argv[0]);
+    }
+}
+
+int register_csv_virtual_table(sqlite3 *db, const CsvBufferMap *buffers) {
+    int status = sqlite3_create_function(db, "gtfs_seconds", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, gtfs_seconds, NULL, NULL);
+    if (status != SQLITE_OK) {
+        return status;
+    }
+    return sqlite3_create_module(db, "gtfs_csv", &csv_module, (void *) buffers);
+}
@@ -0,0 +1,47 @@
+/*!
+ * \file    CsvVirtualTable
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __CsvVirtualTable_H_
+#define __CsvVirtualTable_H_
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <utility>
+#include <sqlite3.h>
+
+/*!
+ * Files the gtfs_csv module reads from memory instead of opening them, keyed by the
+ * name given in CREATE VIRTUAL TABLE (used for members of a zip feed).
+ */
+typedef std::map<std::string, std::pair<const char *, size_t> > CsvBufferMap;
+
+/*!
+ * Registers the "gtfs_csv" virtual table module on db. A GTFS text file can then be
+ * queried in place:
+ *
+ *     CREATE VIRTUAL TABLE temp.stops_src USING gtfs_csv('/feeds/nj/stops.txt');
+ *     SELECT stop_name FROM stops_src WHERE zone_id = '589';
+ *
+ * The columns are named by the file's header row and every value is the field's text
+ * (rows shorter than the header give NULL). An optional second argument names a table
+ * whose declared column types are adopted by the same-named columns, e.g.
+ * gtfs_csv('stops.txt', stop): those columns then return integers and reals, and NULL
+ * for empty fields. The file is mapped and tokenized with CsvReader; fields not
+ * referenced by the query are not unescaped. buffers, if given,
+ * must outlive every gtfs_csv table created while it is registered. Registering
+ * again replaces the previous buffers.
+ *
+ * Also registers gtfs_seconds(time), which turns a GTFS "HH:MM:SS" time into
+ * seconds since midnight the way the loader does (empty gives NULL, anything else
+ * is returned unchanged).
+ */
+int register_csv_virtual_table(sqlite3 *db, const CsvBufferMap *buffers = NULL);
+
+#endif //__CsvVirtualTable_H_
@@ -0,0 +1,164 @@
+/*!
+ * \file    FeedMeta
+ * \project 
+ *
+ */
+
+#include "FeedMeta.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotate_left(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// XXH64 reads its input as little endian words, which is what every target here is
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    return rotate_left(acc, 31) * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t value) {
+    acc ^= xxh64_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t FeedMeta::hash(const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *) data;
+    const unsigned char *end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        // four independent lanes over 32 byte stripes
+        uint64_t v1 = PRIME64_1 + PRIME64_2;
+        uint64_t v2 = PRIME64_2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - PRIME64_1;
+        const unsigned char *limit = end - 32;
+        do {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = PRIME64_5;
+    }
+
+    h += (uint64_t) size;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotate_left(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t) read32(p) * PRIME64_1;
+        h = rotate_left(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * PRIME64_5;
+        h = rotate_left(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+void FeedMeta::add(const string &name, int64_t size, uint64_t hash) {
+    FileDigest digest;
+    digest.size = size;
+    digest.hash = hash;
+    digests[name] = digest;
+}
+
+bool FeedMeta::matches(const FeedMeta &other, const string &name) const {
+    map<string, FileDigest>::const_iterator mine = digests.find(name);
+    map<string, FileDigest>::const_iterator theirs = other.digests.find(name);
+
+    return mine != digests.end() && theirs != other.digests.end()
+            && mine->second.size == theirs->second.size && mine->second.hash == theirs->second.hash;
+}
+
+int FeedMeta::read(sqlite3 *db) {
+    sqlite3_stmt *stmt = NULL;
+
+    digests.clear();
+    if (sqlite3_prepare_v2(db, "SELECT name, size, hash FROM feed_meta", -1, &stmt, NULL) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return 1;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const unsigned char *name = sqlite3_column_text(stmt, 0);
+        if (name != NULL) {
+            add((const char *) name, sqlite3_column_int64(stmt, 1), (uint64_t) sqlite3_column_int64(stmt, 2));
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    return 0;
+}
+
+int FeedMeta::write(sqlite3 *db) const {
+    sqlite3_stmt *stmt = NULL;
+    const char *create = "CREATE TABLE IF NOT EXISTS feed_meta (name VARCHAR PRIMARY KEY, size INTEGER, hash INTEGER); DELETE FROM feed_meta";
+    int status = 0;
+
+    sqlite3_exec(db, "SAVEPOINT feed_meta", NULL, NULL, NULL);
+    if (sqlite3_exec(db, create, NULL, NULL, NULL) != SQLITE_OK
+            || sqlite3_prepare_v2(db, "INSERT INTO feed_meta (name, size, hash) VALUES (?, ?, ?)", -1, &stmt, NULL) != SQLITE_OK) {
+        status = 1;
+    }
+    for (map<string, FileDigest>::const_iterator it = digests.begin(); status == 0 && it != digests.end(); ++it) {
+        // sqlite integers are signed, so the hash is stored as its two's complement
+        sqlite3_bind_text(stmt, 1, it->first.c_str(), (int) it->first.length(), SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, it->second.size);
+        sqlite3_bind_int64(stmt, 3, (sqlite3_int64) it->second.hash);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            status = 1;
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    if (status != 0) {
+        printf("    WARN: could not write feed_meta: %s\n", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK TO feed_meta; RELEASE feed_meta", NULL, NULL, NULL);
+        return 1;
+    }
+    sqlite3_exec(db, "RELEASE feed_meta", NULL, NULL, NULL);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*!
+ * \file    FeedMeta
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __FeedMeta_H_
+#define __FeedMeta_H_
+
+#include <cstddef>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <sqlite3.h>
+
+/*!
+ * Size and content hash of one feed file as it was loaded. size is -1 for a file the
+ * feed did not have.
+ */
+struct FileDigest {
+    int64_t size;
+    uint64_t hash;
+};
+
+/*!
+ * What a database was loaded from, kept in it as
+ *
+ *     feed_meta (name VARCHAR PRIMARY KEY, size INTEGER, hash INTEGER)
+ *
+ * with one row per feed file and one for the loader settings the tables were built
+ * with, so the next load can tell which files changed since and reload only their
+ * tables. Files in a directory are hashed with XXH64, which runs at memory speed over
+ * the mapping; a zip member's digest is its CRC-32 from the archive directory, which
+ * needs no inflating.
+ */
+class FeedMeta {
+    public:
+
+    /*!
+     * XXH64 of size bytes at data, seed 0.
+     */
+    static uint64_t hash(const void *data, size_t size);
+
+    void clear() { digests.clear(); }
+
+    void add(const std::string &name, int64_t size, uint64_t hash);
+
+    /*!
+     * True when both hold the same digest for name.
+     */
+    bool matches(const FeedMeta &other, const std::string &name) const;
+
+    /*!
+     * Replaces the digests with db's feed_meta. Returns 0 on success, or 1 when db
+     * has none.
+     */
+    int read(sqlite3 *db);
+
+    /*!
+     * Replaces db's feed_meta with the digests, creating it if need be. Returns 0 on
+     * success.
+     */
+    int write(sqlite3 *db) const;
+
+    private:
+
+    std::map<std::string, FileDigest> digests;
+};
+
+#endif //__FeedMeta_H_
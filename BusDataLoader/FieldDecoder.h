@@ -0,0 +1,245 @@
+/*!
+ * \file    FieldDecoder
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __FieldDecoder_H_
+#define __FieldDecoder_H_
+
+#include <cctype>
+#include <clocale>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+/*!
+ * Storage class a field is decoded to before it is bound, derived from the
+ * declared type of the destination column the same way sqlite derives affinity.
+ */
+enum ColumnType {
+    COLUMN_TEXT,
+    COLUMN_INTEGER,
+    COLUMN_REAL,
+    COLUMN_SECONDS,
+    COLUMN_DICTIONARY
+};
+
+inline ColumnType column_type_from_decl(const char *decl) {
+    if (decl == NULL) {
+        return COLUMN_TEXT;
+    }
+
+    char upper[64];
+    size_t i = 0;
+    for (; decl[i] != 0 && i < sizeof(upper) - 1; i++) {
+        upper[i] = (char) toupper((unsigned char) decl[i]);
+    }
+    upper[i] = 0;
+
+    if (strstr(upper, "INT") != NULL) {
+        return COLUMN_INTEGER;
+    }
+    if (strstr(upper, "REAL") != NULL || strstr(upper, "FLOA") != NULL || strstr(upper, "DOUB") != NULL) {
+        return COLUMN_REAL;
+    }
+    return COLUMN_TEXT;
+}
+
+inline void trim_field(const char **data, size_t *length) {
+    while (*length > 0 && **data == ' ') {
+        (*data)++;
+        (*length)--;
+    }
+    while (*length > 0 && (*data)[*length - 1] == ' ') {
+        (*length)--;
+    }
+}
+
+/*!
+ * Parses an optionally signed decimal integer of up to 18 digits. Returns false
+ * for anything else, so the caller can fall back to binding the text.
+ */
+inline bool parse_int64(const char *data, size_t length, int64_t *out) {
+    trim_field(&data, &length);
+
+    bool negative = false;
+    if (length > 0 && (*data == '-' || *data == '+')) {
+        negative = *data == '-';
+        data++;
+        length--;
+    }
+    if (length == 0 || length > 18) {
+        return false;
+    }
+
+    int64_t value = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned int digit = (unsigned char) data[i] - '0';
+        if (digit > 9) {
+            return false;
+        }
+        value = value * 10 + digit;
+    }
+
+    *out = negative ? -value : value;
+    return true;
+}
+
+/*!
+ * Parses a GTFS time "H:MM:SS" or "HH:MM:SS" into seconds since midnight. Hours may
+ * run past 24 (and to more digits) for trips that end after midnight. The common
+ * eight-character form is decoded without a loop. Returns false for anything else.
+ */
+inline bool parse_time_seconds(const char *data, size_t length, int64_t *out) {
+    trim_field(&data, &length);
+
+    if (length < 7 || data[length - 3] != ':' || data[length - 6] != ':') {
+        return false;
+    }
+
+    const char *m = data + length - 5;
+    unsigned int m1 = (unsigned char) m[0] - '0';
+    unsigned int m2 = (unsigned char) m[1] - '0';
+    unsigned int s1 = (unsigned char) m[3] - '0';
+    unsigned int s2 = (unsigned char) m[4] - '0';
+    if (m1 > 5 || m2 > 9 || s1 > 5 || s2 > 9) {
+        return false;
+    }
+
+    int64_t hours = 0;
+    size_t hourDigits = length - 6;
+    if (hourDigits == 2) {
+        unsigned int h1 = (unsigned char) data[0] - '0';
+        unsigned int h2 = (unsigned char) data[1] - '0';
+        if (h1 > 9 || h2 > 9) {
+            return false;
+        }
+        hours = h1 * 10 + h2;
+    } else if (hourDigits > 9) {
+        return false;
+    } else {
+        for (size_t i = 0; i < hourDigits; i++) {
+            unsigned int digit = (unsigned char) data[i] - '0';
+            if (digit > 9) {
+                return false;
+            }
+            hours = hours * 10 + digit;
+        }
+    }
+
+    *out = hours * 3600 + (m1 * 10 + m2) * 60 + s1 * 10 + s2;
+    return true;
+}
+
+/*!
+ * Parses a fixed-point decimal such as "-74.141421", with an optional exponent.
+ * When the digits fit in a double's mantissa the result is a single exact
+ * division by a power of ten, which is correctly rounded; anything longer or in
+ * exponent form goes through strtod with '.' as the decimal point whatever the
+ * locale. Returns false if the field is not a finite plain decimal number.
+ */
+inline bool parse_decimal(const char *data, size_t length, double *out) {
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    trim_field(&data, &length);
+
+    const char *p = data;
+    const char *end = data + length;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int fraction = 0;
+    bool point = false;
+
+    for (; p < end; p++) {
+        unsigned int digit = (unsigned char) *p - '0';
+        if (digit <= 9) {
+            mantissa = mantissa * 10 + digit;
+            digits++;
+            fraction += point;
+            if (digits > 15) {
+                break;
+            }
+        } else if (*p == '.' && !point) {
+            point = true;
+        } else {
+            break;
+        }
+    }
+
+    if (p == end) {
+        if (digits == 0) {
+            return false;
+        }
+        double value = (double) mantissa / powers[fraction];
+        *out = negative ? -value : value;
+        return true;
+    }
+
+    // too many digits or an exponent: only a plain decimal goes on to strtod, which
+    // would otherwise also take inf, nan and hex floats
+    p = data + (*data == '-' || *data == '+');
+    int mantissaDigits = 0;
+    const char *pointAt = NULL;
+    for (; p < end; p++) {
+        if ((unsigned int) ((unsigned char) *p - '0') <= 9) {
+            mantissaDigits++;
+        } else if (*p == '.' && pointAt == NULL) {
+            pointAt = p;
+        } else {
+            break;
+        }
+    }
+    if (mantissaDigits == 0) {
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+        const char *exponent = p;
+        while (p < end && (unsigned int) ((unsigned char) *p - '0') <= 9) {
+            p++;
+        }
+        if (p == exponent) {
+            return false;
+        }
+    }
+    if (p != end) {
+        return false;
+    }
+
+    char buffer[64];
+    if (length >= sizeof(buffer)) {
+        return false;
+    }
+    memcpy(buffer, data, length);
+    buffer[length] = 0;
+    if (pointAt != NULL) {
+        // strtod reads the decimal point of the current locale, which is not always '.'
+        buffer[pointAt - data] = *localeconv()->decimal_point;
+    }
+
+    char *parsed;
+    double value = strtod(buffer, &parsed);
+    if (parsed != buffer + length || value - value != 0) {
+        // an exponent out of range overflows to infinity
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+#endif //__FieldDecoder_H_
@@ -0,0 +1,66 @@
+/*!
+ * \file    MappedFile
+ * \project 
+ *
+ */
+
+#include "MappedFile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+MappedFile::MappedFile() : fd(-1), addr(NULL), length(0) {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(char const *path) {
+    close();
+
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close();
+        return false;
+    }
+
+    length = (size_t) st.st_size;
+    if (length == 0) {
+        // mmap refuses zero-length mappings; an empty file is still a valid file
+        return true;
+    }
+
+    void *mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        length = 0;
+        close();
+        return false;
+    }
+
+    madvise(mapped, length, MADV_SEQUENTIAL);
+    addr = (const char *) mapped;
+
+    return true;
+}
+
+void MappedFile::close() {
+    if (addr != NULL) {
+        munmap((void *) addr, length);
+        addr = NULL;
+    }
+    length = 0;
+
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
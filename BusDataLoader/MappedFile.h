@@ -0,0 +1,46 @@
+/*!
+ * \file    MappedFile
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __MappedFile_H_
+#define __MappedFile_H_
+
+#include <cstddef>
+
+/*!
+ * Read-only memory mapping of a whole file. The mapping is advised for
+ * sequential access so the kernel reads ahead aggressively while the loader
+ * walks it front to back.
+ */
+class MappedFile {
+    public:
+
+    MappedFile();
+
+    ~MappedFile();
+
+    bool open(char const *path);
+
+    void close();
+
+    const char *data() const { return addr; }
+
+    size_t size() const { return length; }
+
+    private:
+
+    MappedFile(const MappedFile &);
+
+    MappedFile &operator=(const MappedFile &);
+
+    int fd;
+    const char *addr;
+    size_t length;
+};
+
+#endif //__MappedFile_H_
@@ -0,0 +1,269 @@
+/*!
+ * \file    ParallelCsvParser
+ * \project 
+ *
+ */
+
+#include "ParallelCsvParser.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+using namespace std;
+
+
+// where a CSV stream is between two bytes
+enum FieldState {
+    AT_FIELD_START,
+    IN_FIELD,
+    IN_QUOTES,
+    AFTER_QUOTE
+};
+
+/*!
+ * State after c. A quote opens a quoted field only at the start of a field, or right
+ * after the quote that closed one (an escaped pair); elsewhere in a field it is a
+ * literal character.
+ */
+static FieldState next_state(FieldState state, char c, char delimiter) {
+    if (c == '"') {
+        if (state == IN_QUOTES) {
+            return AFTER_QUOTE;
+        }
+        return state == IN_FIELD ? IN_FIELD : IN_QUOTES;
+    }
+    if (state == IN_QUOTES) {
+        return IN_QUOTES;
+    }
+    return c == delimiter || c == '\n' || c == '\r' ? AT_FIELD_START : IN_FIELD;
+}
+
+/*!
+ * The state at the end of size bytes for each state they may start in, so chunks can
+ * be worked out concurrently and chained afterwards. Only quotes and the bytes just
+ * before them matter, so the chunk is walked a quote at a time.
+ */
+static void chunk_transitions(const char *data, size_t size, char delimiter, unsigned char *transitions) {
+    for (int s = 0; s < 4; s++) {
+        transitions[s] = (unsigned char) s;
+    }
+
+    size_t p = 0;
+    while (p < size) {
+        const char *quote = (const char *) memchr(data + p, '"', size - p);
+        size_t q = quote != NULL ? quote - data : size;
+        if (q > p) {
+            // outside quotes, the last byte before the quote decides whether a field starts there
+            FieldState gap = next_state(IN_FIELD, data[q - 1], delimiter);
+            for (int s = 0; s < 4; s++) {
+                if (transitions[s] != IN_QUOTES) {
+                    transitions[s] = (unsigned char) gap;
+                }
+            }
+        }
+        if (quote == NULL) {
+            break;
+        }
+        for (int s = 0; s < 4; s++) {
+            transitions[s] = (unsigned char) next_state((FieldState) transitions[s], '"', delimiter);
+        }
+        p = q + 1;
+    }
+}
+
+void ParallelCsvParser::split_records(const char *data, size_t size, char delimiter, size_t chunk_count, unsigned int thread_count, vector<size_t> &bounds) {
+    bounds.clear();
+    bounds.push_back(0);
+
+    if (chunk_count <= 1 || size == 0) {
+        bounds.push_back(size);
+        return;
+    }
+
+    // the state transitions of every nominal chunk tell whether its start lies inside a quoted field
+    vector<size_t> nominal(chunk_count + 1);
+    vector<unsigned char> transitions(chunk_count * 4);
+    for (size_t i = 0; i <= chunk_count; i++) {
+        nominal[i] = size / chunk_count * i;
+    }
+    nominal[chunk_count] = size;
+
+    vector<thread> counters;
+    unsigned int worker_count = (unsigned int) min((size_t) max(thread_count, 1u), chunk_count);
+    for (unsigned int t = 0; t < worker_count; t++) {
+        counters.push_back(thread([&, t]() {
+            for (size_t i = t; i < chunk_count; i += worker_count) {
+                chunk_transitions(data + nominal[i], nominal[i + 1] - nominal[i], delimiter, &transitions[i * 4]);
+            }
+        }));
+    }
+    for (unsigned int t = 0; t < counters.size(); t++) {
+        counters[t].join();
+    }
+
+    FieldState state = AT_FIELD_START;
+    for (size_t i = 1; i < chunk_count; i++) {
+        state = (FieldState) transitions[(i - 1) * 4 + state];
+
+        if (bounds.back() > nominal[i]) {
+            // the previous boundary already ran past this split point
+            continue;
+        }
+
+        // the record boundary is just past the first line feed outside quotes
+        FieldState field = state;
+        size_t p = nominal[i];
+        while (p < size) {
+            char c = data[p++];
+            if (c == '\n' && field != IN_QUOTES) {
+                break;
+            }
+            field = next_state(field, c, delimiter);
+        }
+
+        if (p < size && p > bounds.back()) {
+            bounds.push_back(p);
+        }
+    }
+
+    bounds.push_back(size);
+}
+
+
+// parsed chunks each worker may hold before it has to wait for the consumer
+static const size_t RING_SLOTS = 2;
+
+/*!
+ * Waits for the other end of a ring: spins briefly, then yields, then sleeps, so a
+ * side that is far ahead stops competing for the cores the other side needs.
+ */
+static void back_off(unsigned int &spins) {
+    spins++;
+    if (spins < 64) {
+        return;
+    } else if (spins < 256) {
+        this_thread::yield();
+    } else {
+        this_thread::sleep_for(chrono::microseconds(50));
+    }
+}
+
+
+ParallelCsvParser::ParallelCsvParser(const char *data, size_t size, char delimiter, unsigned int thread_count, size_t chunk_size, const vector<char> *projection)
+        : data(data), delimiter(delimiter), projection(projection), consumed(0), handed_out(false), stopping(false) {
+    if (thread_count < 1) {
+        thread_count = 1;
+    }
+    if (chunk_size < 1) {
+        chunk_size = 1;
+    }
+
+    split_records(data, size, delimiter, (size + chunk_size - 1) / chunk_size, thread_count, bounds);
+    chunk_count = bounds.size() - 1;
+
+    unsigned int worker_count = (unsigned int) min((size_t) thread_count, chunk_count);
+    for (unsigned int t = 0; t < worker_count; t++) {
+        Ring *ring = new Ring();
+        ring->head.store(0);
+        ring->tail.store(0);
+        ring->slots.resize(RING_SLOTS);
+        rings.push_back(ring);
+    }
+    for (unsigned int t = 0; t < worker_count; t++) {
+        threads.push_back(thread(&ParallelCsvParser::worker, this, t));
+    }
+}
+
+ParallelCsvParser::~ParallelCsvParser() {
+    stopping.store(true);
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    for (size_t i = 0; i < rings.size(); i++) {
+        delete rings[i];
+    }
+}
+
+void ParallelCsvParser::worker(unsigned int index) {
+    Ring *ring = rings[index];
+    size_t head = 0;
+    // reused for every chunk of this worker, so a warm worker parses without allocating
+    CsvReader reader(NULL, 0, delimiter);
+    CsvRecord record;
+    vector<pair<size_t, size_t> > unescaped_fields;
+    reader.set_projection(projection);
+
+    // chunk c belongs to worker c % rings.size(), so each ring holds its chunks in file order
+    for (size_t chunk = index; chunk < chunk_count; chunk += rings.size()) {
+        unsigned int spins = 0;
+        while (head - ring->tail.load(memory_order_acquire) == RING_SLOTS) {
+            if (stopping.load(memory_order_relaxed)) {
+                return;
+            }
+            back_off(spins);
+        }
+
+        parse_chunk(chunk, reader, record, unescaped_fields, ring->slots[head % RING_SLOTS]);
+        ring->head.store(++head, memory_order_release);
+    }
+}
+
+void ParallelCsvParser::parse_chunk(size_t index, CsvReader &reader, CsvRecord &record, vector<pair<size_t, size_t> > &unescaped_fields, CsvRecordBatch &batch) {
+    const char *chunk = data + bounds[index];
+    size_t length = bounds[index + 1] - bounds[index];
+    reader.reset(chunk, length);
+    unescaped_fields.clear();
+
+    // clearing keeps each slot's capacity from the chunks it held before
+    batch.fields.clear();
+    batch.field_counts.clear();
+    batch.lines.clear();
+    batch.unescaped.clear();
+    batch.line_count = 0;
+
+    while (reader.next_record(record)) {
+        for (size_t i = 0; i < record.size(); i++) {
+            CsvField field = record[i];
+            if (field.length > 0 && (field.data < chunk || field.data >= chunk + length)) {
+                // unescaped copies live in the record's slab and are overwritten by the next record
+                unescaped_fields.push_back(make_pair(batch.fields.size(), batch.unescaped.size()));
+                batch.unescaped.append(field.data, field.length);
+            }
+            batch.fields.push_back(field);
+        }
+        batch.field_counts.push_back((uint32_t) record.size());
+        batch.lines.push_back(reader.line_number());
+    }
+
+    for (size_t i = 0; i < unescaped_fields.size(); i++) {
+        batch.fields[unescaped_fields[i].first].data = batch.unescaped.data() + unescaped_fields[i].second;
+    }
+
+    batch.line_count = reader.lines_consumed();
+}
+
+const CsvRecordBatch *ParallelCsvParser::next_batch() {
+    if (handed_out) {
+        // the consumer is done with the previous batch; its slot can be refilled
+        Ring *previous = rings[(consumed - 1) % rings.size()];
+        previous->tail.store(previous->tail.load(memory_order_relaxed) + 1, memory_order_release);
+        handed_out = false;
+    }
+
+    if (consumed >= chunk_count) {
+        return NULL;
+    }
+
+    Ring *ring = rings[consumed % rings.size()];
+    size_t tail = ring->tail.load(memory_order_relaxed);
+    unsigned int spins = 0;
+    while (ring->head.load(memory_order_acquire) == tail) {
+        back_off(spins);
+    }
+
+    consumed++;
+    handed_out = true;
+    return &ring->slots[tail % RING_SLOTS];
+}
@@ -0,0 +1,106 @@
+/*!
+ * \file    ParallelCsvParser
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __ParallelCsvParser_H_
+#define __ParallelCsvParser_H_
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "CsvReader.h"
+
+/*!
+ * All records of one chunk. Fields of record r are the field_counts[r] entries
+ * following those of record r - 1; lines[r] is the record's line within the chunk.
+ */
+struct CsvRecordBatch {
+    std::vector<CsvField> fields;
+    std::vector<uint32_t> field_counts;
+    std::vector<uint32_t> lines;
+    std::string unescaped;
+    unsigned int line_count;
+};
+
+/*!
+ * Parses one large CSV buffer on a pool of threads. The buffer is cut into chunks
+ * whose boundaries are moved forward to the next record boundary (taking quoted
+ * fields into account), the chunks are tokenized concurrently, and next_batch()
+ * hands them back in their original order.
+ *
+ * Chunks are dealt to the workers round robin, and each worker passes its parsed
+ * chunks to the consumer through its own bounded single-producer/single-consumer
+ * ring. Reading the rings in turn restores file order without any locking, and a
+ * full ring stops its worker, so memory stays bounded however large the file is.
+ */
+class ParallelCsvParser {
+    public:
+
+    ParallelCsvParser(const char *data, size_t size, char delimiter, unsigned int thread_count, size_t chunk_size = 4 * 1024 * 1024, const std::vector<char> *projection = NULL);
+
+    ~ParallelCsvParser();
+
+    /*!
+     * Blocks until the next chunk in file order is parsed. The previous batch is
+     * released. Returns NULL once every chunk has been handed out.
+     */
+    const CsvRecordBatch *next_batch();
+
+    /*!
+     * Splits data into at most chunk_count ranges that each start at a record boundary.
+     * bounds receives the start offsets followed by size. Quotes are read the way
+     * CsvScanner reads them, so a quote in the middle of an unquoted field does not
+     * hide the line feeds after it.
+     */
+    static void split_records(const char *data, size_t size, char delimiter, size_t chunk_count, unsigned int thread_count, std::vector<size_t> &bounds);
+
+    private:
+
+    /*!
+     * Parsed chunks of one worker. Only the worker advances head and only the consumer
+     * advances tail; they sit on separate cache lines so neither side's stores
+     * invalidate the other's line on every batch. new only aligns to 16 bytes before
+     * C++17, so head is padded on both sides rather than declared alignas(64), which
+     * keeps each index alone on its line wherever the Ring is allocated.
+     */
+    struct Ring {
+        char leading_padding[64];
+        std::atomic<size_t> head;
+        char head_padding[64 - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> tail;
+        char tail_padding[64 - sizeof(std::atomic<size_t>)];
+        std::vector<CsvRecordBatch> slots;
+    };
+
+    ParallelCsvParser(const ParallelCsvParser &);
+
+    ParallelCsvParser &operator=(const ParallelCsvParser &);
+
+    void worker(unsigned int index);
+
+    void parse_chunk(size_t index, CsvReader &reader, CsvRecord &record, std::vector<std::pair<size_t, size_t> > &unescaped_fields, CsvRecordBatch &batch);
+
+    const char *data;
+    char delimiter;
+    const std::vector<char> *projection;
+    std::vector<size_t> bounds;
+    size_t chunk_count;
+
+    std::vector<Ring *> rings;
+    std::vector<std::thread> threads;
+
+    size_t consumed;
+    bool handed_out;
+    std::atomic<bool> stopping;
+};
+
+#endif //__ParallelCsvParser_H_
@@ -0,0 +1,201 @@
+/*!
+ * \file    QueryPlans
+ * \project 
+ *
+ */
+
+#include "QueryPlans.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+using namespace std;
+
+
+static const char *const PRIMARY_KEY = "PRIMARY KEY";
+
+// a table smaller than this is rightly scanned, so its plan is not checked
+static const int64_t MIN_PLANNED_ROWS = 100;
+
+// keep in step with what the apps run; a plan that stops using its index shows up in the tests
+static const CanonicalQuery CANONICAL_QUERIES[] = {
+        {"departure_board",
+                "SELECT st.departure_time, st.trip_id, t.route_id, t.service_id FROM stop_time st JOIN trip t ON t.trip_id = st.trip_id "
+                "WHERE st.stop_id = ?1 AND st.departure_time >= ?2 ORDER BY st.departure_time LIMIT 20",
+                {{"st", "idx_st_stop_id"}, {"t", "idx_t_trip_id"}}},
+        {"departure_board_secs",
+                "SELECT st.departure_secs, st.trip_id, t.route_id, t.service_id FROM stop_time st JOIN trip t ON t.trip_id = st.trip_id "
+                "WHERE st.stop_id = ?1 AND st.departure_secs >= ?2 ORDER BY st.departure_secs LIMIT 20",
+                {{"st", "idx_st_stop_id"}, {"t", "idx_t_trip_id"}}},
+        {"departure_board_presorted",
+                "SELECT d.departure_secs, d.trip_id, t.route_id, t.service_id FROM stop_time_by_stop d JOIN trip t ON t.trip_id = d.trip_id "
+                "WHERE d.stop_id = ?1 AND d.departure_secs >= ?2 ORDER BY d.departure_secs LIMIT 20",
+                {{"d", PRIMARY_KEY}, {"t", "idx_t_trip_id"}}},
+        {"stop_departures",
+                "SELECT d.departure_secs, d.trip_id, d.route_id, d.headsign_code FROM stop_departure d "
+                "WHERE d.stop_id = ?1 AND d.service_date = ?2 AND d.departure_secs >= ?3 ORDER BY d.departure_secs LIMIT 20",
+                {{"d", PRIMARY_KEY}, {NULL, NULL}}},
+        {"trip_stop_times",
+                "SELECT stop_id, stop_sequence FROM stop_time WHERE trip_id = ?1 ORDER BY stop_sequence",
+                {{"stop_time", "idx_st_trip_id"}, {NULL, NULL}}},
+        {"departures_between",
+                "SELECT trip_id, stop_id FROM stop_time WHERE departure_time BETWEEN ?1 AND ?2",
+                {{"stop_time", "idx_st_departure_time"}, {NULL, NULL}}},
+        {"departures_between_secs",
+                "SELECT trip_id, stop_id FROM stop_time WHERE departure_secs BETWEEN ?1 AND ?2",
+                {{"stop_time", "idx_st_departure_secs"}, {NULL, NULL}}},
+        {"services_on_date",
+                "SELECT service_id FROM calendar_date WHERE date = ?1 AND exception_type = 1",
+                {{"calendar_date", "idx_cd_date"}, {NULL, NULL}}},
+        {"trip",
+                "SELECT route_id, service_id, shape_id FROM trip WHERE trip_id = ?1",
+                {{"trip", "idx_t_trip_id"}, {NULL, NULL}}}
+};
+
+static bool table_exists(sqlite3 *db, const char *table) {
+    sqlite3_stmt *stmt = NULL;
+    bool exists = false;
+
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    sqlite3_finalize(stmt);
+    return exists;
+}
+
+int QueryPlans::analyze(sqlite3 *db, int limit, const set<string> &tables) {
+    char *errMsg = NULL;
+    char *pragma = sqlite3_mprintf("PRAGMA analysis_limit = %d; ", limit);
+    string sql(pragma);
+    sqlite3_free(pragma);
+
+    if (tables.empty()) {
+        sql.append("ANALYZE");
+    }
+    for (set<string>::const_iterator it = tables.begin(); it != tables.end(); ++it) {
+        if (table_exists(db, it->c_str())) {
+            char *analyze = sqlite3_mprintf("ANALYZE \"%w\"; ", it->c_str());
+            sql.append(analyze);
+            sqlite3_free(analyze);
+        }
+    }
+
+    printf("Analyzing..............................................");
+    int status = sqlite3_exec(db, sql.c_str(), NULL, NULL, &errMsg);
+    if (status != SQLITE_OK) {
+        printf("failed: %s\n\n", errMsg);
+        sqlite3_free(errMsg);
+        return 1;
+    }
+    printf("done\n\n");
+
+    return 0;
+}
+
+bool QueryPlans::query_plan(sqlite3 *db, const char *sql, vector<string> *plan) {
+    sqlite3_stmt *stmt = NULL;
+    string explain = string("EXPLAIN QUERY PLAN ").append(sql);
+
+    plan->clear();
+    if (sqlite3_prepare_v2(db, explain.c_str(), -1, &stmt, NULL) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return false;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const unsigned char *detail = sqlite3_column_text(stmt, 3);
+        plan->push_back(detail != NULL ? (const char *) detail : "");
+    }
+    sqlite3_finalize(stmt);
+
+    return true;
+}
+
+static bool index_exists(sqlite3 *db, const char *index) {
+    sqlite3_stmt *stmt = NULL;
+    bool exists = false;
+
+    if (strcmp(index, PRIMARY_KEY) == 0) {
+        return true;
+    }
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type = 'index' AND name = ?", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, index, -1, SQLITE_STATIC);
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    sqlite3_finalize(stmt);
+    return exists;
+}
+
+/*!
+ * False when sqlite_stat1 says the index's table is too small for the plan to matter.
+ * Without statistics every plan is checked.
+ */
+static bool worth_planning(sqlite3 *db, const char *index) {
+    sqlite3_stmt *stmt = NULL;
+    int64_t rows = MIN_PLANNED_ROWS;
+
+    if (sqlite3_prepare_v2(db, "SELECT stat FROM sqlite_stat1 WHERE idx = ?", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, index, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0) != NULL) {
+            // the first number of stat is the row count
+            rows = strtoll((const char *) sqlite3_column_text(stmt, 0), NULL, 10);
+        }
+    }
+    sqlite3_finalize(stmt);
+    return rows >= MIN_PLANNED_ROWS;
+}
+
+/*!
+ * True when a line of plan is "SEARCH table USING [COVERING] INDEX index (...)", or
+ * "SEARCH table USING PRIMARY KEY (...)".
+ */
+static bool searches_with(const vector<string> &plan, const IndexUse &use) {
+    string search = string("SEARCH ").append(use.table).append(" USING ");
+    string index = string(use.index).append(" (");
+
+    for (size_t i = 0; i < plan.size(); i++) {
+        if (plan[i].compare(0, search.length(), search) == 0 && plan[i].find(index, search.length()) != string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t QueryPlans::check(sqlite3 *db, vector<string> *problems) {
+    size_t checked = 0;
+    vector<string> plan;
+
+    for (size_t q = 0; q < sizeof(CANONICAL_QUERIES) / sizeof(CANONICAL_QUERIES[0]); q++) {
+        const CanonicalQuery &query = CANONICAL_QUERIES[q];
+
+        bool applies = true;
+        for (size_t u = 0; u < 2 && query.uses[u].table != NULL; u++) {
+            applies = applies && index_exists(db, query.uses[u].index);
+        }
+        if (!applies || !query_plan(db, query.sql, &plan)) {
+            continue;
+        }
+        checked++;
+
+        for (size_t u = 0; u < 2 && query.uses[u].table != NULL; u++) {
+            if (searches_with(plan, query.uses[u]) || !worth_planning(db, query.uses[u].index)) {
+                continue;
+            }
+            string problem = string(query.name).append(": ").append(query.uses[u].table).append(" is not searched with ")
+                    .append(query.uses[u].index).append(":");
+            for (size_t i = 0; i < plan.size(); i++) {
+                problem.append(i > 0 ? "; " : " ").append(plan[i]);
+            }
+            problems->push_back(problem);
+        }
+    }
+
+    return checked;
+}
+
+const CanonicalQuery *QueryPlans::queries(size_t *count) {
+    *count = sizeof(CANONICAL_QUERIES) / sizeof(CANONICAL_QUERIES[0]);
+    return CANONICAL_QUERIES;
+}
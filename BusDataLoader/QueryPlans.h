@@ -0,0 +1,79 @@
+/*!
+ * \file    QueryPlans
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __QueryPlans_H_
+#define __QueryPlans_H_
+
+#include <cstddef>
+#include <set>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+/*!
+ * A table of a query and the index it has to be searched with: an index name, or
+ * "PRIMARY KEY" for the key of a WITHOUT ROWID table.
+ */
+struct IndexUse {
+    const char *table;      // as the query names it, alias included
+    const char *index;
+};
+
+/*!
+ * One of the queries the apps run most, and how it has to be planned.
+ */
+struct CanonicalQuery {
+    const char *name;
+    const char *sql;
+    IndexUse uses[2];       // unused entries have a NULL table
+};
+
+/*!
+ * Planner statistics for a loaded feed, and the canonical queries whose plans they
+ * must not break.
+ *
+ * Without statistics sqlite plans from fixed guesses, and those guesses sometimes
+ * pick the wrong index. An example is searching a departure board through
+ * idx_st_departure_time when idx_st_stop_id would be better. analyze() records
+ * sqlite_stat1 once the indexes exist, and check() reads every canonical query's
+ * EXPLAIN QUERY PLAN and reports each table that is not searched with its index.
+ *
+ * The queries are written for each stop_time layout the loader builds. A query is
+ * skipped when it does not compile against the database, or when an index it
+ * expects was not created (the clustered trip_id key, the presorted tables). A
+ * table that sqlite_stat1 counts fewer than 100 rows in may be scanned.
+ */
+class QueryPlans {
+    public:
+
+    /*!
+     * Runs ANALYZE with PRAGMA analysis_limit = limit: each index is estimated from
+     * about limit of its rows, and 0 reads all of them. When tables is not empty only
+     * those of them that exist are analyzed and every other table keeps its
+     * statistics. Returns 0 on success.
+     */
+    static int analyze(sqlite3 *db, int limit, const std::set<std::string> &tables);
+
+    /*!
+     * Checks the plan of every canonical query that applies to db and appends one line
+     * per table that is not searched as expected to problems. Returns the number of
+     * queries checked.
+     */
+    static size_t check(sqlite3 *db, std::vector<std::string> *problems);
+
+    /*!
+     * The EXPLAIN QUERY PLAN details of sql, one entry per line of the plan. Returns
+     * false when sql does not compile.
+     */
+    static bool query_plan(sqlite3 *db, const char *sql, std::vector<std::string> *plan);
+
+    static const CanonicalQuery *queries(size_t *count);
+};
+
+#endif //__QueryPlans_H_
@@ -0,0 +1,194 @@
+/*!
+ * \file    ServiceCalendar
+ * \project 
+ *
+ */
+
+#include "ServiceCalendar.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+using namespace std;
+
+
+ServiceCalendar::ServiceCalendar() {
+}
+
+bool ServiceCalendar::day_number(int64_t date, int64_t *day) {
+    int64_t y = date / 10000;
+    int64_t m = date / 100 % 100;
+    int64_t d = date % 100;
+    static const int monthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (date < 0 || m < 1 || m > 12 || d < 1) {
+        return false;
+    }
+    bool leap = y % 4 == 0 && (y % 100 != 0 || y % 400 == 0);
+    if (d > monthDays[m - 1] + (m == 2 && leap)) {
+        return false;
+    }
+
+    // days from civil: March-based years put the leap day last
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    *day = era * 146097 + doe - 719468;
+    return true;
+}
+
+int64_t ServiceCalendar::date_of_day(int64_t day) {
+    // civil from days, the same March-based years backwards
+    day += 719468;
+    int64_t era = (day >= 0 ? day : day - 146096) / 146097;
+    int64_t doe = day - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    int64_t d = doy - (153 * mp + 2) / 5 + 1;
+    int64_t m = mp < 10 ? mp + 3 : mp - 9;
+    int64_t y = yoe + era * 400 + (m <= 2);
+    return y * 10000 + m * 100 + d;
+}
+
+int ServiceCalendar::build(sqlite3 *db) {
+    sqlite3_stmt *stmt = NULL;
+    const char *select = "SELECT service_id, date, exception_type FROM calendar_date WHERE typeof(service_id) = 'integer' AND typeof(date) = 'integer'";
+    vector<int64_t> rows;
+    int64_t startDate = 0;
+    int64_t firstDay = 0;
+    int64_t lastDay = 0;
+    bool anyDay = false;
+    int status = 0;
+
+    printf("Building service_calendar............................");
+
+    if (sqlite3_prepare_v2(db, select, -1, &stmt, NULL) != SQLITE_OK) {
+        printf("failed: %s\n\n", sqlite3_errmsg(db));
+        return 1;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int64_t date = sqlite3_column_int64(stmt, 1);
+        int64_t day;
+        if (!day_number(date, &day)) {
+            continue;
+        }
+        // yyyymmdd sorts like the days it names; day numbers before 1970 are negative
+        if (!anyDay || day < firstDay) {
+            startDate = date;
+            firstDay = day;
+        }
+        lastDay = anyDay ? max(lastDay, day) : day;
+        anyDay = true;
+
+        rows.push_back(sqlite3_column_int64(stmt, 0));
+        rows.push_back(day);
+        rows.push_back(sqlite3_column_int64(stmt, 2));
+    }
+    sqlite3_finalize(stmt);
+
+    // one bitset per service over the whole feed, so any two can be compared day by day
+    uint32_t dayCount = anyDay ? (uint32_t) (lastDay - firstDay + 1) : 0;
+    map<int64_t, vector<unsigned char> > services;
+    for (size_t i = 0; i < rows.size(); i += 3) {
+        vector<unsigned char> &days = services[rows[i]];
+        days.resize((dayCount + 7) / 8);
+
+        int64_t d = rows[i + 1] - firstDay;
+        if (rows[i + 2] == 2) {
+            days[d / 8] &= (unsigned char) ~(1 << (d % 8));
+        } else if (rows[i + 2] == 1) {
+            days[d / 8] |= (unsigned char) (1 << (d % 8));
+        }
+    }
+
+    const char *create = "DROP TABLE IF EXISTS service_calendar; "
+            "CREATE TABLE service_calendar (service_id INTEGER PRIMARY KEY, start_date INTEGER, day_count INTEGER, days BLOB)";
+    const char *insert = "INSERT INTO service_calendar (service_id, start_date, day_count, days) VALUES (?, ?, ?, ?)";
+
+    sqlite3_exec(db, "SAVEPOINT service_calendar", NULL, NULL, NULL);
+    if (sqlite3_exec(db, create, NULL, NULL, NULL) != SQLITE_OK || sqlite3_prepare_v2(db, insert, -1, &stmt, NULL) != SQLITE_OK) {
+        status = 1;
+    }
+    for (map<int64_t, vector<unsigned char> >::const_iterator it = services.begin(); status == 0 && it != services.end(); ++it) {
+        sqlite3_bind_int64(stmt, 1, it->first);
+        sqlite3_bind_int64(stmt, 2, startDate);
+        sqlite3_bind_int64(stmt, 3, dayCount);
+        sqlite3_bind_blob(stmt, 4, it->second.empty() ? "" : (const char *) &it->second[0], (int) it->second.size(), SQLITE_STATIC);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            status = 1;
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    if (status != 0) {
+        printf("failed: %s\n\n", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK TO service_calendar; RELEASE service_calendar", NULL, NULL, NULL);
+        return status;
+    }
+    sqlite3_exec(db, "RELEASE service_calendar", NULL, NULL, NULL);
+    printf("%lu services over %u days\n\n", (unsigned long) services.size(), dayCount);
+
+    return 0;
+}
+
+int ServiceCalendar::load(sqlite3 *db) {
+    sqlite3_stmt *stmt = NULL;
+    const char *select = "SELECT service_id, start_date, day_count, days FROM service_calendar";
+
+    services.clear();
+    bits.clear();
+
+    if (sqlite3_prepare_v2(db, select, -1, &stmt, NULL) != SQLITE_OK) {
+        return 1;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Service service;
+        const unsigned char *days = (const unsigned char *) sqlite3_column_blob(stmt, 3);
+        size_t size = (size_t) sqlite3_column_bytes(stmt, 3);
+
+        if (!day_number(sqlite3_column_int64(stmt, 1), &service.first_day)) {
+            continue;
+        }
+        service.day_count = (uint32_t) min((int64_t) size * 8, (int64_t) sqlite3_column_int64(stmt, 2));
+        service.offset = bits.size();
+        bits.insert(bits.end(), days, days + size);
+        services[sqlite3_column_int64(stmt, 0)] = service;
+    }
+    sqlite3_finalize(stmt);
+
+    return 0;
+}
+
+bool ServiceCalendar::active(int64_t service_id, int date) const {
+    unordered_map<int64_t, Service>::const_iterator found = services.find(service_id);
+    int64_t day;
+    if (found == services.end() || !day_number(date, &day)) {
+        return false;
+    }
+
+    const Service &service = found->second;
+    day -= service.first_day;
+    if (day < 0 || day >= (int64_t) service.day_count) {
+        return false;
+    }
+    return (bits[service.offset + day / 8] >> (day % 8) & 1) != 0;
+}
+
+static void service_active(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    const ServiceCalendar *calendar = (const ServiceCalendar *) sqlite3_user_data(context);
+    (void) argc;
+
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+        sqlite3_result_null(context);
+        return;
+    }
+    sqlite3_result_int(context, calendar->active(sqlite3_value_int64(argv[0]), sqlite3_value_int(argv[1])));
+}
+
+int ServiceCalendar::register_function(sqlite3 *db) const {
+    return sqlite3_create_function(db, "service_active", 2, SQLITE_UTF8, (void *) this, service_active, NULL, NULL);
+}
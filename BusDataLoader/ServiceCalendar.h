@@ -0,0 +1,85 @@
+/*!
+ * \file    ServiceCalendar
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __ServiceCalendar_H_
+#define __ServiceCalendar_H_
+
+#include <cstddef>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+#include <sqlite3.h>
+
+/*!
+ * Which services run on which days, as one bit per day per service.
+ *
+ * build() expands calendar_date into the service_calendar table:
+ *
+ *     service_calendar (service_id INTEGER PRIMARY KEY, start_date INTEGER, day_count INTEGER, days BLOB)
+ *
+ * Bit d of days (bit d % 8 of byte d / 8) is set when the service runs d days after
+ * start_date. Every service covers the same range, the first to the last date in the
+ * feed. Dates are yyyymmdd integers, as calendar_date stores them.
+ *
+ * load() reads the table back so active() answers with a hash lookup and a bit test,
+ * and register_function() exposes the same check to SQL:
+ *
+ *     SELECT trip_id FROM trip WHERE service_active(service_id, 20120406);
+ */
+class ServiceCalendar {
+    public:
+
+    ServiceCalendar();
+
+    /*!
+     * Replaces service_calendar with the expansion of calendar_date. exception_type 1
+     * adds the date and 2 removes it, applied in table order. Rows whose service or
+     * date is not an integer are skipped. Returns 0 on success.
+     */
+    static int build(sqlite3 *db);
+
+    /*!
+     * Reads service_calendar. Returns 0 on success.
+     */
+    int load(sqlite3 *db);
+
+    bool active(int64_t service_id, int date) const;
+
+    size_t service_count() const { return services.size(); }
+
+    /*!
+     * Registers service_active(service_id, date) on db. The calendar must outlive the
+     * connection (or the next registration).
+     */
+    int register_function(sqlite3 *db) const;
+
+    /*!
+     * Days since 1970-01-01 of a yyyymmdd date, negative before then. Returns false
+     * for an invalid date, such as a day past the end of its month (20120230).
+     */
+    static bool day_number(int64_t date, int64_t *day);
+
+    /*!
+     * The yyyymmdd date of a day number, the inverse of day_number.
+     */
+    static int64_t date_of_day(int64_t day);
+
+    private:
+
+    struct Service {
+        int64_t first_day;
+        uint32_t day_count;
+        size_t offset;
+    };
+
+    std::unordered_map<int64_t, Service> services;
+    std::vector<unsigned char> bits;
+};
+
+#endif //__ServiceCalendar_H_
@@ -0,0 +1,134 @@
+/*!
+ * \file    ShapeGeometry
+ * \project 
+ *
+ */
+
+#include "ShapeGeometry.h"
+
+#include <cmath>
+
+using namespace std;
+
+
+static const unsigned char VERSION = 1;
+static const unsigned char FLAG_DISTANCE = 1;
+
+// values are rounded to these steps, so a round trip keeps 6 decimals of a coordinate and 4 of a distance
+static const double COORDINATE_SCALE = 1e6;
+static const double DISTANCE_SCALE = 1e4;
+
+static void put_varint(uint64_t value, string *blob) {
+    while (value >= 0x80) {
+        blob->push_back((char) (value | 0x80));
+        value >>= 7;
+    }
+    blob->push_back((char) value);
+}
+
+static void put_signed(int64_t value, string *blob) {
+    // zigzag: small magnitudes of either sign become small unsigned values
+    put_varint(((uint64_t) value << 1) ^ (uint64_t) (value >> 63), blob);
+}
+
+static bool get_varint(const unsigned char *&p, const unsigned char *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char byte = *p++;
+        result |= (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool get_signed(const unsigned char *&p, const unsigned char *end, int64_t *value) {
+    uint64_t zigzag;
+    if (!get_varint(p, end, &zigzag)) {
+        return false;
+    }
+    *value = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+    return true;
+}
+
+void ShapeGeometry::encode(const vector<ShapePoint> &points, string *blob) {
+    bool distances = !points.empty();
+    for (size_t i = 0; i < points.size() && distances; i++) {
+        distances = !std::isnan(points[i].dist);
+    }
+
+    blob->push_back((char) VERSION);
+    blob->push_back((char) (distances ? FLAG_DISTANCE : 0));
+    put_varint(points.size(), blob);
+
+    int64_t lat = 0;
+    int64_t lon = 0;
+    int64_t sequence = 0;
+    int64_t dist = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        int64_t nextLat = llround(points[i].lat * COORDINATE_SCALE);
+        int64_t nextLon = llround(points[i].lon * COORDINATE_SCALE);
+        put_signed(nextLat - lat, blob);
+        put_signed(nextLon - lon, blob);
+        put_signed(points[i].sequence - sequence, blob);
+        lat = nextLat;
+        lon = nextLon;
+        sequence = points[i].sequence;
+
+        if (distances) {
+            int64_t nextDist = llround(points[i].dist * DISTANCE_SCALE);
+            put_signed(nextDist - dist, blob);
+            dist = nextDist;
+        }
+    }
+}
+
+bool ShapeGeometry::decode(const void *blob, size_t size, vector<ShapePoint> *points) {
+    const unsigned char *p = (const unsigned char *) blob;
+    const unsigned char *end = p + size;
+    uint64_t count;
+
+    points->clear();
+    if (size < 2 || p[0] != VERSION) {
+        return false;
+    }
+    bool distances = (p[1] & FLAG_DISTANCE) != 0;
+    p += 2;
+
+    // every point takes at least three bytes, which bounds a corrupt count
+    if (!get_varint(p, end, &count) || count > (uint64_t) (end - p) / 3) {
+        return false;
+    }
+    points->reserve(count);
+
+    int64_t lat = 0;
+    int64_t lon = 0;
+    int64_t sequence = 0;
+    int64_t dist = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        int64_t dLat, dLon, dSequence, dDist = 0;
+        if (!get_signed(p, end, &dLat) || !get_signed(p, end, &dLon) || !get_signed(p, end, &dSequence) || (distances && !get_signed(p, end, &dDist))) {
+            points->clear();
+            return false;
+        }
+        lat += dLat;
+        lon += dLon;
+        sequence += dSequence;
+        dist += dDist;
+
+        ShapePoint point;
+        point.lat = (double) lat / COORDINATE_SCALE;
+        point.lon = (double) lon / COORDINATE_SCALE;
+        point.sequence = sequence;
+        point.dist = distances ? (double) dist / DISTANCE_SCALE : NAN;
+        points->push_back(point);
+    }
+
+    if (p != end) {
+        points->clear();
+        return false;
+    }
+    return true;
+}
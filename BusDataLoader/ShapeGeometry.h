@@ -0,0 +1,58 @@
+/*!
+ * \file    ShapeGeometry
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __ShapeGeometry_H_
+#define __ShapeGeometry_H_
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*!
+ * One point of a shape. dist is NaN when the shape has no shape_dist_traveled.
+ */
+struct ShapePoint {
+    double lat;
+    double lon;
+    int64_t sequence;
+    double dist;
+};
+
+/*!
+ * Encodes a whole shape as one compact BLOB, the form the shape_geom table stores.
+ *
+ * Coordinates are fixed point (1e-6 degrees, about 0.1 m) and distances are fixed
+ * point to 1e-4, which is the precision GTFS feeds publish. The encoding is lossy
+ * beyond that: decode returns every value rounded to the nearest step, so a feed
+ * with more digits loses them. Each point is stored as
+ * the zigzag-encoded varint difference from the previous point, so neighbouring
+ * points on a street cost a few bytes each:
+ *
+ *     version (1 byte) | flags (1 byte) | varint point count
+ *     per point: zz(dlat) zz(dlon) zz(dsequence) [zz(ddist) when flags has bit 0 set]
+ */
+class ShapeGeometry {
+    public:
+
+    /*!
+     * Appends the encoding of points, in the order given, to blob. Distances are kept
+     * only when every point has one.
+     */
+    static void encode(const std::vector<ShapePoint> &points, std::string *blob);
+
+    /*!
+     * Replaces points with the decoded shape, coordinates and distances rounded as
+     * described above. Returns false if blob is not a shape encoding (points is then
+     * left empty).
+     */
+    static bool decode(const void *blob, size_t size, std::vector<ShapePoint> *points);
+};
+
+#endif //__ShapeGeometry_H_
@@ -0,0 +1,205 @@
+/*!
+ * \file    SpatialIndex
+ * \project 
+ *
+ */
+
+#include "SpatialIndex.h"
+#include "ShapeGeometry.h"
+#include "TableSchema.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <unordered_map>
+
+using namespace std;
+
+
+// mean earth radius, metres
+static const double EARTH_RADIUS = 6371008.8;
+static const double DEGREES_PER_RADIAN = 180.0 / M_PI;
+
+// nearest_stops starts with a box this many metres around the point and widens it fourfold
+static const double INITIAL_RADIUS = 250.0;
+static const double RADIUS_GROWTH = 4.0;
+
+double SpatialIndex::haversine(double lat1, double lon1, double lat2, double lon2) {
+    double phi1 = lat1 / DEGREES_PER_RADIAN;
+    double phi2 = lat2 / DEGREES_PER_RADIAN;
+    double sinLat = sin((phi2 - phi1) / 2);
+    double sinLon = sin((lon2 - lon1) / DEGREES_PER_RADIAN / 2);
+    double a = sinLat * sinLat + cos(phi1) * cos(phi2) * sinLon * sinLon;
+    return 2 * EARTH_RADIUS * asin(min(1.0, sqrt(a)));
+}
+
+struct Box {
+    double min_lat;
+    double max_lat;
+    double min_lon;
+    double max_lon;
+};
+
+static void add_point(unordered_map<int64_t, Box> &boxes, int64_t id, double lat, double lon) {
+    pair<unordered_map<int64_t, Box>::iterator, bool> added = boxes.insert(make_pair(id, Box()));
+    Box &box = added.first->second;
+    if (added.second) {
+        box.min_lat = box.max_lat = lat;
+        box.min_lon = box.max_lon = lon;
+    } else {
+        box.min_lat = min(box.min_lat, lat);
+        box.max_lat = max(box.max_lat, lat);
+        box.min_lon = min(box.min_lon, lon);
+        box.max_lon = max(box.max_lon, lon);
+    }
+}
+
+static int insert_shape_boxes(sqlite3 *db) {
+    sqlite3_stmt *select = NULL;
+    sqlite3_stmt *insert = NULL;
+    unordered_map<int64_t, Box> boxes;
+    vector<ShapePoint> points;
+    int status = 0;
+
+    // one pass over the shapes in table order; a GROUP BY shape_id would sort every point first
+    if (sqlite3_prepare_v2(db, "SELECT shape_id, geom FROM shape_geom", -1, &select, NULL) == SQLITE_OK) {
+        while (sqlite3_step(select) == SQLITE_ROW) {
+            if (!ShapeGeometry::decode(sqlite3_column_blob(select, 1), (size_t) sqlite3_column_bytes(select, 1), &points)) {
+                continue;
+            }
+            for (size_t i = 0; i < points.size(); i++) {
+                add_point(boxes, sqlite3_column_int64(select, 0), points[i].lat, points[i].lon);
+            }
+        }
+    } else {
+        sqlite3_finalize(select);
+        select = NULL;
+        if (sqlite3_prepare_v2(db, "SELECT shape_id, shape_pt_lat, shape_pt_lon FROM shape "
+                "WHERE typeof(shape_id) = 'integer' AND typeof(shape_pt_lat) = 'real' AND typeof(shape_pt_lon) = 'real'", -1, &select, NULL) != SQLITE_OK) {
+            return 1;
+        }
+        while (sqlite3_step(select) == SQLITE_ROW) {
+            add_point(boxes, sqlite3_column_int64(select, 0), sqlite3_column_double(select, 1), sqlite3_column_double(select, 2));
+        }
+    }
+    sqlite3_finalize(select);
+
+    if (sqlite3_prepare_v2(db, "INSERT INTO shape_rtree VALUES (?, ?, ?, ?, ?)", -1, &insert, NULL) != SQLITE_OK) {
+        return 1;
+    }
+    for (unordered_map<int64_t, Box>::const_iterator it = boxes.begin(); status == 0 && it != boxes.end(); ++it) {
+        sqlite3_bind_int64(insert, 1, it->first);
+        sqlite3_bind_double(insert, 2, it->second.min_lat);
+        sqlite3_bind_double(insert, 3, it->second.max_lat);
+        sqlite3_bind_double(insert, 4, it->second.min_lon);
+        sqlite3_bind_double(insert, 5, it->second.max_lon);
+        if (sqlite3_step(insert) != SQLITE_DONE) {
+            status = 1;
+        }
+        sqlite3_reset(insert);
+    }
+    sqlite3_finalize(insert);
+
+    return status;
+}
+
+int SpatialIndex::build(sqlite3 *db) {
+    const char *create = "DROP TABLE IF EXISTS stop_rtree; DROP TABLE IF EXISTS shape_rtree; DROP TABLE IF EXISTS route_rtree; "
+            "CREATE VIRTUAL TABLE stop_rtree USING rtree(id, min_lat, max_lat, min_lon, max_lon); "
+            "CREATE VIRTUAL TABLE shape_rtree USING rtree(id, min_lat, max_lat, min_lon, max_lon); "
+            "CREATE VIRTUAL TABLE route_rtree USING rtree(id, min_lat, max_lat, min_lon, max_lon)";
+
+    // the trees are filled in one transaction, stops in table order: sorting them first
+    // only makes the rtree split and reinsert more
+    const char *stops = "INSERT INTO stop_rtree SELECT id, stop_lat, stop_lat, stop_lon, stop_lon FROM stop "
+            "WHERE typeof(stop_lat) = 'real' AND typeof(stop_lon) = 'real'";
+    const char *routes = "INSERT INTO route_rtree SELECT t.route_id, min(s.min_lat), max(s.max_lat), min(s.min_lon), max(s.max_lon) "
+            "FROM (SELECT DISTINCT route_id, shape_id FROM trip WHERE typeof(route_id) = 'integer' AND typeof(shape_id) = 'integer') t "
+            "JOIN shape_rtree s ON s.id = t.shape_id GROUP BY t.route_id";
+
+    printf("Building spatial index...............................");
+
+    sqlite3_exec(db, "SAVEPOINT spatial_index", NULL, NULL, NULL);
+    if (sqlite3_exec(db, create, NULL, NULL, NULL) != SQLITE_OK || sqlite3_exec(db, stops, NULL, NULL, NULL) != SQLITE_OK
+            || insert_shape_boxes(db) != 0 || sqlite3_exec(db, routes, NULL, NULL, NULL) != SQLITE_OK) {
+        printf("failed: %s\n\n", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK TO spatial_index; RELEASE spatial_index", NULL, NULL, NULL);
+        return 1;
+    }
+    sqlite3_exec(db, "RELEASE spatial_index", NULL, NULL, NULL);
+
+    printf("%lld stops, %lld shapes, %lld routes\n\n", (long long) row_count(db, "stop_rtree"), (long long) row_count(db, "shape_rtree"),
+            (long long) row_count(db, "route_rtree"));
+    return 0;
+}
+
+static bool nearer(const NearbyStop &a, const NearbyStop &b) {
+    return a.distance < b.distance;
+}
+
+int SpatialIndex::nearest_stops(sqlite3 *db, double lat, double lon, size_t count, vector<NearbyStop> *stops) {
+    sqlite3_stmt *stmt = NULL;
+    const char *select = "SELECT s.id, s.stop_id, s.stop_lat, s.stop_lon FROM stop_rtree r JOIN stop s ON s.id = r.id "
+            "WHERE r.max_lat >= ?1 AND r.min_lat <= ?2 AND r.max_lon >= ?3 AND r.min_lon <= ?4";
+
+    stops->clear();
+    if (count == 0) {
+        return 0;
+    }
+    if (sqlite3_prepare_v2(db, select, -1, &stmt, NULL) != SQLITE_OK) {
+        return 1;
+    }
+
+    for (double radius = INITIAL_RADIUS; ; radius *= RADIUS_GROWTH) {
+        // the smallest box holding every point within radius of (lat, lon)
+        double angle = radius / EARTH_RADIUS;
+        double dLat = angle * DEGREES_PER_RADIAN;
+        double minLon = -180;
+        double maxLon = 180;
+        bool everywhere = angle >= M_PI;
+        if (fabs(lat) + dLat < 90) {
+            double dLon = asin(sin(angle) / cos(lat / DEGREES_PER_RADIAN)) * DEGREES_PER_RADIAN;
+            if (lon - dLon >= -180 && lon + dLon <= 180) {
+                // a circle across the antimeridian searches every longitude instead
+                minLon = lon - dLon;
+                maxLon = lon + dLon;
+            }
+        }
+
+        sqlite3_bind_double(stmt, 1, lat - dLat);
+        sqlite3_bind_double(stmt, 2, lat + dLat);
+        sqlite3_bind_double(stmt, 3, minLon);
+        sqlite3_bind_double(stmt, 4, maxLon);
+
+        stops->clear();
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            NearbyStop stop;
+            const unsigned char *stopId = sqlite3_column_text(stmt, 1);
+            stop.id = sqlite3_column_int64(stmt, 0);
+            stop.stop_id = stopId != NULL ? (const char *) stopId : "";
+            stop.lat = sqlite3_column_double(stmt, 2);
+            stop.lon = sqlite3_column_double(stmt, 3);
+            stop.distance = haversine(lat, lon, stop.lat, stop.lon);
+            stops->push_back(stop);
+        }
+        sqlite3_reset(stmt);
+        if (rc != SQLITE_DONE) {
+            sqlite3_finalize(stmt);
+            stops->clear();
+            return 1;
+        }
+
+        // stops farther than radius may be in the box while nearer ones outside it were not,
+        // so the answer is only settled once the count-th nearest lies within radius
+        size_t found = min(count, stops->size());
+        partial_sort(stops->begin(), stops->begin() + found, stops->end(), nearer);
+        if (everywhere || (found == count && (*stops)[found - 1].distance <= radius)) {
+            stops->resize(found);
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+/*!
+ * \file    SpatialIndex
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __SpatialIndex_H_
+#define __SpatialIndex_H_
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+/*!
+ * One stop found by SpatialIndex::nearest_stops.
+ */
+struct NearbyStop {
+    int64_t id;             // stop.id, the row the stop was loaded into
+    std::string stop_id;
+    double lat;
+    double lon;
+    double distance;        // metres, along the great circle
+};
+
+/*!
+ * R*Tree indexes over the feed's geography, so "what is near here" reads a handful of
+ * tree pages instead of scanning a table.
+ *
+ * build() fills three rtree virtual tables, each (id, min_lat, max_lat, min_lon, max_lon):
+ *
+ *     stop_rtree   id = stop.id, a point box per stop with coordinates
+ *     shape_rtree  id = shape_id, the bounding box of the shape's points
+ *     route_rtree  id = route_id, the union of the boxes of the shapes its trips follow
+ *
+ * A route none of whose trips has a shape gets no box. The rtree keeps its bounds as
+ * 32-bit floats, rounded outwards, so a box may be a little larger than its points but
+ * never smaller: use it to find candidates and the real coordinates to decide.
+ *
+ *     SELECT route_id FROM route_rtree JOIN route ON route.route_id = route_rtree.id
+ *     WHERE max_lat >= 40.70 AND min_lat <= 40.75 AND max_lon >= -74.05 AND min_lon <= -74.00;
+ */
+class SpatialIndex {
+    public:
+
+    /*!
+     * Replaces the three rtree tables with boxes for what is loaded now. Shape boxes
+     * come from shape, or from the decoded geometry when the feed was loaded into
+     * shape_geom. Rows whose key is not an integer or whose coordinates are missing
+     * are skipped. Returns 0 on success.
+     */
+    static int build(sqlite3 *db);
+
+    /*!
+     * Replaces stops with the count stops closest to (lat, lon), nearest first. The
+     * search box starts small and widens until it is sure to hold every stop nearer
+     * than the count-th one found, so a dense city costs as little as a sparse one.
+     * Returns 0 on success.
+     */
+    static int nearest_stops(sqlite3 *db, double lat, double lon, size_t count, std::vector<NearbyStop> *stops);
+
+    /*!
+     * Great-circle distance in metres between two points given in degrees.
+     */
+    static double haversine(double lat1, double lon1, double lat2, double lon2);
+};
+
+#endif //__SpatialIndex_H_
@@ -0,0 +1,374 @@
+/*!
+ * \file    StopDepartures
+ * \project 
+ *
+ */
+
+#include "StopDepartures.h"
+#include "ServiceCalendar.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+
+static const uint32_t NO_TRIP = UINT32_MAX;
+
+struct DepartureTrip {
+    int64_t service_id;
+    sqlite3_int64 route_id;
+    sqlite3_int64 headsign_code;
+    bool has_route;
+    bool has_headsign;
+};
+
+/*!
+ * What the departure_rows virtual table reads: for each date, the positions in keys
+ * of the stop times departing that day, ascending.
+ */
+struct DepartureSource {
+    const vector<StopTimeKey> *keys;
+    vector<uint32_t> key_trips;
+    vector<DepartureTrip> trips;
+    vector<int64_t> dates;
+    vector<vector<uint32_t> > departures;
+};
+
+struct DepartureTable {
+    sqlite3_vtab base;
+    const DepartureSource *source;
+};
+
+/*!
+ * Walks the stops in key order and, for each, the dates in order: next[d] is the next
+ * departure of date d not yet returned.
+ */
+struct DepartureCursor {
+    sqlite3_vtab_cursor base;
+    vector<size_t> next;
+    size_t date;
+    size_t stop_end;
+    uint32_t key;
+    sqlite3_int64 row;
+    bool eof;
+};
+
+static void departure_advance(DepartureCursor *cursor, const DepartureSource &source) {
+    size_t dateCount = source.dates.size();
+
+    for (;;) {
+        for (; cursor->date < dateCount; cursor->date++) {
+            const vector<uint32_t> &departures = source.departures[cursor->date];
+            size_t &next = cursor->next[cursor->date];
+            if (next < departures.size() && departures[next] < cursor->stop_end) {
+                cursor->key = departures[next++];
+                return;
+            }
+        }
+
+        // every date is done with this stop: the next stop is the one of the lowest key left
+        uint32_t first = NO_TRIP;
+        for (size_t d = 0; d < dateCount; d++) {
+            if (cursor->next[d] < source.departures[d].size()) {
+                first = min(first, source.departures[d][cursor->next[d]]);
+            }
+        }
+        if (first == NO_TRIP) {
+            cursor->eof = true;
+            return;
+        }
+
+        const vector<StopTimeKey> &keys = *source.keys;
+        size_t end = first + 1;
+        while (end < keys.size() && keys[end].stop_id == keys[first].stop_id) {
+            end++;
+        }
+        cursor->stop_end = end;
+        cursor->date = 0;
+    }
+}
+
+static int departures_connect(sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **vtab, char **err) {
+    (void) argc;
+    (void) argv;
+    (void) err;
+
+    int status = sqlite3_declare_vtab(db, "CREATE TABLE x(stop_id INTEGER, service_date INTEGER, departure_secs INTEGER, "
+            "trip_id INTEGER, route_id INTEGER, headsign_code INTEGER)");
+    if (status != SQLITE_OK) {
+        return status;
+    }
+
+    DepartureTable *table = new DepartureTable();
+    memset(&table->base, 0, sizeof(table->base));
+    table->source = (const DepartureSource *) aux;
+    *vtab = &table->base;
+    return SQLITE_OK;
+}
+
+static int departures_disconnect(sqlite3_vtab *vtab) {
+    delete (DepartureTable *) vtab;
+    return SQLITE_OK;
+}
+
+static int departures_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+    const DepartureSource *source = ((DepartureTable *) vtab)->source;
+    size_t rows = 0;
+    for (size_t d = 0; d < source->departures.size(); d++) {
+        rows += source->departures[d].size();
+    }
+
+    // the rows can only be read in key order
+    info->estimatedRows = (sqlite3_int64) rows;
+    info->estimatedCost = (double) rows;
+    return SQLITE_OK;
+}
+
+static int departures_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor) {
+    (void) vtab;
+    DepartureCursor *departures = new DepartureCursor();
+    memset(&departures->base, 0, sizeof(departures->base));
+    departures->eof = true;
+    *cursor = &departures->base;
+    return SQLITE_OK;
+}
+
+static int departures_close(sqlite3_vtab_cursor *cursor) {
+    delete (DepartureCursor *) cursor;
+    return SQLITE_OK;
+}
+
+static int departures_filter(sqlite3_vtab_cursor *cursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+    DepartureCursor *departures = (DepartureCursor *) cursor;
+    const DepartureSource &source = *((DepartureTable *) cursor->pVtab)->source;
+    (void) idxNum;
+    (void) idxStr;
+    (void) argc;
+    (void) argv;
+
+    departures->next.assign(source.dates.size(), 0);
+    departures->date = source.dates.size();
+    departures->stop_end = 0;
+    departures->row = 0;
+    departures->eof = false;
+    departure_advance(departures, source);
+    return SQLITE_OK;
+}
+
+static int departures_next(sqlite3_vtab_cursor *cursor) {
+    DepartureCursor *departures = (DepartureCursor *) cursor;
+    departures->row++;
+    departure_advance(departures, *((DepartureTable *) cursor->pVtab)->source);
+    return SQLITE_OK;
+}
+
+static int departures_eof(sqlite3_vtab_cursor *cursor) {
+    return ((DepartureCursor *) cursor)->eof;
+}
+
+static int departures_column(sqlite3_vtab_cursor *cursor, sqlite3_context *context, int column) {
+    DepartureCursor *departures = (DepartureCursor *) cursor;
+    const DepartureSource &source = *((DepartureTable *) cursor->pVtab)->source;
+    const StopTimeKey &key = (*source.keys)[departures->key];
+    const DepartureTrip &trip = source.trips[source.key_trips[departures->key]];
+
+    switch (column) {
+        case 0:
+            sqlite3_result_int64(context, key.stop_id);
+            break;
+        case 1:
+            sqlite3_result_int64(context, source.dates[departures->date]);
+            break;
+        case 2:
+            sqlite3_result_int(context, key.departure_secs);
+            break;
+        case 3:
+            sqlite3_result_int64(context, key.trip_id);
+            break;
+        case 4:
+            if (trip.has_route) {
+                sqlite3_result_int64(context, trip.route_id);
+            } else {
+                sqlite3_result_null(context);
+            }
+            break;
+        default:
+            if (trip.has_headsign) {
+                sqlite3_result_int64(context, trip.headsign_code);
+            } else {
+                sqlite3_result_null(context);
+            }
+            break;
+    }
+    return SQLITE_OK;
+}
+
+static int departures_rowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid) {
+    *rowid = ((DepartureCursor *) cursor)->row;
+    return SQLITE_OK;
+}
+
+static sqlite3_module departures_module = {
+        0,                      // iVersion
+        departures_connect,     // xCreate
+        departures_connect,     // xConnect
+        departures_best_index,
+        departures_disconnect,
+        departures_disconnect,  // xDestroy
+        departures_open,
+        departures_close,
+        departures_filter,
+        departures_next,
+        departures_eof,
+        departures_column,
+        departures_rowid,
+        NULL,                   // xUpdate: read only
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL};
+
+/*!
+ * Reads every trip with an integer trip_id and maps each key to its trip, or NO_TRIP.
+ */
+static int load_trips(sqlite3 *db, DepartureSource *source) {
+    sqlite3_stmt *stmt = NULL;
+    unordered_map<int64_t, uint32_t> slots;
+
+    // headsign is a view of the dictionary when trip_headsign is encoded
+    const char *coded = "SELECT trip_id, service_id, route_id, trip_headsign_code FROM trip WHERE typeof(trip_id) = 'integer'";
+    const char *text = "SELECT t.trip_id, t.service_id, t.route_id, h.id FROM trip t LEFT JOIN headsign h ON h.trip_headsign = t.trip_headsign "
+            "WHERE typeof(t.trip_id) = 'integer'";
+    if (sqlite3_prepare_v2(db, coded, -1, &stmt, NULL) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        stmt = NULL;
+        if (sqlite3_prepare_v2(db, text, -1, &stmt, NULL) != SQLITE_OK) {
+            return 1;
+        }
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        DepartureTrip trip;
+        trip.service_id = sqlite3_column_int64(stmt, 1);
+        trip.route_id = sqlite3_column_int64(stmt, 2);
+        trip.headsign_code = sqlite3_column_int64(stmt, 3);
+        trip.has_route = sqlite3_column_type(stmt, 2) != SQLITE_NULL;
+        trip.has_headsign = sqlite3_column_type(stmt, 3) != SQLITE_NULL;
+        if (sqlite3_column_type(stmt, 1) != SQLITE_INTEGER) {
+            // a service that is not an integer never runs in service_calendar
+            trip.service_id = INT64_MIN;
+        }
+        if (slots.insert(make_pair(sqlite3_column_int64(stmt, 0), (uint32_t) source->trips.size())).second) {
+            source->trips.push_back(trip);
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    const vector<StopTimeKey> &keys = *source->keys;
+    source->key_trips.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        unordered_map<int64_t, uint32_t>::const_iterator slot = slots.find(keys[i].trip_id);
+        source->key_trips[i] = slot != slots.end() ? slot->second : NO_TRIP;
+    }
+
+    return 0;
+}
+
+static int64_t first_service_date(sqlite3 *db) {
+    sqlite3_stmt *stmt = NULL;
+    int64_t date = 0;
+
+    if (sqlite3_prepare_v2(db, "SELECT min(start_date) FROM service_calendar", -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        date = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return date;
+}
+
+int StopDepartures::build(sqlite3 *db, const vector<StopTimeKey> &keys, int64_t first_date, unsigned int days, unsigned int threads) {
+    DepartureSource source;
+    ServiceCalendar calendar;
+    int64_t firstDay;
+    const char *create = "DROP TABLE IF EXISTS stop_departure; "
+            "CREATE TABLE stop_departure (stop_id INTEGER, service_date INTEGER, departure_secs INTEGER, trip_id INTEGER, "
+            "route_id INTEGER, headsign_code INTEGER, PRIMARY KEY (stop_id, service_date, departure_secs, trip_id)) WITHOUT ROWID; "
+            "CREATE VIRTUAL TABLE temp.departure_rows USING departure_rows";
+
+    // a trip stopping twice at the same stop and time keeps its first row
+    const char *insert = "INSERT OR IGNORE INTO stop_departure SELECT * FROM temp.departure_rows";
+
+    printf("Building stop_departure..............................");
+
+    if (first_date == 0) {
+        first_date = first_service_date(db);
+    }
+    source.keys = &keys;
+    if (!ServiceCalendar::day_number(first_date, &firstDay) || calendar.load(db) != 0 || load_trips(db, &source) != 0) {
+        printf("failed: %s\n\n", first_date == 0 ? "no service dates" : sqlite3_errmsg(db));
+        return 1;
+    }
+    for (unsigned int d = 0; d < days; d++) {
+        source.dates.push_back(ServiceCalendar::date_of_day(firstDay + d));
+    }
+    source.departures.resize(days);
+
+    // each date is independent: its trips either run that day or not
+    atomic<unsigned int> nextDate(0);
+    vector<thread> workers;
+    unsigned int workerCount = min(max(threads, 1u), max(days, 1u));
+    for (unsigned int t = 0; t < workerCount; t++) {
+        workers.push_back(thread([&]() {
+            vector<char> running(source.trips.size());
+            for (unsigned int d = nextDate++; d < days; d = nextDate++) {
+                for (size_t i = 0; i < source.trips.size(); i++) {
+                    running[i] = calendar.active(source.trips[i].service_id, (int) source.dates[d]);
+                }
+                vector<uint32_t> &departures = source.departures[d];
+                for (size_t k = 0; k < keys.size(); k++) {
+                    uint32_t trip = source.key_trips[k];
+                    if (trip != NO_TRIP && running[trip]) {
+                        departures.push_back((uint32_t) k);
+                    }
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    sqlite3_create_module(db, "departure_rows", &departures_module, (void *) &source);
+
+    sqlite3_exec(db, "SAVEPOINT stop_departure", NULL, NULL, NULL);
+    int status = sqlite3_exec(db, create, NULL, NULL, NULL);
+    if (status == SQLITE_OK) {
+        status = sqlite3_exec(db, insert, NULL, NULL, NULL);
+    }
+    if (status != SQLITE_OK) {
+        printf("failed: %s\n\n", sqlite3_errmsg(db));
+    }
+    sqlite3_exec(db, "DROP TABLE IF EXISTS temp.departure_rows", NULL, NULL, NULL);
+    sqlite3_exec(db, status == SQLITE_OK ? "RELEASE stop_departure" : "ROLLBACK TO stop_departure; RELEASE stop_departure", NULL, NULL, NULL);
+    if (status != SQLITE_OK) {
+        return 1;
+    }
+
+    size_t rows = 0;
+    for (unsigned int d = 0; d < days; d++) {
+        rows += source.departures[d].size();
+    }
+    printf("%lu departures over %u days from %lld\n\n", (unsigned long) rows, days, (long long) first_date);
+
+    return 0;
+}
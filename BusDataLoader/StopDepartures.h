@@ -0,0 +1,50 @@
+/*!
+ * \file    StopDepartures
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __StopDepartures_H_
+#define __StopDepartures_H_
+
+#include <stdint.h>
+#include <vector>
+#include <sqlite3.h>
+
+#include "StopTimeIndex.h"
+
+/*!
+ * Every departure from every stop on each day of a date window, worked out once at
+ * load time so a departure board is one range scan:
+ *
+ *     stop_departure (stop_id, service_date, departure_secs, trip_id, route_id, headsign_code)
+ *
+ * A WITHOUT ROWID table keyed on (stop_id, service_date, departure_secs, trip_id).
+ * service_date is yyyymmdd and departure_secs counts from its midnight, so trips
+ * running past midnight keep the date they started on (departure_secs past 86400).
+ * headsign_code is the trip's row in headsign (see TextSearch), which is its
+ * dictionary code when trip_headsign is dictionary encoded.
+ *
+ *     SELECT departure_secs, route_id, h.trip_headsign FROM stop_departure d JOIN headsign h ON h.id = d.headsign_code
+ *     WHERE stop_id = 18652 AND service_date = 20120406 AND departure_secs >= 28800 LIMIT 10;
+ *
+ * A trip departs on a date when service_calendar says its service runs then. Stop
+ * times of trips missing from trip are left out.
+ */
+class StopDepartures {
+    public:
+
+    /*!
+     * Replaces stop_departure with the departures on days days from first_date
+     * (yyyymmdd; 0 starts on the first day of service_calendar). keys are the stop
+     * times' keys in StopTimeIndex::BY_STOP order. Each date is worked out on one of
+     * up to threads threads and the rows are written in key order. Returns 0 on
+     * success.
+     */
+    static int build(sqlite3 *db, const std::vector<StopTimeKey> &keys, int64_t first_date, unsigned int days, unsigned int threads);
+};
+
+#endif //__StopDepartures_H_
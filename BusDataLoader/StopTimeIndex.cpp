@@ -0,0 +1,402 @@
+/*!
+ * \file    StopTimeIndex
+ * \project 
+ *
+ */
+
+#include "StopTimeIndex.h"
+#include "FieldDecoder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+
+// a pass is only split across threads when each gets at least this many keys
+static const size_t MIN_KEYS_PER_THREAD = 65536;
+
+static const int STOP_ID = 0;
+static const int DEPARTURE_TIME = 1;
+static const int TRIP_ID = 2;
+static const int STOP_SEQUENCE = 3;
+
+StopTimeIndex::StopTimeIndex() {
+    set_fields(-1, -1, -1, -1);
+    clear();
+}
+
+void StopTimeIndex::clear() {
+    vector<StopTimeKey>().swap(keys);
+    rows = 0;
+    keyable = true;
+    sorted_by_stop = false;
+}
+
+void StopTimeIndex::set_fields(int stop_id, int departure_time, int trip_id, int stop_sequence) {
+    fields[STOP_ID] = stop_id;
+    fields[DEPARTURE_TIME] = departure_time;
+    fields[TRIP_ID] = trip_id;
+    fields[STOP_SEQUENCE] = stop_sequence;
+}
+
+StopTimeIndex::KeyState StopTimeIndex::read_key(const CsvField *row, size_t field_count, StopTimeKey *key) const {
+    int64_t values[4];
+
+    if (!keyable) {
+        return KEY_INVALID;
+    }
+
+    // a stop time without a departure is not a departure, so it is left out
+    size_t departure = (size_t) fields[DEPARTURE_TIME];
+    const char *data = departure < field_count ? row[departure].data : NULL;
+    size_t length = departure < field_count ? row[departure].length : 0;
+    trim_field(&data, &length);
+    if (length == 0) {
+        return KEY_NO_DEPARTURE;
+    }
+
+    for (int k = 0; k < 4; k++) {
+        size_t source = (size_t) fields[k];
+        bool parsed = source < field_count && (k == DEPARTURE_TIME ? parse_time_seconds(row[source].data, row[source].length, &values[k])
+                : parse_int64(row[source].data, row[source].length, &values[k]));
+        if (!parsed) {
+            return KEY_INVALID;
+        }
+    }
+
+    if (values[DEPARTURE_TIME] > INT32_MAX || values[STOP_SEQUENCE] < INT32_MIN || values[STOP_SEQUENCE] > INT32_MAX) {
+        return KEY_INVALID;
+    }
+
+    key->stop_id = values[STOP_ID];
+    key->trip_id = values[TRIP_ID];
+    key->departure_secs = (int32_t) values[DEPARTURE_TIME];
+    key->stop_sequence = (int32_t) values[STOP_SEQUENCE];
+    return KEY_READ;
+}
+
+void StopTimeIndex::add(const StopTimeKey &key, KeyState state) {
+    rows++;
+    sorted_by_stop = false;
+    if (state == KEY_INVALID) {
+        keyable = false;
+    } else if (state == KEY_READ && keyable) {
+        keys.push_back(key);
+    }
+}
+
+int StopTimeIndex::collect(sqlite3 *db, bool seconds_columns) {
+    sqlite3_stmt *stmt = NULL;
+    const char *select = seconds_columns ? "SELECT stop_id, departure_secs, trip_id, stop_sequence FROM stop_time"
+            : "SELECT stop_id, departure_time, trip_id, stop_sequence FROM stop_time";
+
+    clear();
+    if (sqlite3_prepare_v2(db, select, -1, &stmt, NULL) != SQLITE_OK) {
+        return 1;
+    }
+
+    int status = SQLITE_DONE;
+    while (keyable && (status = sqlite3_step(stmt)) == SQLITE_ROW) {
+        rows++;
+        int departureType = sqlite3_column_type(stmt, 1);
+        if (departureType == SQLITE_NULL || (departureType == SQLITE_TEXT && sqlite3_column_bytes(stmt, 1) == 0)) {
+            continue;
+        }
+
+        StopTimeKey key;
+        int64_t departure;
+        if (departureType == SQLITE_INTEGER) {
+            departure = sqlite3_column_int64(stmt, 1);
+        } else if (departureType != SQLITE_TEXT
+                || !parse_time_seconds((const char *) sqlite3_column_text(stmt, 1), sqlite3_column_bytes(stmt, 1), &departure)) {
+            keyable = false;
+            break;
+        }
+
+        if (sqlite3_column_type(stmt, 0) != SQLITE_INTEGER || sqlite3_column_type(stmt, 2) != SQLITE_INTEGER
+                || sqlite3_column_type(stmt, 3) != SQLITE_INTEGER || departure > INT32_MAX
+                || sqlite3_column_int64(stmt, 3) != sqlite3_column_int(stmt, 3)) {
+            keyable = false;
+            break;
+        }
+        key.stop_id = sqlite3_column_int64(stmt, 0);
+        key.trip_id = sqlite3_column_int64(stmt, 2);
+        key.departure_secs = (int32_t) departure;
+        key.stop_sequence = sqlite3_column_int(stmt, 3);
+        keys.push_back(key);
+    }
+    sqlite3_finalize(stmt);
+
+    return keyable && status != SQLITE_DONE ? 1 : 0;
+}
+
+/*!
+ * Runs work(t) for t in [0, workers), the last on the calling thread.
+ */
+template<typename Work>
+static void run_workers(unsigned int workers, const Work &work) {
+    vector<thread> threads;
+    for (unsigned int t = 0; t + 1 < workers; t++) {
+        threads.push_back(thread(work, t));
+    }
+    work(workers - 1);
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+}
+
+/*!
+ * Stably sorts keys on one field. Values are taken relative to the smallest, so
+ * negative keys sort first and only the bytes that differ cost a pass.
+ */
+template<typename Field>
+static void radix_sort(vector<StopTimeKey> &keys, vector<StopTimeKey> &scratch, Field StopTimeKey::*field, unsigned int threads) {
+    size_t n = keys.size();
+    if (n < 2) {
+        return;
+    }
+
+    int64_t low = keys[0].*field;
+    int64_t high = low;
+    for (size_t i = 1; i < n; i++) {
+        low = min(low, (int64_t) (keys[i].*field));
+        high = max(high, (int64_t) (keys[i].*field));
+    }
+    uint64_t range = (uint64_t) high - (uint64_t) low;
+
+    unsigned int workers = (unsigned int) min((size_t) max(threads, 1u), n / MIN_KEYS_PER_THREAD + 1);
+    vector<size_t> counts(workers * 256);
+    scratch.resize(n);
+
+    for (int shift = 0; shift < 64 && (range >> shift) != 0; shift += 8) {
+        // each worker counts the digits of its slice, then scatters it behind the slices before it
+        fill(counts.begin(), counts.end(), 0);
+        run_workers(workers, [&](unsigned int t) {
+            size_t *count = &counts[t * 256];
+            for (size_t i = n * t / workers; i < n * (t + 1) / workers; i++) {
+                count[(((uint64_t) (int64_t) (keys[i].*field) - (uint64_t) low) >> shift) & 0xff]++;
+            }
+        });
+
+        size_t offset = 0;
+        bool split = true;
+        for (size_t digit = 0; digit < 256; digit++) {
+            size_t total = 0;
+            for (unsigned int t = 0; t < workers; t++) {
+                size_t count = counts[t * 256 + digit];
+                counts[t * 256 + digit] = offset + total;
+                total += count;
+            }
+            split = split && total != n;
+            offset += total;
+        }
+        if (!split) {
+            // every key has the same digit here
+            continue;
+        }
+
+        run_workers(workers, [&](unsigned int t) {
+            size_t *next = &counts[t * 256];
+            for (size_t i = n * t / workers; i < n * (t + 1) / workers; i++) {
+                scratch[next[(((uint64_t) (int64_t) (keys[i].*field) - (uint64_t) low) >> shift) & 0xff]++] = keys[i];
+            }
+        });
+        keys.swap(scratch);
+    }
+}
+
+static bool in_trip_order(const vector<StopTimeKey> &keys) {
+    for (size_t i = 1; i < keys.size(); i++) {
+        if (keys[i].trip_id < keys[i - 1].trip_id || (keys[i].trip_id == keys[i - 1].trip_id && keys[i].stop_sequence < keys[i - 1].stop_sequence)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void sort_by_departure(vector<StopTimeKey> &keys, vector<StopTimeKey> &scratch, unsigned int threads) {
+    if (!in_trip_order(keys)) {
+        radix_sort(keys, scratch, &StopTimeKey::stop_sequence, threads);
+        radix_sort(keys, scratch, &StopTimeKey::trip_id, threads);
+    }
+    radix_sort(keys, scratch, &StopTimeKey::departure_secs, threads);
+}
+
+const vector<StopTimeKey> &StopTimeIndex::by_stop(unsigned int threads) {
+    if (!sorted_by_stop) {
+        sort(keys, BY_STOP, threads);
+        sorted_by_stop = true;
+    }
+    return keys;
+}
+
+void StopTimeIndex::sort(vector<StopTimeKey> &keys, Order order, unsigned int threads) {
+    vector<StopTimeKey> scratch;
+
+    sort_by_departure(keys, scratch, threads);
+    if (order == BY_STOP) {
+        radix_sort(keys, scratch, &StopTimeKey::stop_id, threads);
+    }
+}
+
+struct KeyTable {
+    sqlite3_vtab base;
+    const vector<StopTimeKey> *keys;
+};
+
+struct KeyCursor {
+    sqlite3_vtab_cursor base;
+    size_t row;
+};
+
+static int keys_connect(sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **vtab, char **err) {
+    (void) argc;
+    (void) argv;
+    (void) err;
+
+    int status = sqlite3_declare_vtab(db, "CREATE TABLE x(stop_id INTEGER, departure_secs INTEGER, trip_id INTEGER, stop_sequence INTEGER)");
+    if (status != SQLITE_OK) {
+        return status;
+    }
+
+    KeyTable *table = new KeyTable();
+    memset(&table->base, 0, sizeof(table->base));
+    table->keys = (const vector<StopTimeKey> *) aux;
+    *vtab = &table->base;
+    return SQLITE_OK;
+}
+
+static int keys_disconnect(sqlite3_vtab *vtab) {
+    delete (KeyTable *) vtab;
+    return SQLITE_OK;
+}
+
+static int keys_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+    // the keys can only be read in the order they are in
+    info->estimatedRows = (sqlite3_int64) ((KeyTable *) vtab)->keys->size();
+    info->estimatedCost = (double) info->estimatedRows;
+    return SQLITE_OK;
+}
+
+static int keys_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor) {
+    (void) vtab;
+    KeyCursor *keys = new KeyCursor();
+    memset(&keys->base, 0, sizeof(keys->base));
+    keys->row = 0;
+    *cursor = &keys->base;
+    return SQLITE_OK;
+}
+
+static int keys_close(sqlite3_vtab_cursor *cursor) {
+    delete (KeyCursor *) cursor;
+    return SQLITE_OK;
+}
+
+static int keys_filter(sqlite3_vtab_cursor *cursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv) {
+    (void) idxNum;
+    (void) idxStr;
+    (void) argc;
+    (void) argv;
+    ((KeyCursor *) cursor)->row = 0;
+    return SQLITE_OK;
+}
+
+static int keys_next(sqlite3_vtab_cursor *cursor) {
+    ((KeyCursor *) cursor)->row++;
+    return SQLITE_OK;
+}
+
+static int keys_eof(sqlite3_vtab_cursor *cursor) {
+    return ((KeyCursor *) cursor)->row >= ((KeyTable *) cursor->pVtab)->keys->size();
+}
+
+static int keys_column(sqlite3_vtab_cursor *cursor, sqlite3_context *context, int column) {
+    const StopTimeKey &key = (*((KeyTable *) cursor->pVtab)->keys)[((KeyCursor *) cursor)->row];
+
+    switch (column) {
+        case 0:
+            sqlite3_result_int64(context, key.stop_id);
+            break;
+        case 1:
+            sqlite3_result_int(context, key.departure_secs);
+            break;
+        case 2:
+            sqlite3_result_int64(context, key.trip_id);
+            break;
+        default:
+            sqlite3_result_int(context, key.stop_sequence);
+            break;
+    }
+    return SQLITE_OK;
+}
+
+static int keys_rowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid) {
+    *rowid = (sqlite3_int64) ((KeyCursor *) cursor)->row;
+    return SQLITE_OK;
+}
+
+static sqlite3_module keys_module = {
+        0,                  // iVersion
+        keys_connect,       // xCreate
+        keys_connect,       // xConnect
+        keys_best_index,
+        keys_disconnect,
+        keys_disconnect,    // xDestroy
+        keys_open,
+        keys_close,
+        keys_filter,
+        keys_next,
+        keys_eof,
+        keys_column,
+        keys_rowid,
+        NULL,               // xUpdate: read only
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        NULL};
+
+int StopTimeIndex::build(sqlite3 *db, unsigned int threads) {
+    vector<StopTimeKey> scratch;
+    const char *create = "DROP TABLE IF EXISTS stop_time_by_stop; DROP TABLE IF EXISTS stop_time_by_departure; "
+            "CREATE TABLE stop_time_by_stop (stop_id INTEGER, departure_secs INTEGER, trip_id INTEGER, stop_sequence INTEGER, "
+            "PRIMARY KEY (stop_id, departure_secs, trip_id, stop_sequence)) WITHOUT ROWID; "
+            "CREATE TABLE stop_time_by_departure (departure_secs INTEGER, trip_id INTEGER, stop_sequence INTEGER, stop_id INTEGER, "
+            "PRIMARY KEY (departure_secs, trip_id, stop_sequence)) WITHOUT ROWID; "
+            "CREATE VIRTUAL TABLE temp.stop_time_keys USING stop_time_keys";
+
+    // the keys are read in place, in whatever order they are in when each INSERT runs;
+    // a repeated stop time keeps its first row
+    const char *byDeparture = "INSERT OR IGNORE INTO stop_time_by_departure SELECT departure_secs, trip_id, stop_sequence, stop_id FROM temp.stop_time_keys";
+    const char *byStop = "INSERT OR IGNORE INTO stop_time_by_stop SELECT stop_id, departure_secs, trip_id, stop_sequence FROM temp.stop_time_keys";
+
+    sqlite3_create_module(db, "stop_time_keys", &keys_module, (void *) &keys);
+
+    sqlite3_exec(db, "SAVEPOINT presorted_keys", NULL, NULL, NULL);
+    int status = sqlite3_exec(db, create, NULL, NULL, NULL);
+    if (status == SQLITE_OK) {
+        // sorted by departure first, the keys need only a stable pass on stop_id for the other order
+        sort_by_departure(keys, scratch, threads);
+        status = sqlite3_exec(db, byDeparture, NULL, NULL, NULL);
+    }
+    if (status == SQLITE_OK) {
+        radix_sort(keys, scratch, &StopTimeKey::stop_id, threads);
+        sorted_by_stop = true;
+        status = sqlite3_exec(db, byStop, NULL, NULL, NULL);
+    }
+    if (status != SQLITE_OK) {
+        printf("failed: %s\n\n", sqlite3_errmsg(db));
+    }
+    sqlite3_exec(db, "DROP TABLE IF EXISTS temp.stop_time_keys", NULL, NULL, NULL);
+    sqlite3_exec(db, status == SQLITE_OK ? "RELEASE presorted_keys" : "ROLLBACK TO presorted_keys; RELEASE presorted_keys", NULL, NULL, NULL);
+
+    return status == SQLITE_OK ? 0 : 1;
+}
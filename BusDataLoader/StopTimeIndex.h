@@ -0,0 +1,141 @@
+/*!
+ * \file    StopTimeIndex
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __StopTimeIndex_H_
+#define __StopTimeIndex_H_
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+#include <sqlite3.h>
+
+#include "CsvReader.h"
+
+/*!
+ * The index keys of one stop_time row.
+ */
+struct StopTimeKey {
+    int64_t stop_id;
+    int64_t trip_id;
+    int32_t departure_secs;
+    int32_t stop_sequence;
+};
+
+/*!
+ * Presorted, covering replacements for the stop_id and departure indexes of stop_time.
+ *
+ * CREATE INDEX reads the whole of stop_time back and sorts it with sqlite's external
+ * sorter, once per index. Instead, the loader hands every parsed stop_time row to
+ * add() once it is inserted, which keeps just its keys. build() radix sorts them in memory and writes
+ * two WITHOUT ROWID tables in key order, so each b-tree only grows at its right edge:
+ *
+ *     stop_time_by_stop       (stop_id, departure_secs, trip_id, stop_sequence)
+ *     stop_time_by_departure  (departure_secs, trip_id, stop_sequence, stop_id)
+ *
+ * The first is keyed on all four columns, the second on the first three. Both cover
+ * a departure board without touching stop_time:
+ *
+ *     SELECT d.departure_secs, t.trip_headsign FROM stop_time_by_stop d JOIN trip t ON t.trip_id = d.trip_id
+ *     WHERE d.stop_id = 18652 AND d.departure_secs >= 28800 ORDER BY d.departure_secs LIMIT 10;
+ *
+ * and a row of stop_time is found again by (trip_id, stop_sequence). Departures are
+ * seconds since midnight whatever BusDataLoader::TimeColumns is. Stop times without
+ * a departure time are left out. Keys must be integers: a row with any other stop_id,
+ * trip_id or stop_sequence makes the set unusable and the loader builds the plain
+ * indexes instead.
+ */
+class StopTimeIndex {
+    public:
+
+    StopTimeIndex();
+
+    /*!
+     * Forgets every key, ready for the next load.
+     */
+    void clear();
+
+    /*!
+     * Positions of the key fields in the records add() will be given, or -1 for a
+     * field the file lacks (which makes the set unusable).
+     */
+    void set_fields(int stop_id, int departure_time, int trip_id, int stop_sequence);
+
+    /*!
+     * What read_key made of a record.
+     */
+    enum KeyState {
+        KEY_READ,
+        KEY_NO_DEPARTURE,       // not a departure, so it is left out
+        KEY_INVALID             // a key is missing or not an integer
+    };
+
+    /*!
+     * Reads the keys of one stop_time record, whose fields are at the positions given
+     * to set_fields. Nothing is kept until the record is handed to add().
+     */
+    KeyState read_key(const CsvField *fields, size_t field_count, StopTimeKey *key) const;
+
+    /*!
+     * Keeps a key read by read_key, once its row is in stop_time. An invalid key makes
+     * the set unusable.
+     */
+    void add(const StopTimeKey &key, KeyState state);
+
+    /*!
+     * Reads the keys back from the loaded stop_time table, for loads that wrote it
+     * without passing its rows through add(). Returns 0 on success.
+     */
+    int collect(sqlite3 *db, bool seconds_columns);
+
+    /*!
+     * True once add() or collect() saw rows and every one of them could be keyed.
+     */
+    bool usable() const { return rows > 0 && keyable; }
+
+    size_t size() const { return keys.size(); }
+
+    /*!
+     * The keys seen, in BY_STOP order. build() leaves them that way; otherwise they are
+     * sorted now, on up to threads threads.
+     */
+    const std::vector<StopTimeKey> &by_stop(unsigned int threads);
+
+    /*!
+     * Replaces stop_time_by_stop and stop_time_by_departure with the keys seen,
+     * sorting them on up to threads threads. Returns 0 on success.
+     */
+    int build(sqlite3 *db, unsigned int threads);
+
+    /*!
+     * The orders build() writes the tables in.
+     */
+    enum Order {
+        BY_STOP,            // stop_id, departure_secs, trip_id, stop_sequence
+        BY_DEPARTURE        // departure_secs, trip_id, stop_sequence
+    };
+
+    /*!
+     * Sorts keys into order with a stable least significant digit radix sort, one byte
+     * per pass. Bytes every key shares are skipped, and so are the trip_id and
+     * stop_sequence passes when the keys already come in that order, as they do from
+     * a feed written trip by trip. Each pass counts and scatters on up to threads
+     * threads.
+     */
+    static void sort(std::vector<StopTimeKey> &keys, Order order, unsigned int threads);
+
+    private:
+
+    std::vector<StopTimeKey> keys;
+    int fields[4];
+    size_t rows;
+    bool keyable;
+    bool sorted_by_stop;
+};
+
+#endif //__StopTimeIndex_H_
@@ -0,0 +1,79 @@
+/*!
+ * \file    StringPool
+ * \project 
+ *
+ */
+
+#include "StringPool.h"
+
+#include <cstring>
+
+using namespace std;
+
+
+// the table is grown whenever it would become more than half full
+static const size_t INITIAL_SLOTS = 1024;
+
+StringPool::StringPool() {
+    clear();
+}
+
+void StringPool::clear() {
+    arena.clear();
+    offsets.assign(1, 0);
+    hashes.clear();
+    slots.assign(INITIAL_SLOTS, 0);
+}
+
+uint32_t StringPool::hash(const char *data, size_t length) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (unsigned char) data[i]) * 16777619u;
+    }
+    return h;
+}
+
+void StringPool::grow() {
+    slots.assign(slots.size() * 2, 0);
+    size_t mask = slots.size() - 1;
+
+    for (uint32_t code = 1; code <= hashes.size(); code++) {
+        size_t slot = hashes[code - 1] & mask;
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = code;
+    }
+}
+
+uint32_t StringPool::intern(const char *data, size_t length) {
+    uint32_t h = hash(data, length);
+    size_t mask = slots.size() - 1;
+    size_t slot = h & mask;
+
+    for (; slots[slot] != 0; slot = (slot + 1) & mask) {
+        uint32_t code = slots[slot];
+        size_t begin = offsets[code - 1];
+        if (hashes[code - 1] == h && offsets[code] - begin == length && memcmp(arena.data() + begin, data, length) == 0) {
+            return code;
+        }
+    }
+
+    arena.insert(arena.end(), data, data + length);
+    offsets.push_back(arena.size());
+    hashes.push_back(h);
+
+    uint32_t code = (uint32_t) hashes.size();
+    slots[slot] = code;
+    if (hashes.size() * 2 > slots.size()) {
+        grow();
+    }
+    return code;
+}
+
+const char *StringPool::value(uint32_t code, size_t *length) const {
+    size_t begin = offsets[code - 1];
+    *length = offsets[code] - begin;
+    return arena.data() + begin;
+}
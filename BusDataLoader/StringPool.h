@@ -0,0 +1,55 @@
+/*!
+ * \file    StringPool
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __StringPool_H_
+#define __StringPool_H_
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+/*!
+ * Interns strings: every distinct value is stored once, in one contiguous arena, and
+ * is known by a dense code (1, 2, 3, ... in the order values were first seen). Lookup
+ * is an open-addressing hash table of codes, so interning a value already in the pool
+ * neither allocates nor copies.
+ */
+class StringPool {
+    public:
+
+    StringPool();
+
+    /*!
+     * Code of data, adding it to the pool the first time it is seen.
+     */
+    uint32_t intern(const char *data, size_t length);
+
+    /*!
+     * The value of code, which must be between 1 and size(). The pointer stays valid
+     * until the next intern() or clear().
+     */
+    const char *value(uint32_t code, size_t *length) const;
+
+    size_t size() const { return offsets.size() - 1; }
+
+    void clear();
+
+    private:
+
+    static uint32_t hash(const char *data, size_t length);
+
+    void grow();
+
+    std::vector<char> arena;
+    std::vector<size_t> offsets;
+    std::vector<uint32_t> hashes;
+    std::vector<uint32_t> slots;
+};
+
+#endif //__StringPool_H_
@@ -0,0 +1,44 @@
+/*!
+ * \file    TableSchema
+ * \project 
+ *
+ */
+
+#include "TableSchema.h"
+
+using namespace std;
+
+
+string create_table_sql(const TableDescriptor &table, const char *primary_key) {
+    string sql = string("CREATE TABLE ").append(table.name).append(primary_key == NULL ? " (id INTEGER PRIMARY KEY" : " (id INTEGER");
+
+    for (size_t i = 0; i < table.column_count; i++) {
+        sql.append(", ").append(table.columns[i].name).append(" ").append(column_declaration(table.columns[i].type));
+    }
+
+    if (primary_key != NULL) {
+        return sql.append(", PRIMARY KEY (").append(primary_key).append(")) WITHOUT ROWID");
+    }
+    return sql.append(")");
+}
+
+string column_list(const TableDescriptor &table) {
+    string columns;
+
+    for (size_t i = 0; i < table.column_count; i++) {
+        columns.append(i > 0 ? ", " : "").append(table.columns[i].name);
+    }
+    return columns;
+}
+
+int64_t row_count(sqlite3 *db, const char *table) {
+    sqlite3_stmt *stmt = NULL;
+    string sql = string("SELECT count(*) FROM ").append(table);
+    int64_t count = 0;
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        count = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return count;
+}
@@ -0,0 +1,249 @@
+/*!
+ * \file    TableSchema
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __TableSchema_H_
+#define __TableSchema_H_
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <sqlite3.h>
+
+#include "CsvReader.h"
+#include "FieldDecoder.h"
+#include "StringPool.h"
+
+/*!
+ * One column of a table loaded from a GTFS file: the field of the file it is read
+ * from, how that field is decoded and bound, and whether an empty field is stored as
+ * NULL (otherwise it is stored as the empty string).
+ */
+struct ColumnDescriptor {
+    const char *name;
+    const char *source;
+    ColumnType type;
+    bool nullable;
+};
+
+// how a buffered field of a row is stored (see BusDataLoader::InsertPlan)
+static const char FIELD_STABLE = 0;
+static const char FIELD_SPILLED = 1;
+static const char FIELD_MISSING = 2;
+
+/*!
+ * Binds one row of fields to parameters index, index + 1, ... of stmt, one per column.
+ * state says where each field is (FIELD_SPILLED fields hold an offset into spill), and
+ * dictionaries holds the pool of every COLUMN_DICTIONARY column.
+ */
+typedef void (*RowBinder)(sqlite3_stmt *stmt, int index, const CsvField *row, const char *state, const char *spill, StringPool *const *dictionaries);
+
+/*!
+ * A table in the form it is created and loaded. Every table also has an
+ * "id INTEGER PRIMARY KEY" column ahead of these, which the load leaves to sqlite.
+ */
+struct TableDescriptor {
+    const char *name;
+    const ColumnDescriptor *columns;
+    size_t column_count;
+    RowBinder bind_row;
+};
+
+/*!
+ * Declared type of a column: sqlite derives the same affinity from it that Type decodes to.
+ */
+inline const char *column_declaration(ColumnType type) {
+    return type == COLUMN_TEXT ? "VARCHAR" : type == COLUMN_REAL ? "REAL" : "INTEGER";
+}
+
+/*!
+ * Numbers are bound natively so sqlite neither copies the text nor converts it. Fields
+ * that do not parse are bound as text, and the field slices outlive the step, so
+ * sqlite does not need its own copy.
+ */
+template <ColumnType Type, bool Nullable>
+inline void bind_value(sqlite3_stmt *stmt, int index, const CsvField &field, StringPool *dictionary) {
+    int64_t integer;
+    double real;
+
+    if (Nullable && field.length == 0) {
+        sqlite3_bind_null(stmt, index);
+    } else if (Type == COLUMN_DICTIONARY) {
+        sqlite3_bind_int64(stmt, index, dictionary->intern(field.data, field.length));
+    } else if (Type == COLUMN_INTEGER && parse_int64(field.data, field.length, &integer)) {
+        sqlite3_bind_int64(stmt, index, integer);
+    } else if (Type == COLUMN_SECONDS && parse_time_seconds(field.data, field.length, &integer)) {
+        sqlite3_bind_int64(stmt, index, integer);
+    } else if (Type == COLUMN_REAL && parse_decimal(field.data, field.length, &real)) {
+        sqlite3_bind_double(stmt, index, real);
+    } else {
+        sqlite3_bind_text(stmt, index, field.data, (int) field.length, SQLITE_STATIC);
+    }
+}
+
+/*!
+ * Binds columns I to N - 1 of Columns. Each column's decoder is chosen from its
+ * descriptor at compile time, so a row is a straight run of parses and binds.
+ */
+template <const ColumnDescriptor *Columns, size_t I, size_t N>
+struct ColumnBinder {
+    static inline void bind(sqlite3_stmt *stmt, int index, const CsvField *row, const char *state, const char *spill, StringPool *const *dictionaries) {
+        if (state[I] == FIELD_MISSING) {
+            // short rows and fields the file does not have leave the column NULL
+            sqlite3_bind_null(stmt, index + (int) I);
+        } else if (state[I] == FIELD_SPILLED) {
+            CsvField field = {spill + (uintptr_t) row[I].data, row[I].length};
+            bind_value<Columns[I].type, Columns[I].nullable>(stmt, index + (int) I, field, dictionaries[I]);
+        } else {
+            bind_value<Columns[I].type, Columns[I].nullable>(stmt, index + (int) I, row[I], dictionaries[I]);
+        }
+        ColumnBinder<Columns, I + 1, N>::bind(stmt, index, row, state, spill, dictionaries);
+    }
+};
+
+template <const ColumnDescriptor *Columns, size_t N>
+struct ColumnBinder<Columns, N, N> {
+    static inline void bind(sqlite3_stmt *, int, const CsvField *, const char *, const char *, StringPool *const *) {
+    }
+};
+
+template <const ColumnDescriptor *Columns, size_t N>
+void bind_row(sqlite3_stmt *stmt, int index, const CsvField *row, const char *state, const char *spill, StringPool *const *dictionaries) {
+    ColumnBinder<Columns, 0, N>::bind(stmt, index, row, state, spill, dictionaries);
+}
+
+#define TABLE_DESCRIPTOR(name, columns) {name, columns, sizeof(columns) / sizeof(columns[0]), &bind_row<columns, sizeof(columns) / sizeof(columns[0])>}
+
+
+constexpr ColumnDescriptor AGENCY_COLUMNS[] = {
+        {"agency_id",       "agency_id",       COLUMN_INTEGER, true},
+        {"agency_name",     "agency_name",     COLUMN_TEXT,    false},
+        {"agency_url",      "agency_url",      COLUMN_TEXT,    false},
+        {"agency_timezone", "agency_timezone", COLUMN_TEXT,    false},
+        {"agency_lang",     "agency_lang",     COLUMN_TEXT,    false},
+        {"agency_phone",    "agency_phone",    COLUMN_TEXT,    false}};
+
+// date is yyyymmdd
+constexpr ColumnDescriptor CALENDAR_DATE_COLUMNS[] = {
+        {"service_id",     "service_id",     COLUMN_INTEGER, true},
+        {"date",           "date",           COLUMN_INTEGER, true},
+        {"exception_type", "exception_type", COLUMN_INTEGER, true}};
+
+constexpr ColumnDescriptor ROUTE_COLUMNS[] = {
+        {"route_id",         "route_id",         COLUMN_INTEGER, true},
+        {"agency_id",        "agency_id",        COLUMN_INTEGER, true},
+        {"route_short_name", "route_short_name", COLUMN_TEXT,    false},
+        {"route_long_name",  "route_long_name",  COLUMN_TEXT,    false},
+        {"route_type",       "route_type",       COLUMN_INTEGER, true},
+        {"route_url",        "route_url",        COLUMN_TEXT,    false},
+        {"route_color",      "route_color",      COLUMN_TEXT,    false}};
+
+constexpr ColumnDescriptor ROUTE_CODED_COLUMNS[] = {
+        {"route_id",              "route_id",         COLUMN_INTEGER,    true},
+        {"agency_id",             "agency_id",        COLUMN_INTEGER,    true},
+        {"route_short_name_code", "route_short_name", COLUMN_DICTIONARY, true},
+        {"route_long_name",       "route_long_name",  COLUMN_TEXT,       false},
+        {"route_type",            "route_type",       COLUMN_INTEGER,    true},
+        {"route_url",             "route_url",        COLUMN_TEXT,       false},
+        {"route_color",           "route_color",      COLUMN_TEXT,       false}};
+
+// times are HH:MM:SS, past 24:00:00 for trips running after midnight
+constexpr ColumnDescriptor STOP_TIME_COLUMNS[] = {
+        {"trip_id",             "trip_id",             COLUMN_INTEGER, true},
+        {"arrival_time",        "arrival_time",        COLUMN_TEXT,    false},
+        {"departure_time",      "departure_time",      COLUMN_TEXT,    false},
+        {"stop_id",             "stop_id",             COLUMN_INTEGER, true},
+        {"stop_sequence",       "stop_sequence",       COLUMN_INTEGER, true},
+        {"pickup_type",         "pickup_type",         COLUMN_INTEGER, true},
+        {"drop_off_type",       "drop_off_type",       COLUMN_INTEGER, true},
+        {"shape_dist_traveled", "shape_dist_traveled", COLUMN_REAL,    true}};
+
+// times are seconds since midnight, in columns after the others as the seconds schema has always had them
+constexpr ColumnDescriptor STOP_TIME_SECONDS_COLUMNS[] = {
+        {"trip_id",             "trip_id",             COLUMN_INTEGER, true},
+        {"stop_id",             "stop_id",             COLUMN_INTEGER, true},
+        {"stop_sequence",       "stop_sequence",       COLUMN_INTEGER, true},
+        {"pickup_type",         "pickup_type",         COLUMN_INTEGER, true},
+        {"drop_off_type",       "drop_off_type",       COLUMN_INTEGER, true},
+        {"shape_dist_traveled", "shape_dist_traveled", COLUMN_REAL,    true},
+        {"arrival_secs",        "arrival_time",        COLUMN_SECONDS, true},
+        {"departure_secs",      "departure_time",      COLUMN_SECONDS, true}};
+
+constexpr ColumnDescriptor STOP_COLUMNS[] = {
+        {"stop_id",   "stop_id",   COLUMN_INTEGER, true},
+        {"stop_code", "stop_code", COLUMN_INTEGER, true},
+        {"stop_name", "stop_name", COLUMN_TEXT,    false},
+        {"stop_desc", "stop_desc", COLUMN_TEXT,    false},
+        {"stop_lat",  "stop_lat",  COLUMN_REAL,    true},
+        {"stop_lon",  "stop_lon",  COLUMN_REAL,    true},
+        {"zone_id",   "zone_id",   COLUMN_INTEGER, true}};
+
+constexpr ColumnDescriptor STOP_CODED_COLUMNS[] = {
+        {"stop_id",        "stop_id",   COLUMN_INTEGER,    true},
+        {"stop_code",      "stop_code", COLUMN_INTEGER,    true},
+        {"stop_name_code", "stop_name", COLUMN_DICTIONARY, true},
+        {"stop_desc",      "stop_desc", COLUMN_TEXT,       false},
+        {"stop_lat",       "stop_lat",  COLUMN_REAL,       true},
+        {"stop_lon",       "stop_lon",  COLUMN_REAL,       true},
+        {"zone_id",        "zone_id",   COLUMN_INTEGER,    true}};
+
+constexpr ColumnDescriptor TRIP_COLUMNS[] = {
+        {"route_id",      "route_id",      COLUMN_INTEGER, true},
+        {"service_id",    "service_id",    COLUMN_INTEGER, true},
+        {"trip_id",       "trip_id",       COLUMN_INTEGER, true},
+        {"trip_headsign", "trip_headsign", COLUMN_TEXT,    false},
+        {"direction_id",  "direction_id",  COLUMN_INTEGER, true},
+        {"block_id",      "block_id",      COLUMN_TEXT,    false},
+        {"shape_id",      "shape_id",      COLUMN_INTEGER, true}};
+
+constexpr ColumnDescriptor TRIP_CODED_COLUMNS[] = {
+        {"route_id",           "route_id",      COLUMN_INTEGER,    true},
+        {"service_id",         "service_id",    COLUMN_INTEGER,    true},
+        {"trip_id",            "trip_id",       COLUMN_INTEGER,    true},
+        {"trip_headsign_code", "trip_headsign", COLUMN_DICTIONARY, true},
+        {"direction_id",       "direction_id",  COLUMN_INTEGER,    true},
+        {"block_id_code",      "block_id",      COLUMN_DICTIONARY, true},
+        {"shape_id",           "shape_id",      COLUMN_INTEGER,    true}};
+
+constexpr ColumnDescriptor SHAPE_COLUMNS[] = {
+        {"shape_id",            "shape_id",            COLUMN_INTEGER, true},
+        {"shape_pt_lat",        "shape_pt_lat",        COLUMN_REAL,    true},
+        {"shape_pt_lon",        "shape_pt_lon",        COLUMN_REAL,    true},
+        {"shape_pt_sequence",   "shape_pt_sequence",   COLUMN_INTEGER, true},
+        {"shape_dist_traveled", "shape_dist_traveled", COLUMN_REAL,    true}};
+
+constexpr TableDescriptor AGENCY_TABLE = TABLE_DESCRIPTOR("agency", AGENCY_COLUMNS);
+constexpr TableDescriptor CALENDAR_DATE_TABLE = TABLE_DESCRIPTOR("calendar_date", CALENDAR_DATE_COLUMNS);
+constexpr TableDescriptor ROUTE_TABLE = TABLE_DESCRIPTOR("route", ROUTE_COLUMNS);
+constexpr TableDescriptor ROUTE_CODED_TABLE = TABLE_DESCRIPTOR("route", ROUTE_CODED_COLUMNS);
+constexpr TableDescriptor STOP_TIME_TABLE = TABLE_DESCRIPTOR("stop_time", STOP_TIME_COLUMNS);
+constexpr TableDescriptor STOP_TIME_SECONDS_TABLE = TABLE_DESCRIPTOR("stop_time", STOP_TIME_SECONDS_COLUMNS);
+constexpr TableDescriptor STOP_TABLE = TABLE_DESCRIPTOR("stop", STOP_COLUMNS);
+constexpr TableDescriptor STOP_CODED_TABLE = TABLE_DESCRIPTOR("stop", STOP_CODED_COLUMNS);
+constexpr TableDescriptor TRIP_TABLE = TABLE_DESCRIPTOR("trip", TRIP_COLUMNS);
+constexpr TableDescriptor TRIP_CODED_TABLE = TABLE_DESCRIPTOR("trip", TRIP_CODED_COLUMNS);
+constexpr TableDescriptor SHAPE_TABLE = TABLE_DESCRIPTOR("shape", SHAPE_COLUMNS);
+
+/*!
+ * "CREATE TABLE name (id INTEGER PRIMARY KEY, column TYPE, ...)". With a primary_key
+ * such as "trip_id, stop_sequence" the table is WITHOUT ROWID, clustered on that key,
+ * and id is left an ordinary column.
+ */
+std::string create_table_sql(const TableDescriptor &table, const char *primary_key);
+
+/*!
+ * The table's columns, comma separated, in the order bind_row binds them.
+ */
+std::string column_list(const TableDescriptor &table);
+
+/*!
+ * Rows in table, or 0 when it cannot be counted.
+ */
+int64_t row_count(sqlite3 *db, const char *table);
+
+#endif //__TableSchema_H_
@@ -0,0 +1,123 @@
+/*!
+ * \file    TextSearch
+ * \project 
+ *
+ */
+
+#include "TextSearch.h"
+#include "TableSchema.h"
+
+#include <cctype>
+#include <cstdio>
+#include <stdint.h>
+
+using namespace std;
+
+
+// prefix lengths FTS5 keeps separate indexes for
+static const char *PREFIX_LENGTHS = "2 3";
+
+static bool has_column(sqlite3 *db, const char *table, const char *column) {
+    // not a trial SELECT: sqlite reads an unknown "column" as a string literal
+    sqlite3_stmt *stmt = NULL;
+    bool exists = false;
+
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM pragma_table_info(?) WHERE name = ?", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, column, -1, SQLITE_STATIC);
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    sqlite3_finalize(stmt);
+    return exists;
+}
+
+/*!
+ * Drops name whether it is a table or a view.
+ */
+static int drop_object(sqlite3 *db, const char *name) {
+    sqlite3_stmt *stmt = NULL;
+    string type;
+    int status = 0;
+
+    if (sqlite3_prepare_v2(db, "SELECT type FROM sqlite_master WHERE name = ?", -1, &stmt, NULL) != SQLITE_OK) {
+        return 1;
+    }
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        type = (const char *) sqlite3_column_text(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+
+    if (type == "table" || type == "view") {
+        char *sql = sqlite3_mprintf("DROP %s \"%w\"", type.c_str(), name);
+        status = sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK ? 0 : 1;
+        sqlite3_free(sql);
+    }
+    return status;
+}
+
+int TextSearch::build(sqlite3 *db) {
+    bool stopCodes = has_column(db, "stop", "stop_name_code");
+    bool headsignCodes = has_column(db, "trip", "trip_headsign_code");
+    const char *dropped[] = {"stop_search", "headsign_search", "stop_text", "headsign"};
+    string sql;
+
+    // external content: the indexes read their text from these, and store none of it
+    if (stopCodes) {
+        sql.append("CREATE VIEW stop_text AS SELECT stop.id AS id, d.value AS stop_name, stop.stop_desc AS stop_desc "
+                "FROM stop LEFT JOIN dict_stop_name d ON d.code = stop.stop_name_code; ");
+    }
+    if (headsignCodes) {
+        sql.append("CREATE VIEW headsign AS SELECT code AS id, value AS trip_headsign FROM dict_trip_headsign; ");
+    } else {
+        sql.append("CREATE TABLE headsign (id INTEGER PRIMARY KEY, trip_headsign VARCHAR); "
+                "INSERT INTO headsign (trip_headsign) SELECT DISTINCT trip_headsign FROM trip WHERE trip_headsign <> ''; ");
+    }
+    sql.append("CREATE VIRTUAL TABLE stop_search USING fts5(stop_name, stop_desc, content='").append(stopCodes ? "stop_text" : "stop")
+            .append("', content_rowid='id', prefix='").append(PREFIX_LENGTHS).append("'); ");
+    sql.append("CREATE VIRTUAL TABLE headsign_search USING fts5(trip_headsign, content='headsign', content_rowid='id', prefix='")
+            .append(PREFIX_LENGTHS).append("'); ");
+
+    // one pass over each content table builds the whole index, instead of a row at a time
+    sql.append("INSERT INTO stop_search (stop_search) VALUES ('rebuild'); "
+            "INSERT INTO headsign_search (headsign_search) VALUES ('rebuild')");
+
+    printf("Building search index................................");
+
+    sqlite3_exec(db, "SAVEPOINT search_index", NULL, NULL, NULL);
+    int status = 0;
+    for (size_t i = 0; status == 0 && i < sizeof(dropped) / sizeof(dropped[0]); i++) {
+        status = drop_object(db, dropped[i]);
+    }
+    if (status != 0 || sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL) != SQLITE_OK) {
+        printf("failed: %s\n\n", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK TO search_index; RELEASE search_index", NULL, NULL, NULL);
+        return 1;
+    }
+    sqlite3_exec(db, "RELEASE search_index", NULL, NULL, NULL);
+
+    printf("%lld stops, %lld headsigns\n\n", (long long) row_count(db, "stop"), (long long) row_count(db, "headsign"));
+    return 0;
+}
+
+string TextSearch::prefix_query(const string &text) {
+    string query;
+
+    for (size_t i = 0; i < text.length();) {
+        // ASCII letters and digits, and any non-ASCII byte, are word characters, as
+        // they are to the unicode61 tokenizer for the text feeds carry
+        size_t start = i;
+        while (i < text.length() && ((unsigned char) text[i] >= 0x80 || isalnum((unsigned char) text[i]))) {
+            i++;
+        }
+        if (i > start) {
+            if (!query.empty()) {
+                query.push_back(' ');
+            }
+            query.append("\"").append(text, start, i - start).append("\"*");
+        } else {
+            i++;
+        }
+    }
+    return query;
+}
@@ -0,0 +1,58 @@
+/*!
+ * \file    TextSearch
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __TextSearch_H_
+#define __TextSearch_H_
+
+#include <string>
+#include <sqlite3.h>
+
+/*!
+ * FTS5 indexes for search-as-you-type over stop names and headsigns.
+ *
+ * build() creates two external content FTS5 tables. They hold only the index, so no
+ * text is stored twice:
+ *
+ *     stop_search      (stop_name, stop_desc), rowid = stop.id
+ *     headsign_search  (trip_headsign), rowid = headsign.id
+ *
+ * headsign lists every distinct non-empty trip_headsign once, as (id, trip_headsign).
+ * When the loader dictionary encodes stop_name and trip_headsign, the indexes read
+ * the values through views over the dict_ tables instead, and headsign is a view
+ * of dict_trip_headsign.
+ *
+ * Both indexes keep prefix indexes for 2 and 3 characters, so the short prefixes
+ * typed first are answered without scanning the term list:
+ *
+ *     SELECT stop.* FROM stop_search JOIN stop ON stop.id = stop_search.rowid
+ *     WHERE stop_search MATCH 'stop_name: "main"* "st"*' ORDER BY rank;
+ *
+ * The indexes are filled once from the loaded tables. Editing stop or trip later
+ * does not update them; call build() again.
+ */
+class TextSearch {
+    public:
+
+    /*!
+     * Replaces the search tables with indexes of what is loaded now. Each index is
+     * populated by a single 'rebuild' from its content table, in one transaction.
+     * Returns 0 on success.
+     */
+    static int build(sqlite3 *db);
+
+    /*!
+     * A MATCH expression for text as the rider typed it: every word becomes a quoted
+     * prefix token ("main st" gives "main"* "st"*), so quotes, operators and
+     * punctuation in the input are never parsed as query syntax. Returns an empty
+     * string when text has no word characters.
+     */
+    static std::string prefix_query(const std::string &text);
+};
+
+#endif //__TextSearch_H_
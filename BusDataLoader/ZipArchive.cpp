@@ -0,0 +1,242 @@
+/*!
+ * \file    ZipArchive
+ * \project 
+ *
+ */
+
+#include "ZipArchive.h"
+
+#include <cstring>
+#include <zlib.h>
+
+using namespace std;
+
+static const uint32_t SIG_END_OF_DIRECTORY = 0x06054b50;
+static const uint32_t SIG_DIRECTORY_ENTRY = 0x02014b50;
+static const uint32_t SIG_LOCAL_HEADER = 0x04034b50;
+
+static const uint16_t METHOD_STORED = 0;
+static const uint16_t METHOD_DEFLATED = 8;
+
+// zip headers are little endian and unaligned
+static uint16_t read16(const char *p) {
+    const unsigned char *u = (const unsigned char *) p;
+    return (uint16_t) (u[0] | (u[1] << 8));
+}
+
+static uint32_t read32(const char *p) {
+    const unsigned char *u = (const unsigned char *) p;
+    return (uint32_t) u[0] | ((uint32_t) u[1] << 8) | ((uint32_t) u[2] << 16) | ((uint32_t) u[3] << 24);
+}
+
+static string base_name(const string &path) {
+    size_t slash = path.find_last_of('/');
+    return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+
+ZipArchive::ZipArchive() {
+}
+
+ZipArchive::~ZipArchive() {
+    close();
+}
+
+bool ZipArchive::is_zip_path(char const *path) {
+    size_t length = strlen(path);
+    return length > 4 && strcasecmp(path + length - 4, ".zip") == 0;
+}
+
+bool ZipArchive::open(char const *path) {
+    close();
+
+    if (!file.open(path) || !read_directory()) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void ZipArchive::close() {
+    // inflating threads write into the members, so they have to finish first
+    for (map<string, Member>::iterator it = members.begin(); it != members.end(); ++it) {
+        if (it->second.done.valid()) {
+            it->second.done.wait();
+        }
+    }
+    members.clear();
+    entries.clear();
+    file.close();
+}
+
+bool ZipArchive::read_directory() {
+    const char *data = file.data();
+    size_t size = file.size();
+
+    if (size < 22) {
+        return false;
+    }
+
+    // the end of central directory record sits in the last 64KB + 22 bytes, after an optional comment
+    size_t lowest = size > 65557 ? size - 65557 : 0;
+    size_t eocd = size - 22;
+    while (read32(data + eocd) != SIG_END_OF_DIRECTORY) {
+        if (eocd == lowest) {
+            return false;
+        }
+        eocd--;
+    }
+
+    uint16_t count = read16(data + eocd + 10);
+    uint32_t directory_size = read32(data + eocd + 12);
+    uint32_t offset = read32(data + eocd + 16);
+
+    if ((size_t) offset + directory_size > size) {
+        // zip64 archives store 0xffffffff here; a GTFS feed never needs them
+        return false;
+    }
+
+    const char *p = data + offset;
+    const char *end = p + directory_size;
+    for (uint16_t i = 0; i < count; i++) {
+        if (p + 46 > end || read32(p) != SIG_DIRECTORY_ENTRY) {
+            return false;
+        }
+
+        Entry entry;
+        uint16_t name_length = read16(p + 28);
+        uint16_t extra_length = read16(p + 30);
+        uint16_t comment_length = read16(p + 32);
+
+        entry.method = read16(p + 10);
+        entry.crc32 = read32(p + 16);
+        entry.compressed_size = read32(p + 20);
+        entry.size = read32(p + 24);
+        entry.local_offset = read32(p + 42);
+        entry.name.assign(p + 46, name_length);
+        entries.push_back(entry);
+
+        p += 46 + name_length + extra_length + comment_length;
+    }
+
+    return true;
+}
+
+const ZipArchive::Entry *ZipArchive::find_entry(char const *name) const {
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (base_name(entries[i].name) == name) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+bool ZipArchive::member_size(char const *name, size_t *size) const {
+    const Entry *entry = find_entry(name);
+    if (entry == NULL) {
+        return false;
+    }
+    *size = entry->size;
+    return true;
+}
+
+bool ZipArchive::member_crc32(char const *name, uint32_t *crc) const {
+    const Entry *entry = find_entry(name);
+    if (entry == NULL) {
+        return false;
+    }
+    *crc = entry->crc32;
+    return true;
+}
+
+bool ZipArchive::extract(const Entry *entry, Member *member) {
+    const char *data = file.data();
+    size_t size = file.size();
+
+    if ((size_t) entry->local_offset + 30 > size || read32(data + entry->local_offset) != SIG_LOCAL_HEADER) {
+        return false;
+    }
+
+    // the local header has its own name and extra lengths, which may differ from the directory's
+    size_t start = (size_t) entry->local_offset + 30 + read16(data + entry->local_offset + 26) + read16(data + entry->local_offset + 28);
+    if (start + entry->compressed_size > size) {
+        return false;
+    }
+
+    if (entry->method == METHOD_STORED) {
+        member->data = data + start;
+        member->size = entry->compressed_size;
+        return true;
+    }
+
+    if (entry->method != METHOD_DEFLATED) {
+        return false;
+    }
+
+    member->inflated.resize(entry->size);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return false;
+    }
+
+    stream.next_in = (Bytef *) (data + start);
+    stream.avail_in = entry->compressed_size;
+    stream.next_out = (Bytef *) (member->inflated.empty() ? NULL : &member->inflated[0]);
+    stream.avail_out = entry->size;
+
+    int status = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+
+    if (status != Z_STREAM_END || stream.total_out != entry->size) {
+        return false;
+    }
+
+    member->data = member->inflated.empty() ? NULL : &member->inflated[0];
+    member->size = entry->size;
+    return true;
+}
+
+void ZipArchive::extract_async(const vector<string> &names) {
+    for (size_t i = 0; i < names.size(); i++) {
+        const Entry *entry = find_entry(names[i].c_str());
+        if (entry == NULL || members.count(names[i]) != 0) {
+            continue;
+        }
+
+        Member &member = members[names[i]];
+        member.data = NULL;
+        member.size = 0;
+        member.done = async(launch::async, &ZipArchive::extract, this, entry, &member).share();
+    }
+}
+
+bool ZipArchive::member_data(char const *name, const char **data, size_t *size) {
+    map<string, Member>::iterator it = members.find(name);
+
+    if (it == members.end()) {
+        // not requested up front: inflate it on this thread
+        const Entry *entry = find_entry(name);
+        if (entry == NULL) {
+            return false;
+        }
+
+        Member &member = members[name];
+        member.data = NULL;
+        member.size = 0;
+        promise<bool> result;
+        result.set_value(extract(entry, &member));
+        member.done = result.get_future().share();
+        it = members.find(name);
+    }
+
+    if (!it->second.done.get()) {
+        return false;
+    }
+
+    *data = it->second.data;
+    *size = it->second.size;
+    return true;
+}
@@ -0,0 +1,96 @@
+/*!
+ * \file    ZipArchive
+ * \project 
+ *
+ */
+
+
+
+
+#ifndef __ZipArchive_H_
+#define __ZipArchive_H_
+
+#include <cstddef>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <future>
+
+#include "MappedFile.h"
+
+/*!
+ * Read access to the members of a zip file (a published GTFS feed) without
+ * unpacking it to disk. The archive is mapped, the central directory is read,
+ * and members are inflated with zlib straight into memory, each on its own
+ * thread, while the caller is already loading the ones that are done.
+ * Stored (uncompressed) members are handed out from the mapping without a copy.
+ */
+class ZipArchive {
+    public:
+
+    ZipArchive();
+
+    ~ZipArchive();
+
+    bool open(char const *path);
+
+    void close();
+
+    /*!
+     * Starts inflating every member whose file name (ignoring any folder) is in names.
+     */
+    void extract_async(const std::vector<std::string> &names);
+
+    /*!
+     * Waits for the member to be inflated. Returns false if the archive has no such
+     * member or it could not be inflated.
+     */
+    bool member_data(char const *name, const char **data, size_t *size);
+
+    /*!
+     * Uncompressed size of a member, from the central directory.
+     */
+    bool member_size(char const *name, size_t *size) const;
+
+    /*!
+     * CRC-32 of a member's uncompressed content, from the central directory.
+     */
+    bool member_crc32(char const *name, uint32_t *crc) const;
+
+    static bool is_zip_path(char const *path);
+
+    private:
+
+    struct Entry {
+        std::string name;
+        uint16_t method;
+        uint32_t crc32;
+        uint32_t compressed_size;
+        uint32_t size;
+        uint32_t local_offset;
+    };
+
+    struct Member {
+        std::vector<char> inflated;
+        const char *data;
+        size_t size;
+        std::shared_future<bool> done;
+    };
+
+    ZipArchive(const ZipArchive &);
+
+    ZipArchive &operator=(const ZipArchive &);
+
+    bool read_directory();
+
+    const Entry *find_entry(char const *name) const;
+
+    bool extract(const Entry *entry, Member *member);
+
+    MappedFile file;
+    std::vector<Entry> entries;
+    std::map<std::string, Member> members;
+};
+
+#endif //__ZipArchive_H_
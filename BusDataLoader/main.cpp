@@ -1,4 +1,5 @@
 #include "BusDataLoader.h"
+#include <unistd.h>
 
 
 void usage(const char *cmd) {
@@ -17,8 +18,19 @@ int main(int argc, const char *argv[]) {
 
     BusDataLoader *loader = new BusDataLoader();
 
-    loader->clear_old_database(db_path);
-    loader->create_database(db_path, NULL);
+    // builds beside db_path and swaps the finished database in, so there is nothing to clear first
+    loader->set_fast_build(true);
+    loader->set_concurrent_tables(std::thread::hardware_concurrency() > 1);
+
+    // a republished feed only reloads the files that changed since the last run
+    loader->set_incremental_reload(true);
+
+    // feeds that fit in half the machine's memory are built there and written out in one pass
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && pageSize > 0) {
+        loader->set_memory_budget((size_t) pages * (size_t) pageSize / 2);
+    }
     loader->load_data(dir_path, db_path);
 
     delete loader;
@@ -10,10 +10,48 @@
 
 #include "BusDataTests.h"
 #include "BusDataLoader.h"
+#include "ParallelCsvParser.h"
+#include "CsvVirtualTable.h"
+#include "ServiceCalendar.h"
+#include "StringPool.h"
+#include "ShapeGeometry.h"
+#include "SpatialIndex.h"
+#include "TextSearch.h"
+#include "TableSchema.h"
+#include "StopTimeIndex.h"
+#include "QueryPlans.h"
+#include "FeedMeta.h"
 #include <string>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <chrono>
+#include <cmath>
 
 const char *RESOURCE_DIR_PATH = "";
 
+// every operator new in the test binary is counted, so tests can assert a code path does not allocate
+static std::atomic<size_t> allocation_count(0);
+
+void *operator new(size_t size) {
+    allocation_count++;
+    void *p = malloc(size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+// kept out of line: inlined, free() on a pointer from operator new reads as a mismatch to gcc
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
 int BusDataTests::get_table_count(sqlite3 *db, char const *table, int *status) {
     sqlite3_stmt *stmt;
     int code, rows;
@@ -28,6 +66,40 @@ int BusDataTests::get_table_count(sqlite3 *db, char const *table, int *status) {
     sqlite3_finalize(stmt);
     return rows;
 }
+
+void BusDataTests::assert_feed_counts(const char *dbPath) {
+    const char *tables[] = {"calendar_date", "agency", "route", "shape", "stop", "trip", "stop_time"};
+    const int expected[] = {16, 1, 3, 5, 4, 2, 7};
+    sqlite3 *db;
+    int code;
+
+    sqlite3_open(dbPath, &db);
+    for (int i = 0; i < 7; i++) {
+        int rows = get_table_count(db, tables[i], &code);
+        if (code != SQLITE_ROW || rows != expected[i]) {
+            sqlite3_close(db);
+            FAIL() << tables[i] << " has " << rows << " rows, expected " << expected[i];
+        }
+    }
+    sqlite3_close(db);
+}
+
+void BusDataTests::write_missing_feed_files(const char *dirPath) {
+    const char *files[][2] = {
+            {"/stops.txt", "stop_id,stop_code,stop_name,stop_desc,stop_lat,stop_lon,zone_id\n"},
+            {"/trips.txt", "route_id,service_id,trip_id,trip_headsign,direction_id,block_id,shape_id\n"},
+            {"/stop_times.txt", "trip_id,arrival_time,departure_time,stop_id,stop_sequence\n"}};
+    struct stat info;
+
+    // a feed needs these files, so ones a test does not care about are left empty but for the header
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        std::string path = std::string(dirPath).append(files[i][0]);
+        if (stat(path.c_str(), &info) != 0) {
+            std::ofstream os(path.c_str());
+            os << files[i][1];
+        }
+    }
+}
 namespace {
 
     TEST_F(BusDataTests, MethodClearOldDatabase) {
@@ -93,7 +165,6 @@ namespace {
 
         const char *dirPath = RESOURCE_DIR_PATH;
         const char *dbPath = "/tmp/busdata_test.db";
-        const char *error;
         int code;
         int rows;
         sqlite3 *db;
@@ -349,4 +420,1827 @@ namespace {
     }
 
 
+    TEST_F(BusDataTests, CsvReaderQuotedFields) {
+        const char *csv = "a,\"b,c\",\"say \"\"hi\"\"\",\r\n\r\n1,,\"\"\n\"multi\nline\",x";
+        CsvReader reader(csv, strlen(csv), ',');
+        CsvRecord fields;
+
+        ASSERT_TRUE(reader.next_record(fields));
+        ASSERT_EQ(1u, reader.line_number());
+        ASSERT_EQ(4u, fields.size());
+        ASSERT_EQ("a", std::string(fields[0].data, fields[0].length));
+        ASSERT_EQ("b,c", std::string(fields[1].data, fields[1].length));
+        ASSERT_EQ("say \"hi\"", std::string(fields[2].data, fields[2].length));
+        ASSERT_EQ(0u, fields[3].length);
+
+        ASSERT_TRUE(reader.next_record(fields));
+        ASSERT_EQ(3u, reader.line_number());
+        ASSERT_EQ(3u, fields.size());
+        ASSERT_EQ("1", std::string(fields[0].data, fields[0].length));
+        ASSERT_EQ(0u, fields[1].length);
+        ASSERT_EQ(0u, fields[2].length);
+
+        ASSERT_TRUE(reader.next_record(fields));
+        ASSERT_EQ(4u, reader.line_number());
+        ASSERT_EQ(2u, fields.size());
+        ASSERT_EQ("multi\nline", std::string(fields[0].data, fields[0].length));
+        ASSERT_EQ("x", std::string(fields[1].data, fields[1].length));
+
+        ASSERT_FALSE(reader.next_record(fields));
+    }
+
+    TEST_F(BusDataTests, MethodLoadDataStreamReader) {
+        const char *dbPath = "/tmp/busdata_test_stream.db";
+
+        BusDataLoader *loader = new BusDataLoader();
+        loader->set_reader_mode(BusDataLoader::READER_STREAM);
+        loader->clear_old_database(dbPath);
+        loader->create_database(dbPath, NULL);
+        ASSERT_EQ(0, loader->load_data(RESOURCE_DIR_PATH, dbPath));
+
+        ASSERT_NO_FATAL_FAILURE(assert_feed_counts(dbPath));
+
+        delete loader;
+    }
+
+
+    TEST_F(BusDataTests, CsvScannerKernelsAgree) {
+        const char alphabet[] = {'a', 'b', ',', '"', '\n', '\r', ' '};
+        const size_t size = 10007;
+        std::vector<char> data(size);
+        unsigned int seed = 12345;
+        for (size_t i = 0; i < size; i++) {
+            seed = seed * 1103515245 + 12345;
+            data[i] = alphabet[(seed >> 16) % sizeof(alphabet)];
+        }
+
+        // byte-at-a-time reference: a quote opens a quoted field only at the start of a
+        // field or right after the quote that closed one
+        std::vector<uint32_t> expected;
+        bool inquotes = false;
+        bool fieldStart = true;
+        bool closedQuote = false;
+        for (size_t i = 0; i < size; i++) {
+            char c = data[i];
+            bool closing = false;
+            if (c == '"') {
+                if (inquotes) {
+                    inquotes = false;
+                    closing = true;
+                } else if (fieldStart || closedQuote) {
+                    inquotes = true;
+                }
+            } else if (!inquotes && (c == ',' || c == '\n' || c == '\r')) {
+                expected.push_back((uint32_t) i);
+            }
+            fieldStart = !inquotes && (c == ',' || c == '\n' || c == '\r');
+            closedQuote = closing;
+        }
+
+        CsvScanner::Kernel kernels[] = {CsvScanner::KERNEL_SCALAR, CsvScanner::KERNEL_SSE2, CsvScanner::KERNEL_AVX2};
+        for (int k = 0; k < 3; k++) {
+            if (!CsvScanner::kernel_supported(kernels[k])) {
+                continue;
+            }
+            CsvScanner scanner(',', kernels[k]);
+            ASSERT_EQ(kernels[k], scanner.kernel());
+
+            // split at a non-multiple of 64 to exercise the padded tail and the quote carry
+            std::vector<uint32_t> positions(size + 128);
+            size_t first = 4000;
+            size_t count = scanner.scan(&data[0], first, &positions[0]);
+            size_t more = scanner.scan(&data[first], size - first, &positions[count]);
+            for (size_t i = count; i < count + more; i++) {
+                positions[i] += (uint32_t) first;
+            }
+            positions.resize(count + more);
+
+            ASSERT_EQ(expected, positions);
+        }
+    }
+
+
+    TEST_F(BusDataTests, ParallelCsvParserSplitsOnRecords) {
+        // the nominal split points land inside a quoted field spanning two lines
+        const char *csv = "1,\"x\ny\nz\",a\n2,\"p,\nq\",b\n3,c,d\n";
+        std::vector<size_t> bounds;
+        ParallelCsvParser::split_records(csv, strlen(csv), ',', 4, 2, bounds);
+
+        ASSERT_EQ(0u, bounds.front());
+        ASSERT_EQ(strlen(csv), bounds.back());
+        for (size_t i = 1; i + 1 < bounds.size(); i++) {
+            ASSERT_EQ('\n', csv[bounds[i] - 1]);
+            ASSERT_TRUE(csv[bounds[i]] == '2' || csv[bounds[i]] == '3');
+        }
+
+        // tiny chunks force many batches; records must come back complete and in order
+        std::string big;
+        for (int i = 0; i < 500; i++) {
+            std::ostringstream row;
+            row << i << ",\"name, \"\"" << i << "\"\"\n\",x\n";
+            big.append(row.str());
+        }
+
+        ParallelCsvParser parser(big.data(), big.length(), ',', 3, 64);
+        const CsvRecordBatch *batch;
+        int expected = 0;
+        unsigned int lineBase = 0;
+        while ((batch = parser.next_batch()) != NULL) {
+            const CsvField *field = batch->fields.empty() ? NULL : &batch->fields[0];
+            for (size_t r = 0; r < batch->field_counts.size(); r++) {
+                ASSERT_EQ(3u, batch->field_counts[r]);
+                std::ostringstream id, name;
+                id << expected;
+                name << "name, \"" << expected << "\"\n";
+                ASSERT_EQ(id.str(), std::string(field[0].data, field[0].length));
+                ASSERT_EQ(name.str(), std::string(field[1].data, field[1].length));
+                ASSERT_EQ((unsigned int) expected * 2 + 1, lineBase + batch->lines[r]);
+                field += 3;
+                expected++;
+            }
+            lineBase += batch->line_count;
+        }
+        ASSERT_EQ(500, expected);
+
+        // workers blocked on full rings must let go when the consumer gives up early
+        ParallelCsvParser *abandoned = new ParallelCsvParser(big.data(), big.length(), ',', 3, 64);
+        ASSERT_TRUE(abandoned->next_batch() != NULL);
+        delete abandoned;
+    }
+
+    TEST_F(BusDataTests, StrayQuoteInUnquotedField) {
+        // the quote in 12" SIGN is a literal character and must not swallow the records after it
+        std::string csv = "1,12\" SIGN,a\n2,\"x,\"\"y\"\"\",b\n";
+        for (int i = 3; i < 200; i++) {
+            std::ostringstream row;
+            row << i << ",plain,c\n";
+            csv.append(row.str());
+        }
+
+        CsvReader reader(csv.data(), csv.length(), ',');
+        CsvRecord record;
+        ASSERT_TRUE(reader.next_record(record));
+        ASSERT_EQ(3u, record.size());
+        ASSERT_EQ("12\" SIGN", std::string(record[1].data, record[1].length));
+        ASSERT_TRUE(reader.next_record(record));
+        ASSERT_EQ(3u, record.size());
+        ASSERT_EQ("x,\"y\"", std::string(record[1].data, record[1].length));
+        ASSERT_EQ(2u, reader.line_number());
+
+        std::vector<size_t> bounds;
+        ParallelCsvParser::split_records(csv.data(), csv.length(), ',', 8, 2, bounds);
+        ASSERT_GT(bounds.size(), 3u);
+        for (size_t i = 1; i + 1 < bounds.size(); i++) {
+            ASSERT_EQ('\n', csv[bounds[i] - 1]);
+        }
+
+        ParallelCsvParser parser(csv.data(), csv.length(), ',', 2, 64);
+        const CsvRecordBatch *batch;
+        size_t records = 0;
+        while ((batch = parser.next_batch()) != NULL) {
+            for (size_t r = 0; r < batch->field_counts.size(); r++) {
+                ASSERT_EQ(3u, batch->field_counts[r]);
+            }
+            records += batch->field_counts.size();
+        }
+        ASSERT_EQ(199u, records);
+    }
+
+    TEST_F(BusDataTests, MethodLoadDataParallelParse) {
+        const char *dbPath = "/tmp/busdata_test_parallel.db";
+
+        BusDataLoader *loader = new BusDataLoader();
+        loader->set_parse_threads(4);
+        loader->clear_old_database(dbPath);
+        loader->create_database(dbPath, NULL);
+        ASSERT_EQ(0, loader->load_data(RESOURCE_DIR_PATH, dbPath));
+
+        ASSERT_NO_FATAL_FAILURE(assert_feed_counts(dbPath));
+
+        delete loader;
+    }
+
+
+    TEST_F(BusDataTests, CsvRecordParsesWithoutAllocating) {
+        std::string csv;
+        for (int i = 0; i < 1000; i++) {
+            std::ostringstream row;
+            row << i << ",\"ROUTE " << i << " \"\"EXPRESS\"\"\",40." << i << ",,\"plain\"\r\n";
+            csv.append(row.str());
+        }
+
+        // mapped-file path: one reader over the whole buffer
+        size_t start = allocation_count;
+        CsvReader reader(csv.data(), csv.length(), ',');
+        CsvRecord record;
+        for (int i = 0; i < 10; i++) {
+            ASSERT_TRUE(reader.next_record(record));
+        }
+        ASSERT_EQ(5u, record.size());
+        ASSERT_EQ("ROUTE 9 \"EXPRESS\"", std::string(record[1].data, record[1].length));
+
+        size_t before = allocation_count;
+        ASSERT_LT(start, before);
+        int rows = 10;
+        while (reader.next_record(record)) {
+            rows++;
+        }
+        ASSERT_EQ(before, (size_t) allocation_count);
+        ASSERT_EQ(1000, rows);
+
+        // stream path: one reader reset on every line
+        std::vector<std::string> lines;
+        std::istringstream stream(csv);
+        std::string line;
+        while (getline(stream, line)) {
+            lines.push_back(line);
+        }
+
+        CsvReader lineReader(NULL, 0, ',');
+        for (int i = 0; i < 10; i++) {
+            lineReader.reset(lines[i].data(), lines[i].length());
+            ASSERT_TRUE(lineReader.next_record(record));
+        }
+
+        before = allocation_count;
+        for (size_t i = 10; i < lines.size(); i++) {
+            lineReader.reset(lines[i].data(), lines[i].length());
+            lineReader.next_record(record);
+        }
+        ASSERT_EQ(before, (size_t) allocation_count);
+
+        // parallel path: equal chunks, so each worker's buffers fit every chunk once warm
+        std::string row = "7,\"ROUTE 7 \"\"EXPRESS\"\"\",40.5,,\"plain\"\r\n";
+        std::string equalRows;
+        for (int i = 0; i < 1000; i++) {
+            equalRows.append(row);
+        }
+        ParallelCsvParser parser(equalRows.data(), equalRows.length(), ',', 2, 20 * row.length());
+        const CsvRecordBatch *batch = NULL;
+        for (int i = 0; i < 4; i++) {
+            batch = parser.next_batch();
+            ASSERT_TRUE(batch != NULL);
+        }
+
+        before = allocation_count;
+        size_t batches = 4;
+        while ((batch = parser.next_batch()) != NULL) {
+            ASSERT_EQ(17u, batch->fields[1].length);
+            ASSERT_EQ(0, memcmp("ROUTE 7 \"EXPRESS\"", batch->fields[1].data, 17));
+            batches++;
+        }
+        ASSERT_EQ(before, (size_t) allocation_count);
+        ASSERT_EQ(50u, batches);
+    }
+
+
+    TEST_F(BusDataTests, FieldDecoders) {
+        int64_t intValue;
+        double realValue;
+
+        ASSERT_TRUE(parse_int64("21263", 5, &intValue));
+        ASSERT_EQ(21263, intValue);
+        ASSERT_TRUE(parse_int64(" -42 ", 5, &intValue));
+        ASSERT_EQ(-42, intValue);
+        ASSERT_FALSE(parse_int64("164OD014", 8, &intValue));
+        ASSERT_FALSE(parse_int64("", 0, &intValue));
+        ASSERT_FALSE(parse_int64("1234567890123456789", 19, &intValue));
+
+        ASSERT_TRUE(parse_decimal("-74.141421", 10, &realValue));
+        ASSERT_EQ(-74.141421, realValue);
+        ASSERT_TRUE(parse_decimal("1.5e3", 5, &realValue));
+        ASSERT_EQ(1500.0, realValue);
+        ASSERT_TRUE(parse_decimal("7", 1, &realValue));
+        ASSERT_EQ(7.0, realValue);
+        ASSERT_FALSE(parse_decimal(".", 1, &realValue));
+        ASSERT_FALSE(parse_decimal("40.7x", 5, &realValue));
+        ASSERT_TRUE(parse_decimal("-40.71277584325123456", 21, &realValue));
+        ASSERT_EQ(strtod("-40.71277584325123456", NULL), realValue);
+        ASSERT_TRUE(parse_decimal("2.5E-3", 6, &realValue));
+        ASSERT_EQ(0.0025, realValue);
+        ASSERT_FALSE(parse_decimal("inf", 3, &realValue));
+        ASSERT_FALSE(parse_decimal("-Infinity", 9, &realValue));
+        ASSERT_FALSE(parse_decimal("nan", 3, &realValue));
+        ASSERT_FALSE(parse_decimal("0x1A", 4, &realValue));
+        ASSERT_FALSE(parse_decimal("1e999", 5, &realValue));
+        ASSERT_FALSE(parse_decimal("1e", 2, &realValue));
+        ASSERT_FALSE(parse_decimal("1.2.3e4", 7, &realValue));
+
+        // the fast path must round exactly like strtod
+        unsigned int seed = 99;
+        for (int i = 0; i < 100000; i++) {
+            char text[32];
+            seed = seed * 1103515245 + 12345;
+            int whole = (int) (seed >> 8) % 200 - 100;
+            seed = seed * 1103515245 + 12345;
+            int frac = (int) ((seed >> 4) % 1000000);
+            int len = sprintf(text, "%d.%06d", whole, frac);
+            ASSERT_TRUE(parse_decimal(text, len, &realValue));
+            ASSERT_EQ(strtod(text, NULL), realValue) << text;
+        }
+
+        ASSERT_EQ(COLUMN_INTEGER, column_type_from_decl("INTEGER"));
+        ASSERT_EQ(COLUMN_REAL, column_type_from_decl("REAL"));
+        ASSERT_EQ(COLUMN_TEXT, column_type_from_decl("VARCHAR"));
+        ASSERT_EQ(COLUMN_TEXT, column_type_from_decl(NULL));
+
+        ASSERT_TRUE(parse_time_seconds("07:28:15", 8, &intValue));
+        ASSERT_EQ(7 * 3600 + 28 * 60 + 15, intValue);
+        ASSERT_TRUE(parse_time_seconds(" 7:05:09", 8, &intValue));
+        ASSERT_EQ(7 * 3600 + 5 * 60 + 9, intValue);
+        ASSERT_TRUE(parse_time_seconds("25:10:00", 8, &intValue));
+        ASSERT_EQ(90600, intValue);
+        ASSERT_TRUE(parse_time_seconds("100:00:01", 9, &intValue));
+        ASSERT_EQ(360001, intValue);
+        ASSERT_FALSE(parse_time_seconds("07:60:00", 8, &intValue));
+        ASSERT_FALSE(parse_time_seconds("7:5:09", 6, &intValue));
+        ASSERT_FALSE(parse_time_seconds("ab:00:00", 8, &intValue));
+        ASSERT_FALSE(parse_time_seconds("07-28-15", 8, &intValue));
+    }
+
+    TEST_F(BusDataTests, MethodLoadDataTypedColumns) {
+        const char *dbPath = "/tmp/busdata_test_typed.db";
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+
+        BusDataLoader *loader = new BusDataLoader();
+        loader->clear_old_database(dbPath);
+        loader->create_database(dbPath, NULL);
+        ASSERT_EQ(0, loader->load_data(RESOURCE_DIR_PATH, dbPath));
+        delete loader;
+
+        sqlite3_open(dbPath, &db);
+
+        sql = "select typeof(stop_id), typeof(stop_code), typeof(stop_name), typeof(stop_desc), typeof(stop_lat) from stop";
+        sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_STREQ("integer", (const char *) sqlite3_column_text(stmt, 0));
+        ASSERT_STREQ("integer", (const char *) sqlite3_column_text(stmt, 1));
+        ASSERT_STREQ("text", (const char *) sqlite3_column_text(stmt, 2));
+        ASSERT_STREQ("text", (const char *) sqlite3_column_text(stmt, 3));
+        ASSERT_STREQ("real", (const char *) sqlite3_column_text(stmt, 4));
+        sqlite3_finalize(stmt);
+
+        sql = "select typeof(shape_dist_traveled), typeof(arrival_time) from stop_time";
+        sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_STREQ("real", (const char *) sqlite3_column_text(stmt, 0));
+        ASSERT_STREQ("text", (const char *) sqlite3_column_text(stmt, 1));
+        sqlite3_finalize(stmt);
+
+        sqlite3_close(db);
+    }
+
+
+    TEST_F(BusDataTests, MethodLoadDataReorderedColumns) {
+        const char *dirPath = "/tmp/busdata_reordered";
+        const char *dbPath = "/tmp/busdata_test_reordered.db";
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+        int code;
+
+        // columns shuffled, an unknown column added and the optional zone_id left out
+        mkdir(dirPath, 0755);
+        std::ofstream os(std::string(dirPath).append("/stops.txt").c_str());
+        os << "\xEF\xBB\xBFstop_lat,stop_name,wheelchair_boarding,stop_id,stop_lon,stop_desc,stop_code\r\n";
+        os << "40.769019,\"ELM ST AT MIDLAND AVE#\",\"1, maybe\",7,-74.141421,,21263\r\n";
+        os << "39.395538,\"MAIN ST AT ADAMS AVE\",0,162,-74.519212,,10817\r\n";
+        os.close();
+        write_missing_feed_files(dirPath);
+
+        BusDataLoader *loader = new BusDataLoader();
+        loader->clear_old_database(dbPath);
+        loader->create_database(dbPath, NULL);
+        ASSERT_EQ(0, loader->load_data(dirPath, dbPath));
+        delete loader;
+
+        sqlite3_open(dbPath, &db);
+        ASSERT_EQ(2, get_table_count(db, "stop", &code));
+
+        sql = "select stop_id, stop_code, stop_name, stop_lat, stop_lon, zone_id from stop order by id";
+        sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_EQ(7, sqlite3_column_int(stmt, 0));
+        ASSERT_EQ(21263, sqlite3_column_int(stmt, 1));
+        ASSERT_STREQ("ELM ST AT MIDLAND AVE#", (const char *) sqlite3_column_text(stmt, 2));
+        ASSERT_EQ(40.769019, sqlite3_column_double(stmt, 3));
+        ASSERT_EQ(-74.141421, sqlite3_column_double(stmt, 4));
+        ASSERT_EQ(SQLITE_NULL, sqlite3_column_type(stmt, 5));
+        sqlite3_finalize(stmt);
+
+        sqlite3_close(db);
+    }
+
+
+    TEST_F(BusDataTests, MethodLoadDataZipArchive) {
+        std::string zipPath = std::string(RESOURCE_DIR_PATH).append("/gtfs_feed.zip");
+        const char *dbPath = "/tmp/busdata_test_zip.db";
+        const char *data;
+        size_t size;
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+
+        // members sit in a folder; agency.txt is stored, the rest deflated
+        ZipArchive archive;
+        ASSERT_TRUE(archive.open(zipPath.c_str()));
+        ASSERT_TRUE(archive.member_data("agency.txt", &data, &size));
+        ASSERT_EQ(0, strncmp(data, "agency_id,", 10));
+        ASSERT_TRUE(archive.member_data("stops.txt", &data, &size));
+        ASSERT_EQ(0, strncmp(data, "stop_id,", 8));
+        ASSERT_FALSE(archive.member_data("frequencies.txt", &data, &size));
+        archive.close();
+
+        BusDataLoader *loader = new BusDataLoader();
+        loader->clear_old_database(dbPath);
+        loader->create_database(dbPath, NULL);
+        ASSERT_EQ(0, loader->load_data(zipPath.c_str(), dbPath));
+        ASSERT_EQ(1, loader->load_data("/tmp/busdata_missing_feed.zip", dbPath));
+        delete loader;
+
+        ASSERT_NO_FATAL_FAILURE(assert_feed_counts(dbPath));
+        sqlite3_open(dbPath, &db);
+
+        sql = "select stop_name from stop where stop_id = 7";
+        sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_STREQ("ELM ST AT MIDLAND AVE#", (const char *) sqlite3_column_text(stmt, 0));
+        sqlite3_finalize(stmt);
+
+        sqlite3_close(db);
+    }
+
+
+    TEST_F(BusDataTests, MethodLoadDataFastBuild) {
+        const char *dbPath = "/tmp/busdata_test_fast.db";
+        const char *buildPath = "/tmp/busdata_test_fast.db.building";
+        struct stat info;
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+        int code;
+
+        // a database readers are already using
+        BusDataLoader *loader = new BusDataLoader();
+        loader->clear_old_database(dbPath);
+        loader->create_database(dbPath, NULL);
+        sqlite3_open(dbPath, &db);
+        sqlite3_exec(db, "CREATE TABLE previous_build (x INTEGER)", NULL, NULL, NULL);
+        sqlite3_close(db);
+
+        // a failed load leaves it alone and cleans up after itself
+        loader->set_fast_build(true);
+        ASSERT_EQ(1, loader->load_data("/tmp/busdata_missing_feed.zip", dbPath));
+        ASSERT_NE(0, stat(buildPath, &info));
+        sqlite3_open(dbPath, &db);
+        ASSERT_EQ(0, get_table_count(db, "previous_build", &code));
+        ASSERT_EQ(SQLITE_ROW, code);
+        sqlite3_close(db);
+
+        // a good one replaces it whole
+        ASSERT_EQ(0, loader->load_data(RESOURCE_DIR_PATH, dbPath));
+        ASSERT_NE(0, stat(buildPath, &info));
+
+        // a feed with a file that has no header and a required file missing is not published
+        const char *brokenPath = "/tmp/busdata_broken";
+        mkdir(brokenPath, 0755);
+        std::ofstream os(std::string(brokenPath).append("/stops.txt").c_str());
+        os.close();
+        os.open(std::string(brokenPath).append("/trips.txt").c_str());
+        os << "route_id,service_id,trip_id,trip_headsign\n";
+        os << "1,1,1,NOWHERE\n";
+        os.close();
+        remove(std::string(brokenPath).append("/stop_times.txt").c_str());
+        ASSERT_EQ(1, loader->load_data(brokenPath, dbPath));
+        ASSERT_NE(0, stat(buildPath, &info));
+        delete loader;
+
+        ASSERT_NO_FATAL_FAILURE(assert_feed_counts(dbPath));
+        sqlite3_open(dbPath, &db);
+        get_table_count(db, "previous_build", &code);
+        ASSERT_NE(SQLITE_ROW, code);
+
+        sql = "PRAGMA page_size";
+        sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_EQ(8192, sqlite3_column_int(stmt, 0));
+        sqlite3_finalize(stmt);
+
+        sqlite3_close(db);
+    }
+
+
+    TEST_F(BusDataTests, MethodLoadDataBatchedInserts) {
+        const char *dirPath = "/tmp/busdata_batched";
+        const char *dbPath = "/tmp/busdata_test_batched.db";
+        const BusDataLoader::ReaderMode modes[] = {BusDataLoader::READER_MMAP, BusDataLoader::READER_STREAM};
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+        int code;
+
+        // two full batches of two plus a tail row, with an escaped name and a short row
+        mkdir(dirPath, 0755);
+        std::ofstream os(std::string(dirPath).append("/stops.txt").c_str());
+        os << "stop_id,stop_code,stop_name,stop_desc,stop_lat,stop_lon,zone_id\n";
+        os << "1,101,\"FIRST \"\"A\"\" ST\",,40.1,-74.1,5\n";
+        os << "2,102,SECOND ST,,40.2,-74.2,5\n";
+        os << "3,103,\"THIRD \"\"C\"\" ST\",,40.3,-74.3,5\n";
+        os << "4,104,FOURTH ST\n";
+        os << "5,105,FIFTH ST,,40.5,-74.5,6\n";
+        os.close();
+        write_missing_feed_files(dirPath);
+
+        for (int m = 0; m < 2; m++) {
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_reader_mode(modes[m]);
+            loader->set_parse_threads(0);
+            loader->set_insert_batch_rows(2);
+            loader->clear_old_database(dbPath);
+            loader->create_database(dbPath, NULL);
+            ASSERT_EQ(0, loader->load_data(dirPath, dbPath));
+            delete loader;
+
+            sqlite3_open(dbPath, &db);
+            ASSERT_EQ(5, get_table_count(db, "stop", &code));
+
+            sql = "select stop_id, stop_name, stop_lat, zone_id from stop order by id";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(1, sqlite3_column_int(stmt, 0));
+            ASSERT_STREQ("FIRST \"A\" ST", (const char *) sqlite3_column_text(stmt, 1));
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_STREQ("SECOND ST", (const char *) sqlite3_column_text(stmt, 1));
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_STREQ("THIRD \"C\" ST", (const char *) sqlite3_column_text(stmt, 1));
+            ASSERT_EQ(40.3, sqlite3_column_double(stmt, 2));
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_STREQ("FOURTH ST", (const char *) sqlite3_column_text(stmt, 1));
+            ASSERT_EQ(SQLITE_NULL, sqlite3_column_type(stmt, 2));
+            ASSERT_EQ(SQLITE_NULL, sqlite3_column_type(stmt, 3));
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(5, sqlite3_column_int(stmt, 0));
+            ASSERT_EQ(6, sqlite3_column_int(stmt, 3));
+            ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+            sqlite3_finalize(stmt);
+
+            sqlite3_close(db);
+        }
+    }
+
+
+    TEST_F(BusDataTests, MethodLoadDataConcurrentTables) {
+        const char *dbPath = "/tmp/busdata_test_concurrent.db";
+        std::string zipPath = std::string(RESOURCE_DIR_PATH).append("/gtfs_feed.zip");
+        const char *sources[] = {RESOURCE_DIR_PATH, zipPath.c_str()};
+        struct stat info;
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+
+        for (int fast = 0; fast < 2; fast++) {
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_concurrent_tables(true);
+            loader->set_fast_build(fast == 1);
+            loader->clear_old_database(dbPath);
+            if (fast == 0) {
+                loader->create_database(dbPath, NULL);
+            }
+            ASSERT_EQ(0, loader->load_data(sources[fast], dbPath));
+            delete loader;
+
+            // the shards are gone once they are merged
+            std::string shardPath = std::string(dbPath).append(fast == 1 ? ".building" : "").append(".shape.shard");
+            ASSERT_NE(0, stat(shardPath.c_str(), &info));
+
+            ASSERT_NO_FATAL_FAILURE(assert_feed_counts(dbPath));
+            sqlite3_open(dbPath, &db);
+
+            sql = "select arrival_time, stop_id from stop_time order by id";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_STREQ("06:08:00", (const char *) sqlite3_column_text(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            sqlite3_close(db);
+        }
+    }
+
+
+    TEST_F(BusDataTests, CsvVirtualTableQueriesFeedFiles) {
+        std::string stopsPath = std::string(RESOURCE_DIR_PATH).append("/stops.txt");
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        std::string sql;
+
+        sqlite3_open(":memory:", &db);
+        ASSERT_EQ(SQLITE_OK, register_csv_virtual_table(db));
+        sqlite3_exec(db, "CREATE TABLE stop (stop_id INTEGER, stop_lat REAL, stop_desc TEXT)", NULL, NULL, NULL);
+
+        // untyped: every field is text
+        sql = std::string("CREATE VIRTUAL TABLE temp.raw_stops USING gtfs_csv('").append(stopsPath).append("')");
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL));
+        sql = "select stop_id, stop_name, typeof(stop_lat), stop_desc from raw_stops where stop_code = '21263'";
+        sqlite3_prepare_v2(db, sql.c_str(), sql.length(), &stmt, NULL);
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_STREQ("7", (const char *) sqlite3_column_text(stmt, 0));
+        ASSERT_STREQ("ELM ST AT MIDLAND AVE#", (const char *) sqlite3_column_text(stmt, 1));
+        ASSERT_STREQ("text", (const char *) sqlite3_column_text(stmt, 2));
+        ASSERT_STREQ("", (const char *) sqlite3_column_text(stmt, 3));
+        ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+        sqlite3_finalize(stmt);
+
+        // typed after the stop table: numbers decoded, untyped columns left alone
+        sql = std::string("CREATE VIRTUAL TABLE temp.typed_stops USING gtfs_csv('").append(stopsPath).append("', stop)");
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL));
+        sql = "select count(*), typeof(stop_id), typeof(stop_lat), typeof(stop_desc) from typed_stops";
+        sqlite3_prepare_v2(db, sql.c_str(), sql.length(), &stmt, NULL);
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_EQ(4, sqlite3_column_int(stmt, 0));
+        ASSERT_STREQ("integer", (const char *) sqlite3_column_text(stmt, 1));
+        ASSERT_STREQ("real", (const char *) sqlite3_column_text(stmt, 2));
+        ASSERT_STREQ("text", (const char *) sqlite3_column_text(stmt, 3));
+        sqlite3_finalize(stmt);
+
+        ASSERT_NE(SQLITE_OK, sqlite3_exec(db, "CREATE VIRTUAL TABLE temp.missing USING gtfs_csv('/tmp/no_such_feed/stops.txt')", NULL, NULL, NULL));
+        sqlite3_close(db);
+    }
+
+
+    TEST_F(BusDataTests, MethodLoadDataVirtualTableImport) {
+        const char *dbPath = "/tmp/busdata_test_vtab.db";
+        std::string zipPath = std::string(RESOURCE_DIR_PATH).append("/gtfs_feed.zip");
+        const char *sources[] = {RESOURCE_DIR_PATH, zipPath.c_str()};
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+
+        for (int s = 0; s < 2; s++) {
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_virtual_table_import(true);
+            loader->clear_old_database(dbPath);
+            loader->create_database(dbPath, NULL);
+            ASSERT_EQ(0, loader->load_data(sources[s], dbPath));
+            delete loader;
+
+            ASSERT_NO_FATAL_FAILURE(assert_feed_counts(dbPath));
+            sqlite3_open(dbPath, &db);
+
+            sql = "select typeof(stop_id), stop_name, stop_lat, stop_desc from stop order by id";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_STREQ("integer", (const char *) sqlite3_column_text(stmt, 0));
+            ASSERT_STREQ("ELM ST AT MIDLAND AVE#", (const char *) sqlite3_column_text(stmt, 1));
+            ASSERT_EQ(40.769019, sqlite3_column_double(stmt, 2));
+            ASSERT_STREQ("", (const char *) sqlite3_column_text(stmt, 3));
+            sqlite3_finalize(stmt);
+
+            sqlite3_close(db);
+        }
+    }
+
+
+    TEST_F(BusDataTests, MethodLoadDataInMemory) {
+        const char *dbPath = "/tmp/busdata_test_memory.db";
+        // the test feed needs a few KB: the first budget fits it, the second forces the disk path
+        const size_t budgets[] = {64 * 1024 * 1024, 1024};
+        const int pageSizes[] = {8192, 4096};
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+
+        for (int b = 0; b < 2; b++) {
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_memory_budget(budgets[b]);
+            loader->clear_old_database(dbPath);
+            loader->create_database(dbPath, NULL);
+            ASSERT_EQ(0, loader->load_data(RESOURCE_DIR_PATH, dbPath));
+            delete loader;
+
+            ASSERT_NO_FATAL_FAILURE(assert_feed_counts(dbPath));
+            sqlite3_open(dbPath, &db);
+
+            // an in-memory build is a fast build copied over the file, page size included
+            sql = "PRAGMA page_size";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(pageSizes[b], sqlite3_column_int(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            sql = "select count(*) from sqlite_master where type = 'index'";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(5, sqlite3_column_int(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            sqlite3_close(db);
+        }
+    }
+
+
+    TEST_F(BusDataTests, MethodLoadDataClusteredStopTimes) {
+        const char *dirPath = "/tmp/busdata_clustered";
+        const char *dbPath = "/tmp/busdata_test_clustered.db";
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+        int code;
+
+        // trips and sequences out of order, with a quoted field in the middle of the file
+        mkdir(dirPath, 0755);
+        std::ofstream os(std::string(dirPath).append("/stop_times.txt").c_str());
+        os << "trip_id,arrival_time,departure_time,stop_id,stop_sequence,pickup_type,drop_off_type,shape_dist_traveled\n";
+        os << "20,08:10:00,08:10:00,3,2,0,0,1.5\n";
+        os << "10,07:00:00,07:00:00,1,1,0,0,0\n";
+        os << "20,08:00:00,\"08:00:00\",2,1,0,0,0\n";
+        os << "10,07:20:00,07:20:00,3,3,0,0,2.5\n";
+        os << "10,07:10:00,07:10:00,2,2,0,0,1.2\n";
+        os.close();
+        write_missing_feed_files(dirPath);
+
+        for (int vtab = 0; vtab < 2; vtab++) {
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_clustered_stop_times(true);
+            loader->set_virtual_table_import(vtab != 0);
+            loader->clear_old_database(dbPath);
+            loader->create_database(dbPath, NULL);
+            ASSERT_EQ(0, loader->load_data(dirPath, dbPath));
+            delete loader;
+
+            sqlite3_open(dbPath, &db);
+            ASSERT_EQ(5, get_table_count(db, "stop_time", &code));
+
+            sql = "select count(*) from sqlite_master where name = 'stop_time' and sql like '%WITHOUT ROWID'";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(1, sqlite3_column_int(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            sql = "select count(*) from sqlite_master where name = 'idx_st_trip_id'";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(0, sqlite3_column_int(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            // a plain scan walks the primary key
+            const int expected[][3] = {{10, 1, 1}, {10, 2, 2}, {10, 3, 3}, {20, 1, 2}, {20, 2, 3}};
+            sql = "select trip_id, stop_sequence, stop_id, departure_time from stop_time";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            for (int r = 0; r < 5; r++) {
+                ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+                ASSERT_EQ(expected[r][0], sqlite3_column_int(stmt, 0));
+                ASSERT_EQ(expected[r][1], sqlite3_column_int(stmt, 1));
+                ASSERT_EQ(expected[r][2], sqlite3_column_int(stmt, 2));
+            }
+            ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+            sqlite3_finalize(stmt);
+
+            sql = "select departure_time from stop_time where trip_id = 20 and stop_sequence = 1";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_STREQ("08:00:00", (const char *) sqlite3_column_text(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            sqlite3_close(db);
+        }
+
+        // a duplicate key fails its batch, and only the duplicate may be lost with it
+        os.open(std::string(dirPath).append("/stop_times.txt").c_str(), std::ios::app);
+        os << "10,07:30:00,07:30:00,4,3,0,0,3.5\n";
+        os.close();
+
+        BusDataLoader *loader = new BusDataLoader();
+        loader->set_clustered_stop_times(true);
+        loader->set_insert_batch_rows(4);
+        loader->clear_old_database(dbPath);
+        loader->create_database(dbPath, NULL);
+        ASSERT_EQ(1, loader->load_data(dirPath, dbPath));
+        delete loader;
+
+        sqlite3_open(dbPath, &db);
+        ASSERT_EQ(5, get_table_count(db, "stop_time", &code));
+        sql = "select stop_id from stop_time where trip_id = 10 and stop_sequence = 3";
+        sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_EQ(3, sqlite3_column_int(stmt, 0));
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+    }
+
+    TEST_F(BusDataTests, MethodLoadDataSecondsTimes) {
+        const char *dirPath = "/tmp/busdata_seconds";
+        const char *dbPath = "/tmp/busdata_test_seconds.db";
+        const BusDataLoader::TimeColumns modes[] = {BusDataLoader::TIMES_SECONDS, BusDataLoader::TIMES_SECONDS_AND_TEXT};
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+        int code;
+
+        // an after-midnight time, a single-digit hour, an empty arrival and one that does not parse
+        mkdir(dirPath, 0755);
+        std::ofstream os(std::string(dirPath).append("/stop_times.txt").c_str());
+        os << "trip_id,arrival_time,departure_time,stop_id,stop_sequence,pickup_type,drop_off_type,shape_dist_traveled\n";
+        os << "1,23:50:00,23:55:30,1,1,0,0,0\n";
+        os << "1,25:10:00,25:10:00,2,2,0,0,1.5\n";
+        os << "2,7:05:09,7:05:09,1,1,0,0,0\n";
+        os << "2,,07:30:00,2,2,0,0,1.5\n";
+        os << "2,soon,07:40:00,3,3,0,0,2.5\n";
+        os.close();
+        write_missing_feed_files(dirPath);
+
+        for (int m = 0; m < 2; m++) {
+            for (int vtab = 0; vtab < 2; vtab++) {
+                BusDataLoader *loader = new BusDataLoader();
+                loader->set_time_columns(modes[m]);
+                loader->set_virtual_table_import(vtab != 0);
+                loader->clear_old_database(dbPath);
+                loader->create_database(dbPath, NULL);
+                ASSERT_EQ(0, loader->load_data(dirPath, dbPath));
+                delete loader;
+
+                sqlite3_open(dbPath, &db);
+                ASSERT_EQ(5, get_table_count(db, "stop_time", &code));
+
+                const int departures[] = {86130, 90600, 25509, 27000, 27600};
+                sql = "select departure_secs, typeof(arrival_secs), arrival_secs from stop_time order by trip_id, stop_sequence";
+                sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+                for (int r = 0; r < 5; r++) {
+                    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+                    ASSERT_EQ(departures[r], sqlite3_column_int(stmt, 0));
+                    if (r == 3) {
+                        ASSERT_STREQ("null", (const char *) sqlite3_column_text(stmt, 1));
+                    } else if (r == 4) {
+                        ASSERT_STREQ("soon", (const char *) sqlite3_column_text(stmt, 2));
+                    } else {
+                        ASSERT_STREQ("integer", (const char *) sqlite3_column_text(stmt, 1));
+                    }
+                }
+                sqlite3_finalize(stmt);
+
+                // departure ranges compare integers through the new index
+                sql = "select count(*) from stop_time where departure_secs between 25000 and 28000";
+                sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+                ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+                ASSERT_EQ(3, sqlite3_column_int(stmt, 0));
+                sqlite3_finalize(stmt);
+
+                sql = "select count(*) from sqlite_master where name = 'idx_st_departure_secs'";
+                sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+                ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+                ASSERT_EQ(1, sqlite3_column_int(stmt, 0));
+                sqlite3_finalize(stmt);
+
+                sql = "select arrival_time, departure_time from stop_time order by trip_id, stop_sequence";
+                if (modes[m] == BusDataLoader::TIMES_SECONDS) {
+                    ASSERT_NE(SQLITE_OK, sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL));
+                    sqlite3_finalize(stmt);
+                } else {
+                    const char *expected[][2] = {{"23:50:00", "23:55:30"}, {"25:10:00", "25:10:00"}, {"07:05:09", "07:05:09"}, {NULL, "07:30:00"}, {"soon", "07:40:00"}};
+                    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL));
+                    for (int r = 0; r < 5; r++) {
+                        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+                        if (expected[r][0] == NULL) {
+                            ASSERT_EQ(SQLITE_NULL, sqlite3_column_type(stmt, 0));
+                        } else {
+                            ASSERT_STREQ(expected[r][0], (const char *) sqlite3_column_text(stmt, 0));
+                        }
+                        ASSERT_STREQ(expected[r][1], (const char *) sqlite3_column_text(stmt, 1));
+                    }
+                    sqlite3_finalize(stmt);
+                }
+
+                sqlite3_close(db);
+            }
+        }
+    }
+
+    TEST_F(BusDataTests, MethodLoadDataServiceCalendar) {
+        const char *dirPath = "/tmp/busdata_calendar";
+        const char *dbPath = "/tmp/busdata_test_calendar.db";
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+        ServiceCalendar calendar;
+        int64_t day;
+
+        // service 7 runs over a month and a leap day; one of its dates is removed again
+        mkdir(dirPath, 0755);
+        std::ofstream os(std::string(dirPath).append("/calendar_dates.txt").c_str());
+        os << "service_id,date,exception_type\n";
+        os << "7,20120228,1\n";
+        os << "7,20120229,1\n";
+        os << "7,20120301,1\n";
+        os << "8,20120301,1\n";
+        os << "7,20120229,2\n";
+        os << "8,someday,1\n";
+        os << "9,20120328,1\n";
+        os.close();
+        os.open(std::string(dirPath).append("/trips.txt").c_str());
+        os << "route_id,service_id,trip_id,trip_headsign,direction_id,block_id,shape_id\n";
+        os << "1,7,100,A,0,,\n";
+        os << "1,8,101,B,0,,\n";
+        os << "1,9,102,C,0,,\n";
+        os.close();
+        write_missing_feed_files(dirPath);
+
+        ASSERT_TRUE(ServiceCalendar::day_number(19700101, &day));
+        ASSERT_EQ(0, day);
+        ASSERT_TRUE(ServiceCalendar::day_number(20120301, &day));
+        ASSERT_EQ(15400, day);
+        ASSERT_FALSE(ServiceCalendar::day_number(20121301, &day));
+        ASSERT_FALSE(ServiceCalendar::day_number(20120231, &day));
+        ASSERT_FALSE(ServiceCalendar::day_number(20120431, &day));
+        ASSERT_TRUE(ServiceCalendar::day_number(20120229, &day));
+        ASSERT_FALSE(ServiceCalendar::day_number(20110229, &day));
+        ASSERT_FALSE(ServiceCalendar::day_number(19000229, &day));
+        ASSERT_TRUE(ServiceCalendar::day_number(20000229, &day));
+        ASSERT_EQ(19700101, ServiceCalendar::date_of_day(0));
+        ASSERT_EQ(20120301, ServiceCalendar::date_of_day(15400));
+        ASSERT_EQ(20120229, ServiceCalendar::date_of_day(15399));
+        ASSERT_EQ(20001231, ServiceCalendar::date_of_day(11322));
+
+        BusDataLoader *loader = new BusDataLoader();
+        loader->clear_old_database(dbPath);
+        loader->create_database(dbPath, NULL);
+        ASSERT_EQ(0, loader->load_data(dirPath, dbPath));
+        delete loader;
+
+        sqlite3_open(dbPath, &db);
+
+        sql = "select service_id, start_date, day_count, length(days) from service_calendar order by service_id";
+        sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+        for (int service = 7; service <= 9; service++) {
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(service, sqlite3_column_int(stmt, 0));
+            ASSERT_EQ(20120228, sqlite3_column_int(stmt, 1));
+            ASSERT_EQ(30, sqlite3_column_int(stmt, 2));
+            ASSERT_EQ(4, sqlite3_column_int(stmt, 3));
+        }
+        ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+        sqlite3_finalize(stmt);
+
+        ASSERT_EQ(0, calendar.load(db));
+        ASSERT_EQ(3, calendar.service_count());
+        ASSERT_TRUE(calendar.active(7, 20120228));
+        ASSERT_FALSE(calendar.active(7, 20120229));
+        ASSERT_TRUE(calendar.active(7, 20120301));
+        ASSERT_FALSE(calendar.active(7, 20120302));
+        ASSERT_TRUE(calendar.active(8, 20120301));
+        ASSERT_TRUE(calendar.active(9, 20120328));
+        ASSERT_FALSE(calendar.active(9, 20120329));
+        ASSERT_FALSE(calendar.active(7, 20120227));
+        ASSERT_FALSE(calendar.active(10, 20120301));
+
+        // trips running on a day, filtered with a bit test instead of a join
+        ASSERT_EQ(SQLITE_OK, calendar.register_function(db));
+        sql = "select trip_id from trip where service_active(service_id, 20120301) order by trip_id";
+        sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_EQ(100, sqlite3_column_int(stmt, 0));
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_EQ(101, sqlite3_column_int(stmt, 0));
+        ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+        sqlite3_finalize(stmt);
+
+        sql = "select typeof(date) from calendar_date";
+        sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_STREQ("integer", (const char *) sqlite3_column_text(stmt, 0));
+        sqlite3_finalize(stmt);
+
+        sqlite3_close(db);
+
+        // dates before 1970 have negative day numbers
+        sqlite3_open(":memory:", &db);
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "create table calendar_date (service_id integer, date integer, exception_type integer); "
+                "insert into calendar_date values (1, 19691229, 1), (2, 19691230, 1)", NULL, NULL, NULL));
+        ASSERT_EQ(0, ServiceCalendar::build(db));
+        sql = "select start_date, day_count from service_calendar where service_id = 2";
+        sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+        ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+        ASSERT_EQ(19691229, sqlite3_column_int(stmt, 0));
+        ASSERT_EQ(2, sqlite3_column_int(stmt, 1));
+        sqlite3_finalize(stmt);
+        ASSERT_EQ(0, calendar.load(db));
+        ASSERT_TRUE(calendar.active(2, 19691230));
+        ASSERT_FALSE(calendar.active(2, 19691229));
+        sqlite3_close(db);
+    }
+
+    TEST_F(BusDataTests, StringPoolInterns) {
+        StringPool pool;
+        size_t length;
+        char value[16];
+
+        ASSERT_EQ(1u, pool.intern("MAIN ST", 7));
+        ASSERT_EQ(2u, pool.intern("MAIN", 4));
+        ASSERT_EQ(1u, pool.intern("MAIN ST", 7));
+        ASSERT_EQ(3u, pool.intern("", 0));
+        ASSERT_EQ(3u, pool.intern("", 0));
+        ASSERT_EQ(3u, pool.size());
+
+        // enough values to grow the table several times
+        for (int i = 0; i < 5000; i++) {
+            int n = snprintf(value, sizeof(value), "v%d", i);
+            ASSERT_EQ((uint32_t) i + 4, pool.intern(value, n));
+        }
+        for (int i = 0; i < 5000; i += 7) {
+            int n = snprintf(value, sizeof(value), "v%d", i);
+            ASSERT_EQ((uint32_t) i + 4, pool.intern(value, n));
+        }
+        ASSERT_EQ(5003u, pool.size());
+
+        const char *stored = pool.value(2, &length);
+        ASSERT_EQ(std::string("MAIN"), std::string(stored, length));
+        stored = pool.value(5003, &length);
+        ASSERT_EQ(std::string("v4999"), std::string(stored, length));
+
+        pool.clear();
+        ASSERT_EQ(0u, pool.size());
+        ASSERT_EQ(1u, pool.intern("MAIN", 4));
+    }
+
+
+    TEST_F(BusDataTests, MethodLoadDataDictionaryEncoding) {
+        const char *plainPath = "/tmp/busdata_test_plain.db";
+        const char *dbPath = "/tmp/busdata_test_dictionary.db";
+        const char *columns[][2] = {{"trip", "trip_headsign"}, {"trip", "block_id"}, {"route", "route_short_name"}, {"stop", "stop_name"}};
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        sqlite3_stmt *plainStmt;
+        char sql[256];
+
+        BusDataLoader *loader = new BusDataLoader();
+        loader->clear_old_database(plainPath);
+        loader->create_database(plainPath, NULL);
+        ASSERT_EQ(0, loader->load_data(RESOURCE_DIR_PATH, plainPath));
+        delete loader;
+
+        for (int vtab = 0; vtab < 2; vtab++) {
+            loader = new BusDataLoader();
+            loader->set_dictionary_encoding(true);
+            loader->set_virtual_table_import(vtab != 0);
+            loader->clear_old_database(dbPath);
+            loader->create_database(dbPath, NULL);
+            ASSERT_EQ(0, loader->load_data(RESOURCE_DIR_PATH, dbPath));
+            ASSERT_TRUE(loader->dictionary("trip_headsign") != NULL);
+            ASSERT_TRUE(loader->dictionary("stop_desc") == NULL);
+
+            sqlite3_open(dbPath, &db);
+            sqlite3 *plain;
+            sqlite3_open(plainPath, &plain);
+
+            // joining the codes back to their dictionaries gives the text of a plain load
+            for (int c = 0; c < 4; c++) {
+                snprintf(sql, sizeof(sql), "select d.value from %s t left join dict_%s d on d.code = t.%s_code order by t.id", columns[c][0], columns[c][1], columns[c][1]);
+                ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, sql, -1, &stmt, NULL));
+                snprintf(sql, sizeof(sql), "select nullif(%s, '') from %s order by id", columns[c][1], columns[c][0]);
+                ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(plain, sql, -1, &plainStmt, NULL));
+
+                int rows = 0;
+                while (sqlite3_step(plainStmt) == SQLITE_ROW) {
+                    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+                    const char *expected = (const char *) sqlite3_column_text(plainStmt, 0);
+                    if (expected == NULL) {
+                        ASSERT_EQ(SQLITE_NULL, sqlite3_column_type(stmt, 0));
+                    } else {
+                        ASSERT_STREQ(expected, (const char *) sqlite3_column_text(stmt, 0));
+                    }
+                    rows++;
+                }
+                ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+                ASSERT_LT(0, rows);
+                sqlite3_finalize(stmt);
+                sqlite3_finalize(plainStmt);
+
+                // every distinct value is stored once, and the loader keeps the same copy
+                snprintf(sql, sizeof(sql), "select count(*), count(distinct value) from dict_%s", columns[c][1]);
+                sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+                ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+                ASSERT_EQ(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+                ASSERT_EQ((size_t) sqlite3_column_int(stmt, 0), loader->dictionary(columns[c][1])->size());
+                sqlite3_finalize(stmt);
+            }
+
+            sqlite3_close(plain);
+            sqlite3_close(db);
+            delete loader;
+        }
+    }
+
+    TEST_F(BusDataTests, ShapeGeometryRoundTrips) {
+        std::vector<ShapePoint> points;
+        std::vector<ShapePoint> decoded;
+        std::string blob;
+        const double coordinates[][4] = {{40.737720, -74.245381, 1, 0.0}, {40.737714, -74.245511, 2, 0.0068},
+                {40.750758, -74.179943, 15, 7.1193}, {-33.868820, 151.209296, 16, 12345.6789}};
+
+        for (int i = 0; i < 4; i++) {
+            ShapePoint point = {coordinates[i][0], coordinates[i][1], (int64_t) coordinates[i][2], coordinates[i][3]};
+            points.push_back(point);
+        }
+        ShapeGeometry::encode(points, &blob);
+        ASSERT_TRUE(ShapeGeometry::decode(blob.data(), blob.size(), &decoded));
+        ASSERT_EQ(4u, decoded.size());
+        for (int i = 0; i < 4; i++) {
+            ASSERT_EQ(points[i].lat, decoded[i].lat);
+            ASSERT_EQ(points[i].lon, decoded[i].lon);
+            ASSERT_EQ(points[i].sequence, decoded[i].sequence);
+            ASSERT_EQ(points[i].dist, decoded[i].dist);
+        }
+
+        // the second point is 6 and 130 millionths of a degree and 0.0068 from the first:
+        // one byte each for lat and sequence, two each for lon and dist
+        std::string first;
+        points.resize(1);
+        ShapeGeometry::encode(points, &first);
+        points.push_back(decoded[1]);
+        blob.clear();
+        ShapeGeometry::encode(points, &blob);
+        ASSERT_EQ(first.size() + 6, blob.size());
+
+        // one point without a distance drops the distances of the whole shape
+        points[1].dist = NAN;
+        blob.clear();
+        ShapeGeometry::encode(points, &blob);
+        ASSERT_TRUE(ShapeGeometry::decode(blob.data(), blob.size(), &decoded));
+        ASSERT_EQ(2u, decoded.size());
+        ASSERT_TRUE(std::isnan(decoded[0].dist));
+        ASSERT_EQ(-74.245511, decoded[1].lon);
+
+        // digits past the fixed point steps are rounded away
+        points.resize(1);
+        points[0].lat = 40.12345678;
+        points[0].dist = 1.23456;
+        blob.clear();
+        ShapeGeometry::encode(points, &blob);
+        ASSERT_TRUE(ShapeGeometry::decode(blob.data(), blob.size(), &decoded));
+        ASSERT_EQ(40.123457, decoded[0].lat);
+        ASSERT_EQ(1.2346, decoded[0].dist);
+
+        ASSERT_FALSE(ShapeGeometry::decode(blob.data(), blob.size() - 1, &decoded));
+        ASSERT_TRUE(decoded.empty());
+        ASSERT_FALSE(ShapeGeometry::decode("\x02\x00\x00", 3, &decoded));
+    }
+
+
+    TEST_F(BusDataTests, MethodLoadDataShapeGeometry) {
+        const char *dbPath = "/tmp/busdata_test_shape_geom.db";
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+        std::vector<ShapePoint> points;
+
+        for (int concurrent = 0; concurrent < 2; concurrent++) {
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_shape_geometry(true);
+            loader->set_concurrent_tables(concurrent != 0);
+            loader->clear_old_database(dbPath);
+            loader->create_database(dbPath, NULL);
+            ASSERT_EQ(0, loader->load_data(RESOURCE_DIR_PATH, dbPath));
+            delete loader;
+
+            sqlite3_open(dbPath, &db);
+
+            sql = "select count(*) from sqlite_master where name = 'shape'";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(0, sqlite3_column_int(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            // shape 6493 is split around shape 1 in the file
+            sql = "select shape_id, point_count, geom from shape_geom order by shape_id";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(1, sqlite3_column_int(stmt, 0));
+            ASSERT_EQ(2, sqlite3_column_int(stmt, 1));
+            ASSERT_TRUE(ShapeGeometry::decode(sqlite3_column_blob(stmt, 2), sqlite3_column_bytes(stmt, 2), &points));
+            ASSERT_EQ(2u, points.size());
+            ASSERT_EQ(40.737720, points[0].lat);
+            ASSERT_EQ(-74.245511, points[1].lon);
+            ASSERT_EQ(0.0068, points[1].dist);
+
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(6493, sqlite3_column_int(stmt, 0));
+            ASSERT_EQ(3, sqlite3_column_int(stmt, 1));
+            ASSERT_TRUE(ShapeGeometry::decode(sqlite3_column_blob(stmt, 2), sqlite3_column_bytes(stmt, 2), &points));
+            ASSERT_EQ(3u, points.size());
+            ASSERT_EQ(15, points[0].sequence);
+            ASSERT_EQ(16, points[1].sequence);
+            ASSERT_EQ(17, points[2].sequence);
+            ASSERT_EQ(40.765668, points[2].lat);
+            ASSERT_EQ(8.2402, points[2].dist);
+            ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+            sqlite3_finalize(stmt);
+
+            sqlite3_close(db);
+        }
+
+        // without shapes.txt there is no geometry to store
+        const char *dirPath = "/tmp/busdata_no_shapes";
+        mkdir(dirPath, 0755);
+        remove(std::string(dirPath).append("/shapes.txt").c_str());
+        write_missing_feed_files(dirPath);
+
+        BusDataLoader *loader = new BusDataLoader();
+        loader->set_shape_geometry(true);
+        loader->clear_old_database(dbPath);
+        loader->create_database(dbPath, NULL);
+        ASSERT_EQ(1, loader->load_data(dirPath, dbPath));
+        delete loader;
+    }
+
+    TEST_F(BusDataTests, MethodLoadDataSpatialIndex) {
+        const char *dbPath = "/tmp/busdata_test_spatial.db";
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+        std::vector<NearbyStop> stops;
+
+        // one degree of latitude
+        ASSERT_NEAR(111195.0, SpatialIndex::haversine(40.0, -74.0, 41.0, -74.0), 1.0);
+        ASSERT_EQ(0.0, SpatialIndex::haversine(40.769019, -74.141421, 40.769019, -74.141421));
+
+        for (int geometry = 0; geometry < 2; geometry++) {
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_shape_geometry(geometry != 0);
+            loader->clear_old_database(dbPath);
+            loader->create_database(dbPath, NULL);
+            ASSERT_EQ(0, loader->load_data(RESOURCE_DIR_PATH, dbPath));
+            delete loader;
+
+            sqlite3_open(dbPath, &db);
+            ASSERT_EQ(4, get_table_count(db, "stop_rtree", NULL));
+            ASSERT_EQ(2, get_table_count(db, "shape_rtree", NULL));
+
+            // the boxes hold their points, float rounding aside
+            sql = "select min_lat, max_lat, min_lon, max_lon from shape_rtree where id = 6493";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_NEAR(40.750758, sqlite3_column_double(stmt, 0), 1e-5);
+            ASSERT_LE(sqlite3_column_double(stmt, 0), 40.750758);
+            ASSERT_GE(sqlite3_column_double(stmt, 1), 40.765668);
+            ASSERT_LE(sqlite3_column_double(stmt, 2), -74.179943);
+            ASSERT_NEAR(-74.175742, sqlite3_column_double(stmt, 3), 1e-5);
+            sqlite3_finalize(stmt);
+
+            // route 1 follows shape 1; route 48's shape 1333 is not in the feed
+            sql = "select id, min_lat from route_rtree";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(1, sqlite3_column_int(stmt, 0));
+            ASSERT_NEAR(40.737714, sqlite3_column_double(stmt, 1), 1e-5);
+            ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+            sqlite3_finalize(stmt);
+
+            // the rtree answers must rank like a scan of every stop
+            const double points[][2] = {{40.769019, -74.141421}, {40.9, -73.99}, {39.0, -75.0}, {-33.9, 151.2}};
+            for (size_t p = 0; p < sizeof(points) / sizeof(points[0]); p++) {
+                std::vector<std::pair<double, std::string> > expected;
+                sql = "select stop_id, stop_lat, stop_lon from stop";
+                sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+                while (sqlite3_step(stmt) == SQLITE_ROW) {
+                    expected.push_back(std::make_pair(SpatialIndex::haversine(points[p][0], points[p][1], sqlite3_column_double(stmt, 1), sqlite3_column_double(stmt, 2)),
+                            std::string((const char *) sqlite3_column_text(stmt, 0))));
+                }
+                sqlite3_finalize(stmt);
+                std::sort(expected.begin(), expected.end());
+
+                for (size_t count = 1; count <= 5; count++) {
+                    ASSERT_EQ(0, SpatialIndex::nearest_stops(db, points[p][0], points[p][1], count, &stops));
+                    ASSERT_EQ(std::min(count, expected.size()), stops.size());
+                    for (size_t i = 0; i < stops.size(); i++) {
+                        ASSERT_EQ(expected[i].second, stops[i].stop_id);
+                        ASSERT_EQ(expected[i].first, stops[i].distance);
+                    }
+                }
+            }
+            ASSERT_EQ(0, SpatialIndex::nearest_stops(db, 40.769019, -74.141421, 1, &stops));
+            ASSERT_EQ("7", stops[0].stop_id);
+            ASSERT_EQ(0.0, stops[0].distance);
+
+            sqlite3_close(db);
+        }
+    }
+
+    TEST_F(BusDataTests, MethodLoadDataTextSearch) {
+        const char *dbPath = "/tmp/busdata_test_search.db";
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+
+        ASSERT_EQ("\"main\"* \"st\"*", TextSearch::prefix_query("main st"));
+        ASSERT_EQ("\"AND\"* \"x\"*", TextSearch::prefix_query(" \"AND\" (x"));
+        ASSERT_EQ("\"caf\xc3\xa9\"*", TextSearch::prefix_query("caf\xc3\xa9-"));
+        ASSERT_EQ("", TextSearch::prefix_query("-- *"));
+
+        for (int encoded = 0; encoded < 2; encoded++) {
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_dictionary_encoding(encoded != 0);
+            loader->clear_old_database(dbPath);
+            loader->create_database(dbPath, NULL);
+            ASSERT_EQ(0, loader->load_data(RESOURCE_DIR_PATH, dbPath));
+            delete loader;
+
+            sqlite3_open(dbPath, &db);
+            ASSERT_EQ(2, get_table_count(db, "headsign", NULL));
+
+            const char *stopQueries[] = {"ma", "av", "city ha", "rd liberty", "zz"};
+            const int stopMatches[] = {1, 3, 1, 1, 0};
+            sql = "select count(*), min(stop.stop_id) from stop_search join stop on stop.id = stop_search.rowid where stop_search match ?";
+            for (size_t i = 0; i < sizeof(stopMatches) / sizeof(stopMatches[0]); i++) {
+                std::string query = TextSearch::prefix_query(stopQueries[i]);
+                sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+                sqlite3_bind_text(stmt, 1, query.c_str(), -1, SQLITE_TRANSIENT);
+                ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+                ASSERT_EQ(stopMatches[i], sqlite3_column_int(stmt, 0));
+                sqlite3_finalize(stmt);
+            }
+
+            // the stop_name column alone, ranked, with the name read back from the index's content
+            sql = "select stop_name from stop_search where stop_search match 'stop_name: \"main\"*' order by rank";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_STREQ("MAIN ST AT ADAMS AVE", (const char *) sqlite3_column_text(stmt, 0));
+            ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+            sqlite3_finalize(stmt);
+
+            sql = "select trip_headsign from headsign_search where headsign_search match ?";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            sqlite3_bind_text(stmt, 1, TextSearch::prefix_query("jersey ex").c_str(), -1, SQLITE_TRANSIENT);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_STREQ("1 JERSEY CITY EXCHANGE PL VIA RIVER TERMINAL-Exact Fare", (const char *) sqlite3_column_text(stmt, 0));
+            ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+            sqlite3_finalize(stmt);
+
+            sqlite3_close(db);
+        }
+    }
+
+    TEST_F(BusDataTests, MethodTableDescriptorSql) {
+        ASSERT_EQ("CREATE TABLE calendar_date (id INTEGER PRIMARY KEY, service_id INTEGER, date INTEGER, exception_type INTEGER)",
+                create_table_sql(CALENDAR_DATE_TABLE, NULL));
+        ASSERT_EQ("service_id, date, exception_type", column_list(CALENDAR_DATE_TABLE));
+
+        std::string clustered = create_table_sql(STOP_TIME_SECONDS_TABLE, "trip_id, stop_sequence");
+        ASSERT_EQ(0u, clustered.find("CREATE TABLE stop_time (id INTEGER, "));
+        ASSERT_NE(std::string::npos, clustered.find("shape_dist_traveled REAL, arrival_secs INTEGER, departure_secs INTEGER, PRIMARY KEY"));
+        ASSERT_NE(std::string::npos, clustered.find(", PRIMARY KEY (trip_id, stop_sequence)) WITHOUT ROWID"));
+        ASSERT_NE(std::string::npos, create_table_sql(STOP_TIME_TABLE, NULL).find("arrival_time VARCHAR"));
+    }
+
+    static bool stop_time_key_before(const StopTimeKey &a, const StopTimeKey &b, bool byStop) {
+        if (byStop && a.stop_id != b.stop_id) {
+            return a.stop_id < b.stop_id;
+        }
+        if (a.departure_secs != b.departure_secs) {
+            return a.departure_secs < b.departure_secs;
+        }
+        return a.trip_id != b.trip_id ? a.trip_id < b.trip_id : a.stop_sequence < b.stop_sequence;
+    }
+
+    TEST_F(BusDataTests, MethodStopTimeIndexSort) {
+        std::vector<StopTimeKey> keys(300000);
+        srand(7);
+        for (size_t i = 0; i < keys.size(); i++) {
+            keys[i].stop_id = (int64_t) (rand() % 5000) - 100 + (i % 3 == 0 ? ((int64_t) 1 << 40) : 0);
+            keys[i].trip_id = rand() % 20000;
+            keys[i].departure_secs = rand() % 100000;
+            keys[i].stop_sequence = rand() % 60 - 1;
+        }
+
+        for (int byStop = 0; byStop < 2; byStop++) {
+            for (unsigned int threads = 1; threads <= 3; threads += 2) {
+                std::vector<StopTimeKey> sorted(keys);
+                StopTimeIndex::sort(sorted, byStop ? StopTimeIndex::BY_STOP : StopTimeIndex::BY_DEPARTURE, threads);
+                ASSERT_EQ(keys.size(), sorted.size());
+                for (size_t i = 1; i < sorted.size(); i++) {
+                    ASSERT_FALSE(stop_time_key_before(sorted[i], sorted[i - 1], byStop != 0)) << i;
+                }
+            }
+        }
+    }
+
+    TEST_F(BusDataTests, MethodLoadDataPresortedIndexes) {
+        const char *dirPath = "/tmp/busdata_presorted";
+        const char *dbPath = "/tmp/busdata_test_presorted.db";
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        const char *sql;
+
+        // trips out of order, a stop time without a departure and one repeated
+        mkdir(dirPath, 0755);
+        std::ofstream os(std::string(dirPath).append("/stop_times.txt").c_str());
+        os << "trip_id,arrival_time,departure_time,stop_id,stop_sequence\n";
+        os << "12,08:00:00,08:00:00,300,1\n";
+        os << "12,08:10:00,08:11:00,200,2\n";
+        os << "11,07:55:00,07:55:00,200,1\n";
+        os << "11,,,300,2\n";
+        os << "11,8:20:00,8:20:00,100,3\n";
+        os << "11,8:20:00,8:20:00,100,3\n";
+        os << "10,25:01:00,25:01:30,200,1\n";
+        os.close();
+        write_missing_feed_files(dirPath);
+
+        const int expected[][4] = {{100, 30000, 11, 3}, {200, 28500, 11, 1}, {200, 29460, 12, 2}, {200, 90090, 10, 1}, {300, 28800, 12, 1}};
+
+        for (int mode = 0; mode < 3; mode++) {
+            if (mode == 2) {
+                os.open(std::string(dirPath).append("/stop_times.txt").c_str(), std::ios::app);
+                os << "10,25:05:00,25:05:00,North,2\n";
+                os.close();
+            }
+
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_presorted_indexes(true);
+            loader->set_virtual_table_import(mode == 1);
+            loader->set_time_columns(mode == 1 ? BusDataLoader::TIMES_SECONDS : BusDataLoader::TIMES_TEXT);
+            loader->clear_old_database(dbPath);
+            loader->create_database(dbPath, NULL);
+            ASSERT_EQ(0, loader->load_data(dirPath, dbPath));
+            delete loader;
+
+            sqlite3_open(dbPath, &db);
+
+            sql = "select count(*) from sqlite_master where name in ('idx_st_stop_id', 'idx_st_departure_time', 'idx_st_departure_secs')";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(mode == 2 ? 2 : 1, sqlite3_column_int(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            // the stop time without a departure is only found through idx_st_stop_id
+            sql = "select count(*) from stop_time indexed by idx_st_stop_id where stop_id = 300";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(2, sqlite3_column_int(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            if (mode == 2) {
+                // a stop_id that is not an integer leaves the plain indexes
+                ASSERT_NE(SQLITE_OK, sqlite3_prepare_v2(db, "select * from stop_time_by_stop", -1, &stmt, NULL));
+                sqlite3_finalize(stmt);
+                sqlite3_close(db);
+                continue;
+            }
+
+            sql = "select stop_id, departure_secs, trip_id, stop_sequence from stop_time_by_stop";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            for (size_t r = 0; r < sizeof(expected) / sizeof(expected[0]); r++) {
+                ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+                for (int c = 0; c < 4; c++) {
+                    ASSERT_EQ(expected[r][c], sqlite3_column_int(stmt, c));
+                }
+            }
+            ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+            sqlite3_finalize(stmt);
+
+            sql = "select group_concat(trip_id || ':' || stop_id, ' ') from (select trip_id, stop_id from stop_time_by_departure where departure_secs >= 28800)";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_STREQ("12:300 12:200 11:100 10:200", (const char *) sqlite3_column_text(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            sqlite3_close(db);
+        }
+    }
+
+    TEST_F(BusDataTests, MethodLoadDataQueryPlans) {
+        const char *dirPath = "/tmp/busdata_plans";
+        const char *dbPath = "/tmp/busdata_test_plans.db";
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+        std::vector<std::string> problems;
+        char line[256];
+
+        // a small feed shaped like a real one: many stops, trips of 25 stops, 60 service days
+        mkdir(dirPath, 0755);
+        std::ofstream os(std::string(dirPath).append("/stops.txt").c_str());
+        os << "stop_id,stop_code,stop_name,stop_desc,stop_lat,stop_lon,zone_id\n";
+        for (int s = 0; s < 500; s++) {
+            snprintf(line, sizeof(line), "%d,%d,STOP %d,,40.%04d,-74.%04d,1\n", 1000 + s, s, s, s * 7, s * 11);
+            os << line;
+        }
+        os.close();
+        os.open(std::string(dirPath).append("/trips.txt").c_str());
+        os << "route_id,service_id,trip_id,trip_headsign,direction_id,block_id,shape_id\n";
+        for (int t = 0; t < 400; t++) {
+            snprintf(line, sizeof(line), "%d,%d,%d,TO %d,%d,,\n", t % 10, t % 3, t, t % 10, t % 2);
+            os << line;
+        }
+        os.close();
+        os.open(std::string(dirPath).append("/stop_times.txt").c_str());
+        os << "trip_id,arrival_time,departure_time,stop_id,stop_sequence\n";
+        for (int t = 0; t < 400; t++) {
+            for (int s = 0; s < 25; s++) {
+                int secs = 18000 + t * 120 + s * 90;
+                snprintf(line, sizeof(line), "%d,%02d:%02d:%02d,%02d:%02d:%02d,%d,%d\n", t, secs / 3600, secs / 60 % 60, secs % 60,
+                        secs / 3600, secs / 60 % 60, secs % 60, 1000 + (t * 7 + s * 13) % 500, s + 1);
+                os << line;
+            }
+        }
+        os.close();
+        os.open(std::string(dirPath).append("/calendar_dates.txt").c_str());
+        os << "service_id,date,exception_type\n";
+        for (int d = 1; d <= 60; d++) {
+            for (int service = 0; service < 3; service++) {
+                snprintf(line, sizeof(line), "%d,2012%02d%02d,1\n", service, 4 + (d - 1) / 30, (d - 1) % 30 + 1);
+                os << line;
+            }
+        }
+        os.close();
+
+        const BusDataLoader::TimeColumns modes[] = {BusDataLoader::TIMES_TEXT, BusDataLoader::TIMES_SECONDS, BusDataLoader::TIMES_SECONDS};
+        for (int m = 0; m < 3; m++) {
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_time_columns(modes[m]);
+            loader->set_presorted_indexes(m == 2);
+            loader->clear_old_database(dbPath);
+            loader->create_database(dbPath, NULL);
+            ASSERT_EQ(0, loader->load_data(dirPath, dbPath));
+            delete loader;
+
+            sqlite3_open(dbPath, &db);
+            ASSERT_EQ(10000, get_table_count(db, "stop_time", NULL));
+
+            const char *sql = "select stat from sqlite_stat1 where idx = 'idx_t_trip_id'";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_STREQ("400 1", (const char *) sqlite3_column_text(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            problems.clear();
+            ASSERT_EQ(5u, QueryPlans::check(db, &problems));
+            for (size_t i = 0; i < problems.size(); i++) {
+                ADD_FAILURE() << problems[i];
+            }
+
+            if (m == 0) {
+                // statistics claiming every stop has half the stop times push the board onto another index
+                ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "update sqlite_stat1 set stat = '10000 5000' where idx = 'idx_st_stop_id'; "
+                        "analyze sqlite_master", NULL, NULL, NULL));
+                problems.clear();
+                QueryPlans::check(db, &problems);
+                ASSERT_EQ(1u, problems.size());
+                ASSERT_EQ(0u, problems[0].find("departure_board: st is not searched with idx_st_stop_id"));
+            }
+
+            sqlite3_close(db);
+        }
+
+        // the same statistics left on stop_time fail a reload of calendar_date, which is then not published
+        BusDataLoader *loader = new BusDataLoader();
+        loader->set_incremental_reload(true);
+        ASSERT_EQ(0, loader->load_data(dirPath, dbPath));
+        delete loader;
+        sqlite3_open(dbPath, &db);
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "update sqlite_stat1 set stat = '10000 5000' where idx = 'idx_st_stop_id'", NULL, NULL, NULL));
+        sqlite3_close(db);
+
+        std::ifstream is(dbPath, std::ios::binary);
+        std::ostringstream served;
+        served << is.rdbuf();
+        is.close();
+
+        os.open(std::string(dirPath).append("/calendar_dates.txt").c_str(), std::ios::app);
+        os << "0,20120601,1\n";
+        os.close();
+        loader = new BusDataLoader();
+        loader->set_incremental_reload(true);
+        ASSERT_NE(0, loader->load_data(dirPath, dbPath));
+        delete loader;
+
+        is.open(dbPath, std::ios::binary);
+        std::ostringstream after;
+        after << is.rdbuf();
+        is.close();
+        ASSERT_TRUE(served.str() == after.str());
+        sqlite3_open(dbPath, &db);
+        ASSERT_EQ(180, get_table_count(db, "calendar_date", NULL));
+        sqlite3_close(db);
+    }
+
+    TEST_F(BusDataTests, MethodLoadDataStopDepartures) {
+        const char *dirPath = "/tmp/busdata_departures";
+        const char *dbPath = "/tmp/busdata_test_departures.db";
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+
+        mkdir(dirPath, 0755);
+        std::ofstream os(std::string(dirPath).append("/stops.txt").c_str());
+        os << "stop_id,stop_code,stop_name,stop_desc,stop_lat,stop_lon,zone_id\n";
+        os << "1,1,FIRST,,40.1,-74.1,1\n";
+        os << "2,2,SECOND,,40.2,-74.2,1\n";
+        os << "3,3,THIRD,,40.3,-74.3,1\n";
+        os.close();
+        os.open(std::string(dirPath).append("/trips.txt").c_str());
+        os << "route_id,service_id,trip_id,trip_headsign,direction_id,block_id,shape_id\n";
+        os << "10,1,1,NORTH,0,,\n";
+        os << "20,2,2,SOUTH,1,,\n";
+        os << "10,1,3,NORTH,0,,\n";
+        os.close();
+        os.open(std::string(dirPath).append("/stop_times.txt").c_str());
+        os << "trip_id,arrival_time,departure_time,stop_id,stop_sequence\n";
+        os << "1,08:00:00,08:00:00,1,1\n";
+        os << "1,08:10:00,08:10:00,2,2\n";
+        os << "2,07:30:00,07:30:00,1,1\n";
+        os << "2,07:45:00,07:45:00,2,2\n";
+        os << "3,24:30:00,24:30:00,1,1\n";
+        os << "3,25:00:00,25:00:00,3,2\n";
+        os << "9,09:00:00,09:00:00,1,1\n";
+        os.close();
+        os.open(std::string(dirPath).append("/calendar_dates.txt").c_str());
+        os << "service_id,date,exception_type\n";
+        os << "1,20120331,1\n";
+        os << "1,20120401,1\n";
+        os << "2,20120401,1\n";
+        os << "2,20120402,1\n";
+        os.close();
+
+        // from the first service date, with the keys read back and with the presorted keys
+        for (int m = 0; m < 2; m++) {
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_time_columns(m == 0 ? BusDataLoader::TIMES_TEXT : BusDataLoader::TIMES_SECONDS);
+            loader->set_presorted_indexes(m == 1);
+            loader->set_dictionary_encoding(m == 1);
+            loader->set_departure_window(m == 0 ? 0 : 20120331, 3);
+            loader->clear_old_database(dbPath);
+            loader->create_database(dbPath, NULL);
+            ASSERT_EQ(0, loader->load_data(dirPath, dbPath));
+            delete loader;
+
+            sqlite3_open(dbPath, &db);
+
+            // two days of trips 1 and 3, two of trip 2, none of trip 9
+            ASSERT_EQ(12, get_table_count(db, "stop_departure", NULL));
+
+            const char *sql = "select service_date, departure_secs, trip_id, route_id, h.trip_headsign from stop_departure d "
+                    "join headsign h on h.id = d.headsign_code where stop_id = 1";
+            const int64_t expected[][4] = {
+                    {20120331, 28800, 1, 10}, {20120331, 88200, 3, 10},
+                    {20120401, 27000, 2, 20}, {20120401, 28800, 1, 10}, {20120401, 88200, 3, 10},
+                    {20120402, 27000, 2, 20}};
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            for (int i = 0; i < 6; i++) {
+                ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+                for (int c = 0; c < 4; c++) {
+                    ASSERT_EQ(expected[i][c], sqlite3_column_int64(stmt, c));
+                }
+                ASSERT_STREQ(expected[i][2] == 2 ? "SOUTH" : "NORTH", (const char *) sqlite3_column_text(stmt, 4));
+            }
+            ASSERT_EQ(SQLITE_DONE, sqlite3_step(stmt));
+            sqlite3_finalize(stmt);
+
+
+            // trip 3 runs past midnight on the date it started
+            sql = "select count(*) from stop_departure where stop_id = 3 and departure_secs = 90000";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(2, sqlite3_column_int(stmt, 0));
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+        }
+    }
+
+    TEST_F(BusDataTests, MethodLoadDataIncremental) {
+        const char *dirPath = "/tmp/busdata_incremental";
+        const char *dbPath = "/tmp/busdata_test_incremental.db";
+        sqlite3 *db;
+        sqlite3_stmt *stmt;
+
+        // reference XXH64 values
+        ASSERT_EQ(0xEF46DB3751D8E999ULL, FeedMeta::hash("", 0));
+        ASSERT_EQ(0x44BC2CF5AD770999ULL, FeedMeta::hash("abc", 3));
+        ASSERT_EQ(0xFBCEA83C8A378BF1ULL, FeedMeta::hash("Nobody inspects the spammish repetition", 39));
+
+        mkdir(dirPath, 0755);
+        std::ofstream os(std::string(dirPath).append("/stops.txt").c_str());
+        os << "stop_id,stop_code,stop_name,stop_desc,stop_lat,stop_lon,zone_id\n";
+        os << "1,1,FIRST,,40.1,-74.1,1\n";
+        os << "2,2,SECOND,,40.2,-74.2,1\n";
+        os.close();
+        os.open(std::string(dirPath).append("/trips.txt").c_str());
+        os << "route_id,service_id,trip_id,trip_headsign,direction_id,block_id,shape_id\n";
+        os << "10,1,1,NORTH,0,,\n";
+        os.close();
+        os.open(std::string(dirPath).append("/stop_times.txt").c_str());
+        os << "trip_id,arrival_time,departure_time,stop_id,stop_sequence\n";
+        os << "1,08:00:00,08:00:00,1,1\n";
+        os << "1,08:10:00,08:10:00,2,2\n";
+        os.close();
+        os.open(std::string(dirPath).append("/calendar_dates.txt").c_str());
+        os << "service_id,date,exception_type\n";
+        os << "1,20120401,1\n";
+        os.close();
+
+        // first load, nothing changed, calendar_dates.txt changed, then other settings
+        for (int run = 0; run < 4; run++) {
+            if (run == 2) {
+                os.open(std::string(dirPath).append("/calendar_dates.txt").c_str(), std::ios::app);
+                os << "1,20120402,1\n";
+                os.close();
+            }
+
+            BusDataLoader *loader = new BusDataLoader();
+            loader->set_incremental_reload(true);
+            loader->set_time_columns(run == 3 ? BusDataLoader::TIMES_SECONDS : BusDataLoader::TIMES_TEXT);
+            loader->set_departure_window(20120401, 2);
+            ASSERT_EQ(0, loader->load_data(dirPath, dbPath));
+            delete loader;
+
+            sqlite3_open(dbPath, &db);
+            ASSERT_EQ(8, get_table_count(db, "feed_meta", NULL));
+            ASSERT_EQ(2, get_table_count(db, "stop_time", NULL));
+            ASSERT_EQ(run < 2 ? 1 : 2, get_table_count(db, "calendar_date", NULL));
+            ASSERT_EQ(run < 2 ? 2 : 4, get_table_count(db, "stop_departure", NULL));
+
+            // a table only a full load would remove shows which tables were rebuilt
+            const char *sql = "select count(*) from sqlite_master where name in ('kept', 'idx_st_stop_id', 'idx_cd_date', 'stop_rtree')";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(run == 0 || run == 3 ? 3 : 4, sqlite3_column_int(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            sql = "select day_count from service_calendar where service_id = 1";
+            sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+            ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            ASSERT_EQ(run < 2 ? 1 : 2, sqlite3_column_int(stmt, 0));
+            sqlite3_finalize(stmt);
+
+            if (run == 0) {
+                ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "create table kept (x INTEGER)", NULL, NULL, NULL));
+            }
+            sqlite3_close(db);
+        }
+
+        // a reload that fails is never published: the stops and the digests stay as they were
+        struct stat info;
+        os.open(std::string(dirPath).append("/stops.txt").c_str());
+        os.close();
+        BusDataLoader *loader = new BusDataLoader();
+        loader->set_incremental_reload(true);
+        loader->set_time_columns(BusDataLoader::TIMES_SECONDS);
+        loader->set_departure_window(20120401, 2);
+        ASSERT_EQ(1, loader->load_data(dirPath, dbPath));
+        delete loader;
+        ASSERT_NE(0, stat(std::string(dbPath).append(".building").c_str(), &info));
+        ASSERT_NE(0, stat(std::string(dbPath).append("-journal").c_str(), &info));
+
+        sqlite3_open(dbPath, &db);
+        ASSERT_EQ(2, get_table_count(db, "stop", NULL));
+        ASSERT_EQ(8, get_table_count(db, "feed_meta", NULL));
+        sqlite3_close(db);
+    }
+
+    /*!
+     * Rows/sec for stop_time and shape with single-row and multi-row INSERTs. Run with
+     * --gtest_also_run_disabled_tests; stop_time timings include its index builds.
+     */
+    TEST_F(BusDataTests, DISABLED_BenchmarkInsertBatching) {
+        const char *tables[] = {"stop_time", "shape"};
+        const char *files[] = {"stop_times.txt", "shapes.txt"};
+        const size_t batchRows[] = {1, 64};
+        const int rows = 500000;
+
+        for (int t = 0; t < 2; t++) {
+            std::string dirPath = std::string("/tmp/busdata_bench_").append(tables[t]);
+            mkdir(dirPath.c_str(), 0755);
+            std::ofstream os(std::string(dirPath).append("/").append(files[t]).c_str());
+            if (t == 0) {
+                os << "trip_id,arrival_time,departure_time,stop_id,stop_sequence,pickup_type,drop_off_type,shape_dist_traveled\r\n";
+                for (int i = 0; i < rows; i++) {
+                    os << 10000 + i / 40 << ",06:" << 10 + i % 40 << ":00,06:" << 10 + i % 40 << ":30," << 20000 + i % 7919 << "," << i % 40 + 1 << ",0,0," << (i % 40) * 0.3125 << "\r\n";
+                }
+            } else {
+                os << "shape_id,shape_pt_lat,shape_pt_lon,shape_pt_sequence,shape_dist_traveled\r\n";
+                for (int i = 0; i < rows; i++) {
+                    os << 3000 + i / 500 << ",40." << 700000 + i % 99991 << ",-74." << 100000 + i % 99989 << "," << i % 500 + 1 << "," << (i % 500) * 0.0625 << "\r\n";
+                }
+            }
+            os.close();
+
+            for (int b = 0; b < 2; b++) {
+                const char *dbPath = "/tmp/busdata_bench.db";
+                sqlite3 *db;
+                int code;
+
+                BusDataLoader *loader = new BusDataLoader();
+                loader->set_fast_build(true);
+                loader->set_insert_batch_rows(batchRows[b]);
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                ASSERT_EQ(0, loader->load_data(dirPath.c_str(), dbPath));
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                delete loader;
+
+                sqlite3_open(dbPath, &db);
+                ASSERT_EQ(rows, get_table_count(db, tables[t], &code));
+                sqlite3_close(db);
+
+                printf("BENCH %s, %zu row(s) per INSERT: %.0f rows/sec\n", tables[t], batchRows[b], rows / seconds);
+            }
+        }
+    }
+
+
 }
@@ -23,6 +23,18 @@ class BusDataTests : public ::testing::Test {
 
     static int get_table_count(sqlite3 *db, char const *table, int *status);
 
+    /*!
+     * Checks that the database at dbPath holds the row counts of the test feed in
+     * RESOURCE_DIR_PATH.
+     */
+    static void assert_feed_counts(const char *dbPath);
+
+    /*!
+     * Writes a header-only stops.txt, trips.txt or stop_times.txt for each that is not
+     * in dirPath, so a test feed can hold just the files it is about.
+     */
+    static void write_missing_feed_files(const char *dirPath);
+
 };
 
 #endif //__BusDataTests_H_